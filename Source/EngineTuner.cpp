@@ -0,0 +1,278 @@
+/*
+==============================================================================
+
+EngineTuner.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "EngineTuner.h"
+#include "NoteTables.h"
+#include "WaveguideString.h"
+
+namespace {
+    constexpr double sampleRate = 48000.0;                  // Sample rate of the benchmarks
+    constexpr int chunkSamples = 96;                        // Samples per timed chunk
+
+    /* Geometry of a key in the default preset*/
+    KeyGeometry defaultKey(int midiNoteNumber) {
+        NoteParameters p { 5.0f, 20.0f, 1.0f, 15.0f, 5.0f, 190.0f, 8000.0f, 0.3f, 0.5f, 1.0f, 1.0f, 14.0f, 30.0f };
+        return KeyGeometry::compute(midiNoteNumber, p, sampleRate);
+    }
+
+    /* Fastest time per sample of process(numSamples) over chunks of chunkSamples, for about seconds (s)*/
+    template <typename Process>
+    double fastestPerSample(Process&& process, double seconds) {
+        double best = std::numeric_limits<double>::max();
+        const juce::int64 end = juce::Time::getHighResolutionTicks() + juce::Time::secondsToHighResolutionTicks(seconds);
+        do {
+            juce::int64 start = juce::Time::getHighResolutionTicks();
+            process(chunkSamples);
+            best = juce::jmin(best, juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start));
+        } while (juce::Time::getHighResolutionTicks() < end);
+        return best / chunkSamples;
+    }
+
+    /* Sets up a string of the default middle C with gridSize points and strikes it*/
+    void strike(String& s, int gridSize) {
+        StringCoefficients c = defaultKey(60).coefficients;
+        c.N = gridSize;
+        s.setsampleRate(float(sampleRate));
+        s.setExcCoordinates(0.3f, 0.5f);
+        s.setCoefficients(c);
+        s.initGrid();
+        for (int n = 0; n < 64; n++) {
+            s.setForce(n < 32 ? 1.0f : 0.0f);
+            s.process();
+        }
+    }
+
+    /* Strings rendered on the pool by tuneHelpers()*/
+    struct HelperJob {
+        juce::OwnedArray<String> strings;
+        std::vector<float> sums;                            // Output of each string, so that the work is not optimised away
+
+        static void render(void* context, int index) {
+            auto* job = static_cast<HelperJob*>(context);
+            String* s = job->strings.getUnchecked(index);
+            float sum = 0.0f;
+            for (int n = 0; n < 1024; n++) {
+                sum += s->process();
+            }
+            job->sums[size_t(index)] += sum;
+        }
+    };
+}
+
+EngineTuner::EngineTuner(WorkerPool& pool) : juce::Thread("AnyPiano engine tuner"), workerPool(pool) {
+}
+
+EngineTuner::~EngineTuner() {
+    stopThread(4000);
+}
+
+void EngineTuner::start() {
+    EngineProfile profile;
+    if (load(profile)) {
+        publish(profile);
+    }
+    else {
+        startThread(1);
+    }
+}
+
+void EngineTuner::retune() {
+    stopThread(4000);
+    startThread(1);
+}
+
+bool EngineTuner::waitUntilTuned(int timeoutMs) {
+    return waitForThreadToExit(timeoutMs);
+}
+
+const EngineProfile* EngineTuner::getProfile() const {
+    return current.load();
+}
+
+std::atomic<const EngineProfile*>* EngineTuner::getProfilePointer() {
+    return &current;
+}
+
+juce::File EngineTuner::getProfileFile() {
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("AnyPiano").getChildFile("EngineProfile")
+        .getChildFile(juce::String::toHexString(getMachineId().hashCode64()) + ".xml");
+}
+
+juce::String EngineTuner::describe(const EngineProfile& profile) {
+    return "grid point cost " + juce::String(profile.gridPointCost, 2)
+        + ", helpers " + (profile.maxHelpers == std::numeric_limits<int>::max() ? juce::String("all") : juce::String(profile.maxHelpers));
+}
+
+void EngineTuner::run() {
+    juce::ScopedNoDenormals noDenormals;
+    while (waitUntilIdle()) {
+        // Keep the profile only if nothing else used the pool while it was measured
+        const juce::uint32 jobs = workerPool.getNumJobs();
+        ownJobs = 0;
+        EngineProfile profile;
+        if (!tune(profile)) {
+            return;
+        }
+        if (workerPool.getNumJobs() - jobs == ownJobs) {
+            save(profile);
+            publish(profile);
+            return;
+        }
+    }
+}
+
+bool EngineTuner::waitUntilIdle() {
+    for (;;) {
+        const juce::uint32 jobs = workerPool.getNumJobs();
+        wait(idleMs);
+        if (threadShouldExit()) {
+            return false;
+        }
+        if (workerPool.getNumJobs() == jobs) {
+            return true;
+        }
+    }
+}
+
+bool EngineTuner::tune(EngineProfile& profile) {
+    // Cost of a string as a + b N per sample, from a least squares fit over grid sizes
+    const int sizes[] = { 64, 128, 256, 512 };
+    double sumN = 0.0, sumT = 0.0, sumNN = 0.0, sumNT = 0.0;
+    for (int n : sizes) {
+        if (threadShouldExit()) {
+            return false;
+        }
+        double t = timeString(n);
+        sumN += n;
+        sumT += t;
+        sumNN += double(n) * n;
+        sumNT += double(n) * t;
+    }
+    const double count = double(juce::numElementsInArray(sizes));
+    const double perPoint = (count * sumNT - sumN * sumT) / (count * sumNN - sumN * sumN);
+    const double fixed = juce::jmax(0.0, (sumT - perPoint * sumN) / count);
+
+    // Grid size at which the waveguide costs as much as the string, which sets the cost of a grid point
+    // in the units of WaveguideString::estimateCost()
+    int numAllpasses = 0;
+    double waveguide = timeWaveguide(numAllpasses);
+    if (threadShouldExit()) {
+        return false;
+    }
+    if (perPoint > 0.0 && waveguide > 0.0) {
+        double crossover = juce::jmax(double(String::minGridSize), (waveguide - fixed) / perPoint);
+        profile.gridPointCost = float(WaveguideString::estimateCost(numAllpasses) / crossover);
+    }
+
+    profile.maxHelpers = tuneHelpers();
+    return !threadShouldExit();
+}
+
+double EngineTuner::timeString(int gridSize) {
+    String s;
+    strike(s, gridSize);
+
+    float sum = 0.0f;
+    double seconds = fastestPerSample([&](int numSamples) {
+        for (int n = 0; n < numSamples; n++) {
+            sum += s.process();
+        }
+    }, benchmarkSeconds);
+    return std::isfinite(sum) ? seconds : 0.0;
+}
+
+double EngineTuner::timeWaveguide(int& numAllpasses) {
+    KeyGeometry g = defaultKey(48);
+    WaveguideString w;
+    w.setsampleRate(float(sampleRate));
+    w.setMaterial(190.0e9f, 8000.0f);
+    w.setExcCoordinates(0.3f, 0.5f);
+    w.setParameters(g.frequency, g.length, g.radius / 1000.0f, 5.0f);
+    w.initGrid();
+    numAllpasses = w.getNumAllpasses();
+    for (int n = 0; n < 64; n++) {
+        w.setForce(n < 32 ? 1.0f : 0.0f);
+        w.process();
+    }
+
+    float sum = 0.0f;
+    double seconds = fastestPerSample([&](int numSamples) {
+        for (int n = 0; n < numSamples; n++) {
+            sum += w.process();
+        }
+    }, benchmarkSeconds);
+    return std::isfinite(sum) ? seconds : 0.0;
+}
+
+int EngineTuner::tuneHelpers() {
+    // Two strings per thread, each long enough to be worth handing to a worker
+    const int numThreads = workerPool.getNumThreads();
+    HelperJob job;
+    for (int i = 0; i < 2 * (numThreads + 1); i++) {
+        strike(*job.strings.add(new String()), 256);
+    }
+    job.sums.assign(size_t(job.strings.size()), 0.0f);
+
+    std::vector<double> seconds;
+    for (int helpers = 0; helpers <= numThreads && !threadShouldExit(); helpers++) {
+        double best = std::numeric_limits<double>::max();
+        for (int repeat = 0; repeat < 5; repeat++) {
+            juce::int64 start = juce::Time::getHighResolutionTicks();
+            workerPool.run(&HelperJob::render, &job, job.strings.size(), helpers);
+            ownJobs++;
+            best = juce::jmin(best, juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start));
+        }
+        seconds.push_back(best);
+    }
+    if (seconds.empty()) {
+        return std::numeric_limits<int>::max();
+    }
+
+    double fastest = *std::min_element(seconds.begin(), seconds.end());
+    for (size_t helpers = 0; helpers < seconds.size(); helpers++) {
+        if (seconds[helpers] <= 1.1 * fastest) {
+            return int(helpers);
+        }
+    }
+    return numThreads;
+}
+
+void EngineTuner::publish(const EngineProfile& profile) {
+    current = profiles.add(new EngineProfile(profile));
+}
+
+bool EngineTuner::load(EngineProfile& profile) {
+    std::unique_ptr<juce::XmlElement> xml(juce::XmlDocument::parse(getProfileFile()));
+    if (xml == nullptr || !xml->hasTagName("ENGINEPROFILE") || xml->getIntAttribute("version") != version
+        || xml->getStringAttribute("machine") != getMachineId()) {
+        return false;
+    }
+    profile.gridPointCost = float(xml->getDoubleAttribute("gridPointCost", profile.gridPointCost));
+    profile.maxHelpers = xml->getIntAttribute("maxHelpers", profile.maxHelpers);
+    return std::isfinite(profile.gridPointCost) && profile.gridPointCost > 0.0f && profile.maxHelpers >= 0;
+}
+
+bool EngineTuner::save(const EngineProfile& profile) {
+    juce::XmlElement xml("ENGINEPROFILE");
+    xml.setAttribute("version", version);
+    xml.setAttribute("machine", getMachineId());
+    xml.setAttribute("gridPointCost", profile.gridPointCost);
+    xml.setAttribute("maxHelpers", profile.maxHelpers);
+
+    juce::File file = getProfileFile();
+    file.getParentDirectory().createDirectory();
+    return xml.writeTo(file);
+}
+
+juce::String EngineTuner::getMachineId() {
+    return juce::SystemStats::getCpuVendor() + " " + juce::SystemStats::getCpuModel()
+        + " " + juce::String(juce::SystemStats::getNumPhysicalCpus()) + "/" + juce::String(juce::SystemStats::getNumCpus())
+        + " " + juce::SystemStats::getComputerName();
+}
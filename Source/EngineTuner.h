@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    EngineTuner.h
+    Author:  Ruthu Prem Kumar
+
+    Measures the engine settings which depend on the machine rather than on
+    the preset, and stores them in a profile file per machine.
+
+    On first launch (no profile for this machine, or one written by an older
+    kernel version) a background thread waits for the worker pool to be idle
+    for idleMs, so that no instance is rendering, then runs short
+    micro-benchmarks :
+    - String updates at several grid sizes and WaveguideString updates, which
+      set the grid size above which Note::chooseEngine() plays a waveguide
+    - the same block of strings on the worker pool with more and more helpers,
+      to find the point past which more threads no longer help.
+    Each benchmark keeps the fastest of many short chunks, so that being
+    preempted by the host does not count, and the whole run takes well under
+    a second. If the pool ran any other job meanwhile, the results are
+    dropped and the tuner waits for the pool to be idle again : a profile
+    measured under load is never published or stored, the defaults stay in
+    use until then. Later starts load the profile instantly, retune()
+    measures again on demand (also once idle).
+
+    Profiles are published through an atomic pointer and never deleted before
+    the tuner, so the audio thread can read one without any lock.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "WorkerPool.h"
+
+/* Engine settings measured for a machine, the defaults are the hand-tuned values*/
+struct EngineProfile {
+    float gridPointCost = 12.0f;                            // Cost of a String grid point per sample, in the units of WaveguideString::estimateCost()
+    int maxHelpers = std::numeric_limits<int>::max();       // Workers past which a block of voices renders no faster
+};
+
+class EngineTuner : private juce::Thread {
+public:
+
+    static constexpr int version = 1;                       // Kernel version, profiles of another version are tuned again
+    static constexpr double benchmarkSeconds = 0.04;        // Time spent on each benchmark (s)
+    static constexpr int idleMs = 500;                      // Time without pool jobs before tuning starts (ms)
+
+    EngineTuner(WorkerPool& pool);
+    ~EngineTuner() override;
+
+    /* Loads the profile of this machine, or tunes it in the background if there is none*/
+    void start();
+
+    /* Tunes again in the background, replacing the stored profile*/
+    void retune();
+
+    /* Waits for tuning in progress to finish, returns false on timeout (-1 waits forever)*/
+    bool waitUntilTuned(int timeoutMs);
+
+    /* Current profile, nullptr until one is loaded or tuned (any thread)*/
+    const EngineProfile* getProfile() const;
+
+    /* Pointer the synthesiser reads the current profile from (see PianoSynthesiser::setEngineProfile())*/
+    std::atomic<const EngineProfile*>* getProfilePointer();
+
+    /* File the profile of this machine is stored in*/
+    static juce::File getProfileFile();
+
+    /* One line description of a profile*/
+    static juce::String describe(const EngineProfile& profile);
+
+private:
+
+    void run() override;
+
+    /* Waits until the pool has run no job for idleMs, returns false if the thread was asked to stop*/
+    bool waitUntilIdle();
+
+    /* Runs every benchmark, returns false if the thread was asked to stop*/
+    bool tune(EngineProfile& profile);
+
+    /* Fastest time per sample of a String with gridSize points (s)*/
+    double timeString(int gridSize);
+
+    /* Fastest time per sample of the WaveguideString of a middle key (s), and its number of dispersion filters*/
+    double timeWaveguide(int& numAllpasses);
+
+    /* Fewest helpers rendering a block of strings on the pool within 10 % of the fastest*/
+    int tuneHelpers();
+
+    /* Keeps the profile until the tuner is deleted and makes it the current one*/
+    void publish(const EngineProfile& profile);
+
+    bool load(EngineProfile& profile);
+    bool save(const EngineProfile& profile);
+
+    /* Identifies the machine : CPU, core counts and host name*/
+    static juce::String getMachineId();
+
+    WorkerPool& workerPool;
+    juce::uint32 ownJobs = 0;                               // Pool jobs run by tuneHelpers()
+    std::atomic<const EngineProfile*> current { nullptr };
+    juce::OwnedArray<EngineProfile> profiles;               // Every profile published, a few per session at most
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(EngineTuner)
+};
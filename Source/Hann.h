@@ -22,6 +22,11 @@
 class Hann {
 public:
 
+	/* Destructor*/
+	~Hann() {
+		delete[] f;
+	}
+
 
 	/* Returns a full Hann window with duration dur(in samples) and peak amplitude famp*/
 	float* fullHann() {
@@ -52,6 +57,7 @@ public:
 	/* Set duration of force signal in samples*/
 	void setDur(int d) {
 		dur = d;
+		delete[] f;
 		f = new float[dur];
 	}
 	int getDur() {
@@ -60,7 +66,7 @@ public:
 
 private:
 
-	float *f;                           // Force signal
+	float *f = nullptr;                 // Force signal
 	float famp;                         // Peak amplitude of input (N)
 	int dur;                            // Duration of input in samples
 
@@ -0,0 +1,511 @@
+/*
+==============================================================================
+
+ImpulseResponses.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "ImpulseResponses.h"
+
+// =================================
+// Set : the responses of one preset
+class ImpulseResponses::Set {
+public:
+    Set(juce::int64 setHash, const NoteParameters& p, float pickupSpread, double sr, int channels)
+        : hash(setHash), parameters(p), spread(pickupSpread), sampleRate(sr), numChannels(channels) {
+        for (auto& key : keys) {
+            key.store(nullptr);
+        }
+    }
+
+    const juce::int64 hash;                                 // Hash of the preset, pickups and sample rate
+    const NoteParameters parameters;                        // Preset of the responses
+    const float spread;                                     // Spread of the pickups around xo
+    const double sampleRate;                                // Sample rate of the responses
+    const int numChannels;                                  // Pickups of the responses
+    std::atomic<const KeyResponse*> keys[numKeys];          // Published responses per key
+    std::unique_ptr<KeyResponse> owned[numKeys];            // Owners of the responses (renderer thread)
+    int numClients = 0;                                     // Number of clients on this set (under the lock)
+    std::atomic<int> readers { 0 };                         // Number of voices playing from this set
+};
+
+// =================================
+// Convolver
+ImpulseResponses::Convolver::~Convolver() {
+    stop();
+}
+
+void ImpulseResponses::Convolver::prepare(double sampleRate, int numChannels) {
+    stop();
+
+    // The uniform level holds enough blocks for the longest response
+    const int maxLength = juce::roundToInt(maxSeconds * sampleRate);
+    maxChannels = juce::jlimit(1, String::maxPickups, numChannels);
+    input.assign(size_t(ringSize), 0.0f);
+    output.assign(size_t(maxChannels * ringSize), 0.0f);
+    for (int level = 0; level < numLevels; level++) {
+        const int blockSize = getBlockSize(level);
+        maxPartitions[level] = level < numLevels - 1 ? 1 : juce::jmax(1, (maxLength - tailStart + tailStart - 1) / tailStart);
+        delayLine[level].assign(size_t(maxPartitions[level] * (blockSize + 1) * 2), 0.0f);
+        silent[level].assign(size_t(maxPartitions[level]), 1);
+        newest[level] = 0;
+        fft[level].reset(new juce::dsp::FFT(juce::roundToInt(std::log2(2 * blockSize))));
+    }
+    buffer.assign(size_t(4 * tailStart), 0.0f);
+    sum.assign(size_t(4 * tailStart), 0.0f);
+}
+
+void ImpulseResponses::Convolver::release() {
+    stop();
+
+    maxChannels = 0;
+    std::vector<float>().swap(input);
+    std::vector<float>().swap(output);
+    for (int level = 0; level < numLevels; level++) {
+        std::vector<float>().swap(delayLine[level]);
+        std::vector<char>().swap(silent[level]);
+        fft[level].reset();
+    }
+    std::vector<float>().swap(buffer);
+    std::vector<float>().swap(sum);
+}
+
+void ImpulseResponses::Convolver::process(float force, float* outputs) {
+    const int mask = ringSize - 1;
+    const int numChannels = response->numChannels;
+    input[size_t(position & mask)] = force;
+    if (force != 0.0f) {
+        lastForce = position;
+    }
+
+    // Head taps, only while the force is within their reach
+    if (position - lastForce < headLength) {
+        for (int c = 0; c < numChannels; c++) {
+            const float* h = response->head.data() + c * headLength;
+            float y = 0.0f;
+            for (int k = 0; k < headLength; k++) {
+                y += h[k] * input[size_t((position - k) & mask)];
+            }
+            outputs[c] += y;
+        }
+    }
+
+    // Output of the partitions computed so far
+    const int slot = position & mask;
+    for (int c = 0; c < numChannels; c++) {
+        float& pending = output[size_t(c * ringSize + slot)];
+        outputs[c] += pending;
+        pending = 0.0f;
+    }
+
+    // Partitions whose block of force is now complete
+    position++;
+    for (int level = 0; level < numLevels; level++) {
+        if ((position & (getBlockSize(level) - 1)) == 0) {
+            processLevel(level);
+        }
+    }
+}
+
+void ImpulseResponses::Convolver::processLevel(int level) {
+    const int blockSize = getBlockSize(level);
+    const int numPartitions = juce::jmin(response->numPartitions[level], maxPartitions[level]);
+    if (numPartitions == 0) {
+        return;
+    }
+    const int numBins = blockSize + 1;
+    const int mask = ringSize - 1;
+
+    // Spectrum of the last two blocks of force (overlap-save), unless they were silent
+    int& index = newest[level];
+    index = (index + 1) % maxPartitions[level];
+    const bool isSilent = position - lastForce > 2 * blockSize;
+    silent[level][size_t(index)] = isSilent ? 1 : 0;
+    if (!isSilent) {
+        for (int i = 0; i < 2 * blockSize; i++) {
+            buffer[size_t(i)] = input[size_t((position - 2 * blockSize + i) & mask)];
+        }
+        fft[level]->performRealOnlyForwardTransform(buffer.data(), true);
+        std::copy(buffer.begin(), buffer.begin() + 2 * numBins, delayLine[level].begin() + index * 2 * numBins);
+    }
+
+    bool anyInput = false;
+    for (int p = 0; p < numPartitions && !anyInput; p++) {
+        anyInput = silent[level][size_t((index - p + maxPartitions[level]) % maxPartitions[level])] == 0;
+    }
+    if (!anyInput) {
+        return;
+    }
+
+    // Partition p of each channel multiplies the block of force from p blocks ago
+    for (int c = 0; c < response->numChannels; c++) {
+        std::fill(sum.begin(), sum.begin() + 2 * numBins, 0.0f);
+        for (int p = 0; p < numPartitions; p++) {
+            const int block = (index - p + maxPartitions[level]) % maxPartitions[level];
+            if (silent[level][size_t(block)] != 0) {
+                continue;
+            }
+            const float* x = delayLine[level].data() + block * 2 * numBins;
+            const float* h = response->spectra[level].data() + size_t(c * response->numPartitions[level] + p) * 2 * numBins;
+            float* s = sum.data();
+            for (int i = 0; i < numBins; i++) {
+                s[2 * i] += x[2 * i] * h[2 * i] - x[2 * i + 1] * h[2 * i + 1];
+                s[2 * i + 1] += x[2 * i] * h[2 * i + 1] + x[2 * i + 1] * h[2 * i];
+            }
+        }
+        std::copy(sum.begin(), sum.begin() + 2 * numBins, buffer.begin());
+        fft[level]->performRealOnlyInverseTransform(buffer.data());
+
+        // The second half is the output from now on, as each level starts at its own block size
+        float* pending = output.data() + c * ringSize;
+        for (int i = 0; i < blockSize; i++) {
+            pending[(position + i) & mask] += buffer[size_t(blockSize + i)];
+        }
+    }
+}
+
+int ImpulseResponses::Convolver::getNumChannels() const {
+    return response != nullptr ? response->numChannels : 0;
+}
+
+bool ImpulseResponses::Convolver::isActive() const {
+    return response != nullptr && position - lastForce <= response->length;
+}
+
+void ImpulseResponses::Convolver::stop() {
+    if (set != nullptr) {
+        set->readers--;
+        set = nullptr;
+    }
+    response = nullptr;
+}
+
+void ImpulseResponses::Convolver::reset() {
+    std::fill(input.begin(), input.end(), 0.0f);
+    std::fill(output.begin(), output.end(), 0.0f);
+    for (int level = 0; level < numLevels; level++) {
+        std::fill(silent[level].begin(), silent[level].end(), 1);
+    }
+    position = 0;
+    lastForce = std::numeric_limits<int>::min() / 2;
+}
+
+// =================================
+// Client
+ImpulseResponses::Client::Client(ImpulseResponses& r, juce::AudioProcessorValueTreeState& state) : responses(r), parameters(state) {
+    irMode = parameters.getRawParameterValue("irMode");
+    pickupSpread = parameters.getRawParameterValue("pickupSpread");
+
+    for (auto& count : playCount) {
+        count.store(0);
+    }
+
+    const juce::ScopedLock sl(responses.lock);
+    responses.clients.add(this);
+}
+
+ImpulseResponses::Client::~Client() {
+    const juce::ScopedLock sl(responses.lock);
+    responses.clients.removeFirstMatchingValue(this);
+    activeSet.store(nullptr);
+    if (set != nullptr) {
+        responses.releaseSet(set);
+    }
+}
+
+void ImpulseResponses::Client::prepare(double newSampleRate, int newNumChannels) {
+    numChannels = juce::jlimit(1, String::maxPickups, newNumChannels);
+    sampleRate = newSampleRate;
+    responses.startThread(2);
+    responses.notify();
+}
+
+void ImpulseResponses::Client::release() {
+    // The renderer drops the set on its next pass
+    sampleRate = 0.0;
+    activeSet.store(nullptr);
+    responses.notify();
+}
+
+bool ImpulseResponses::Client::isEnabled() const {
+    return *irMode >= 0.5f;
+}
+
+void ImpulseResponses::Client::keyPlayed(int midiNoteNumber) {
+    playCount[midiNoteNumber]++;
+}
+
+bool ImpulseResponses::Client::start(Convolver& convolver, int midiNoteNumber) {
+    // Register as a reader before the renderer can see this voice as gone (see freeRetiredSets())
+    responses.entering++;
+    Set* set = *irMode >= 0.5f ? activeSet.load() : nullptr;
+    if (set != nullptr) {
+        set->readers++;
+    }
+    responses.entering--;
+
+    if (set == nullptr) {
+        convolver.stop();
+        return false;
+    }
+
+    const KeyResponse* response = set->keys[midiNoteNumber].load(std::memory_order_acquire);
+    if (response == nullptr || response->numChannels > convolver.maxChannels) {
+        set->readers--;
+        convolver.stop();
+        return false;
+    }
+
+    // Still ringing with the same response : the new force adds to it
+    if (convolver.set == set && convolver.response == response) {
+        set->readers--;
+        return true;
+    }
+
+    convolver.stop();
+    convolver.set = set;
+    convolver.response = response;
+    convolver.reset();
+    return true;
+}
+
+// =================================
+// ImpulseResponses
+ImpulseResponses::ImpulseResponses() : juce::Thread("AnyPiano impulse responses") {
+}
+
+ImpulseResponses::~ImpulseResponses() {
+    stopThread(4000);
+
+    // Every processor, and so every voice, is gone with the last client
+    jassert(clients.isEmpty());
+}
+
+int ImpulseResponses::getBlockSize(int level) {
+    return headLength << level;
+}
+
+void ImpulseResponses::run() {
+    juce::ScopedNoDenormals noDenormals;
+    while (!threadShouldExit()) {
+        updateClients();
+        freeRetiredSets();
+
+        // Render in idle time, with a pause between keys to leave the CPU to the host
+        if (renderNextKey()) {
+            wait(20);
+        }
+        else {
+            wait(250);
+        }
+    }
+}
+
+void ImpulseResponses::updateClients() {
+    const juce::ScopedLock sl(lock);
+
+    for (Client* client : clients) {
+        // Responses only take up memory while the mode is on
+        const double sampleRate = client->sampleRate.load();
+        const int numChannels = client->numChannels.load();
+        const NoteParameters p = NoteParameters::fromState(client->parameters);
+        const float spread = *client->pickupSpread;
+        juce::int64 hash = 0;
+        if (sampleRate > 0.0 && *client->irMode >= 0.5f) {
+            juce::uint64 mixed = juce::uint64(hashNoteParameters(p, sampleRate));
+            mixed = (mixed * 31 + juce::uint64(juce::roundToInt(spread * 1.0e6f))) * 31 + juce::uint64(numChannels);
+            hash = juce::jmax(juce::int64(1), juce::int64(mixed & 0x7fffffffffffffffull));
+        }
+
+        if (hash == client->setHash) {
+            // Back to the current set after a release
+            if (client->set != nullptr) {
+                client->activeSet.store(client->set);
+            }
+            continue;
+        }
+
+        // A hash of 0 leaves no set
+        client->activeSet.store(nullptr);
+        if (client->set != nullptr) {
+            releaseSet(client->set);
+        }
+        client->set = hash != 0 ? acquireSet(hash, p, spread, sampleRate, numChannels) : nullptr;
+        client->setHash = hash;
+        client->activeSet.store(client->set);
+    }
+}
+
+ImpulseResponses::Set* ImpulseResponses::acquireSet(juce::int64 hash, const NoteParameters& p, float spread, double sampleRate, int numChannels) {
+    auto it = sets.find(hash);
+    if (it == sets.end()) {
+        auto retired = std::find_if(retiredSets.begin(), retiredSets.end(), [hash](const std::unique_ptr<Set>& s) {
+            return s->hash == hash;
+        });
+        if (retired != retiredSets.end()) {
+            // Still alive : take it back with the responses rendered so far
+            it = sets.emplace(hash, std::move(*retired)).first;
+            retiredSets.erase(retired);
+        }
+        else {
+            it = sets.emplace(hash, std::unique_ptr<Set>(new Set(hash, p, spread, sampleRate, numChannels))).first;
+        }
+    }
+
+    it->second->numClients++;
+    return it->second.get();
+}
+
+void ImpulseResponses::releaseSet(Set* set) {
+    if (--set->numClients > 0) {
+        return;
+    }
+    auto it = sets.find(set->hash);
+    jassert(it != sets.end() && it->second.get() == set);
+    retiredSets.push_back(std::move(it->second));
+    sets.erase(it);
+}
+
+void ImpulseResponses::freeRetiredSets() {
+    const juce::ScopedLock sl(lock);
+
+    // A voice which loaded a retired set registers as its reader before it stops entering,
+    // so once no voice is entering, the reader counts can only go down
+    if (retiredSets.empty() || entering.load() != 0) {
+        return;
+    }
+    retiredSets.erase(std::remove_if(retiredSets.begin(), retiredSets.end(), [](const std::unique_ptr<Set>& s) {
+        return s->readers.load() == 0;
+    }), retiredSets.end());
+}
+
+bool ImpulseResponses::renderNextKey() {
+    Set* bestSet = nullptr;
+    int bestKey = -1;
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        // Most played keys of any client first
+        int bestCount = 0;
+        for (Client* client : clients) {
+            Set* set = client->set;
+            for (int key = 0; set != nullptr && key < numKeys; key++) {
+                int count = client->playCount[key].load();
+                if (count > bestCount && set->owned[key] == nullptr) {
+                    bestCount = count;
+                    bestSet = set;
+                    bestKey = key;
+                }
+            }
+        }
+
+        // Then the piano range, outwards from middle C
+        for (Client* client : clients) {
+            Set* set = client->set;
+            for (int offset = 0; set != nullptr && bestKey < 0 && offset <= 48; offset++) {
+                for (int key : { 60 + offset, 60 - offset }) {
+                    if (key >= 21 && key <= 108 && set->owned[key] == nullptr) {
+                        bestSet = set;
+                        bestKey = key;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Only this thread deletes sets, so the set outlives the render without the lock
+    if (bestKey < 0) {
+        return false;
+    }
+    auto response = renderKey(*bestSet, bestKey);
+    if (response == nullptr) {
+        return false;
+    }
+    bestSet->owned[bestKey] = std::move(response);
+    bestSet->keys[bestKey].store(bestSet->owned[bestKey].get(), std::memory_order_release);
+    return true;
+}
+
+std::unique_ptr<ImpulseResponses::KeyResponse> ImpulseResponses::renderKey(const Set& set, int midiNoteNumber) {
+    const NoteParameters& p = set.parameters;
+    const double sampleRate = set.sampleRate;
+    const int numChannels = set.numChannels;
+
+    std::unique_ptr<KeyResponse> r(new KeyResponse());
+    r->numChannels = numChannels;
+    r->length = juce::roundToInt(juce::jlimit(2.0f * fadeSeconds, maxSeconds, p.T60) * sampleRate);
+
+    // Strike the FDTD strings of the key with a unit impulse, the detune being fixed per key
+    Note note;
+    note.setSampleRate(float(sampleRate));
+    note.setWaveguideAllowed(false);
+    note.setSeed(juce::int64(midiNoteNumber) + 1);
+    note.setKey(midiNoteNumber, 0.5f, true, p);
+    note.setImpulse();
+    const bool playable = note.isPlayable();                // Keys with non-finite coefficients get a silent response
+    float positions[String::maxPickups];
+    spreadPickups(p.xo, set.spread, numChannels, positions);
+    note.setPickups(positions, numChannels, false);
+
+    std::vector<float> samples(size_t(numChannels * r->length));
+    const int fadeLength = juce::roundToInt(fadeSeconds * sampleRate);
+    for (int n = 0; n < r->length; n++) {
+        float outputs[String::maxPickups];
+        for (int c = 0; c < numChannels; c++) {
+            outputs[c] = 0.0f;
+        }
+        if (playable) {
+            note.process(outputs);
+        }
+
+        int remaining = r->length - n;
+        float fade = remaining < fadeLength ? float(remaining) / float(fadeLength) : 1.0f;
+        for (int c = 0; c < numChannels; c++) {
+            samples[size_t(c * r->length + n)] = fade * outputs[c];
+        }
+
+        if ((n & 4095) == 0 && threadShouldExit()) {
+            return nullptr;
+        }
+    }
+
+    // Head taps
+    r->head.assign(size_t(numChannels * headLength), 0.0f);
+    for (int c = 0; c < numChannels; c++) {
+        for (int k = 0; k < juce::jmin(headLength, r->length); k++) {
+            r->head[size_t(c * headLength + k)] = samples[size_t(c * r->length + k)];
+        }
+    }
+
+    // Partitions of each level, zero padded to twice their size
+    std::vector<float> buffer(size_t(4 * tailStart));
+    for (int level = 0; level < numLevels; level++) {
+        const int blockSize = getBlockSize(level);
+        const int start = blockSize;
+        const int numBins = blockSize + 1;
+        const int remaining = juce::jmax(0, r->length - start);
+        r->numPartitions[level] = level < numLevels - 1 ? juce::jmin(1, remaining) : (remaining + blockSize - 1) / blockSize;
+        r->spectra[level].assign(size_t(numChannels * r->numPartitions[level] * 2 * numBins), 0.0f);
+
+        juce::dsp::FFT fft(juce::roundToInt(std::log2(2 * blockSize)));
+        for (int c = 0; c < numChannels; c++) {
+            for (int p = 0; p < r->numPartitions[level]; p++) {
+                std::fill(buffer.begin(), buffer.end(), 0.0f);
+                for (int k = 0; k < blockSize; k++) {
+                    int tap = start + p * blockSize + k;
+                    if (tap < r->length) {
+                        buffer[size_t(k)] = samples[size_t(c * r->length + tap)];
+                    }
+                }
+                fft.performRealOnlyForwardTransform(buffer.data(), true);
+                std::copy(buffer.begin(), buffer.begin() + 2 * numBins,
+                    r->spectra[level].begin() + size_t(c * r->numPartitions[level] + p) * 2 * numBins);
+            }
+        }
+    }
+    return r;
+}
@@ -0,0 +1,194 @@
+/*
+  ==============================================================================
+
+    ImpulseResponses.h
+    Author:  Ruthu Prem Kumar
+
+    Impulse responses of every key, for rendering notes by convolution
+    instead of simulating their strings.
+
+    Once the parameters are fixed a note is linear and time invariant : its
+    output is the force signal convolved with the response of its strings
+    (onset intervals included) at each pickup. A background thread renders
+    that response once per preset by striking a Note with a unit impulse,
+    most played keys first, then the piano range outwards from middle C.
+    Responses only exist while the "irMode" parameter is on, and last until
+    the T60 time (at most maxSeconds).
+
+    Convolver renders a note from its force signal with a non-uniformly
+    partitioned convolution without latency : the first headLength taps
+    are applied directly, each following octave of the response up to
+    tailStart by one FFT partition of its own length, and the rest by
+    uniform partitions of tailStart samples. A partition is computed when
+    the block of force it needs is complete, and partitions of silent
+    blocks are skipped, so once the force has ended a voice costs nearly
+    nothing whatever the length of its strings or the sample rate.
+
+    There is one renderer per process, held by SharedResources : each
+    processor registers a Client, and clients on the same preset, pickups
+    and sample rate share one set of responses.
+    A change of parameters switches the client to another set, a set no
+    client uses is freed once no voice plays from it.
+    Call Client::prepare() from prepareToPlay(), then start() and
+    Convolver::process() from the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <map>
+#include "Note.h"
+
+class ImpulseResponses : private juce::Thread {
+public:
+
+    static constexpr int numKeys = 128;                     // MIDI keys
+    static constexpr int headLength = 64;                   // Taps applied directly
+    static constexpr int numLevels = 7;                     // Partition sizes headLength to tailStart
+    static constexpr int tailStart = headLength << (numLevels - 1); // Start of the uniform partitions
+    static constexpr int ringSize = 2 * tailStart;          // History of the force and pending output (a power of two)
+    static constexpr float maxSeconds = 4.0f;               // Longest response (s)
+    static constexpr float fadeSeconds = 0.05f;             // Fade out at the end of a response (s)
+
+    /* Response of one key at every pickup, split into the partitions of Convolver (immutable once published)*/
+    struct KeyResponse {
+        int length = 0;                                     // Length of the response in samples
+        int numChannels = 0;                                // Pickups
+        std::vector<float> head;                            // First headLength taps of each channel
+        int numPartitions[numLevels];                       // Partitions per level
+        std::vector<float> spectra[numLevels];              // Spectra of the partitions, channel by channel (blockSize + 1 complex each)
+    };
+
+    class Set;
+    class Client;
+
+    /* Convolves the force of one note with a key response, owned by a voice*/
+    class Convolver {
+    public:
+        ~Convolver();
+
+        /* Allocates the buffers for responses at a sample rate with up to numChannels pickups (not for the audio thread)*/
+        void prepare(double sampleRate, int numChannels);
+
+        /* Frees the buffers (not for the audio thread, nor while it may use the convolver)*/
+        void release();
+
+        /* Adds the next force sample and adds the output of each channel to outputs*/
+        void process(float force, float* outputs);
+
+        /* Number of channels added by process()*/
+        int getNumChannels() const;
+
+        /* True while playing a response*/
+        bool isActive() const;
+
+        /* Stops playing and releases the set*/
+        void stop();
+
+    private:
+        friend class ImpulseResponses;
+        friend class Client;
+
+        /* Clears the force history and the pending output*/
+        void reset();
+
+        /* Convolves the block of force which has just completed with the partitions of a level*/
+        void processLevel(int level);
+
+        Set* set = nullptr;                                 // Set the response is read from
+        const KeyResponse* response = nullptr;              // Response being played
+        int position = 0;                                   // Force samples so far
+        int lastForce = std::numeric_limits<int>::min() / 2; // Position of the last non-zero force sample
+
+        std::vector<float> input;                           // Force history (ringSize)
+        std::vector<float> output;                          // Pending output of each channel (numChannels x ringSize)
+        std::vector<float> delayLine[numLevels];            // Spectra of the last blocks of force per level
+        std::vector<char> silent[numLevels];                // Blocks of the delay line which were all zero
+        int newest[numLevels];                              // Index of the newest block in the delay line
+        int maxPartitions[numLevels];                       // Blocks held by the delay line
+        std::unique_ptr<juce::dsp::FFT> fft[numLevels];     // FFT of twice the block size of each level
+        std::vector<float> buffer;                          // FFT buffer (4 tailStart)
+        std::vector<float> sum;                             // Accumulated spectrum of one channel (4 tailStart)
+        int maxChannels = 0;                                // Channels allocated by prepare()
+    };
+
+    /* The responses as seen by one processor : its preset and pickups, and the keys it plays*/
+    class Client {
+    public:
+        Client(ImpulseResponses& responses, juce::AudioProcessorValueTreeState& parameters);
+        ~Client();
+
+        /* Sets the sample rate and number of pickups, and starts rendering the responses of this processor*/
+        void prepare(double sampleRate, int numChannels);
+
+        /* Stops rendering and playing the responses of this processor*/
+        void release();
+
+        /* True while the impulse response mode is on, the voices only need their convolvers then*/
+        bool isEnabled() const;
+
+        /* Counts a note on, so that the most played keys are rendered first (audio thread)*/
+        void keyPlayed(int midiNoteNumber);
+
+        /* Starts convolving a key, returns false if the mode is off or the key has not been rendered yet (audio thread).
+           A convolver already playing the same response keeps ringing, so that the responses of a re-strike add*/
+        bool start(Convolver& convolver, int midiNoteNumber);
+
+    private:
+        friend class ImpulseResponses;
+
+        ImpulseResponses& responses;                        // Renderer this client is registered with
+        juce::AudioProcessorValueTreeState& parameters;     // Parameters of the processor
+        std::atomic<float>* irMode;                         // Convolution on (>= 0.5) or off
+        std::atomic<float>* pickupSpread;                   // Spread of the pickups around xo
+
+        std::atomic<double> sampleRate { 0.0 };             // Sample rate of the processor, 0 when released
+        std::atomic<int> numChannels { 1 };                 // Pickups of the processor
+        Set* set = nullptr;                                 // Set of the current preset (renderer thread)
+        juce::int64 setHash = 0;                            // Hash of the preset, pickups and sample rate of the set
+        std::atomic<Set*> activeSet { nullptr };            // Set the voices read from
+
+        std::atomic<int> playCount[numKeys];                // Note ons per key
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Client)
+    };
+
+    ImpulseResponses();
+    ~ImpulseResponses() override;
+
+    /* Block size of a level*/
+    static int getBlockSize(int level);
+
+private:
+
+    void run() override;
+
+    /* Follows the preset of every client, switching sets when it changes*/
+    void updateClients();
+
+    /* Returns the set of a preset, creating it if no client uses it yet*/
+    Set* acquireSet(juce::int64 hash, const NoteParameters& p, float spread, double sampleRate, int numChannels);
+
+    /* Drops a client's use of a set, retiring it when no client is left*/
+    void releaseSet(Set* set);
+
+    /* Deletes the retired sets once no voice can be reading them*/
+    void freeRetiredSets();
+
+    /* Renders the most wanted missing key, returns false if there is nothing left to render*/
+    bool renderNextKey();
+
+    /* Renders the response of one key of a set and splits it into partitions*/
+    std::unique_ptr<KeyResponse> renderKey(const Set& set, int midiNoteNumber);
+
+    juce::CriticalSection lock;                             // Guards the clients and sets (never taken on the audio thread)
+    juce::Array<Client*> clients;                           // Registered processors
+    std::map<juce::int64, std::unique_ptr<Set>> sets;       // Sets in use by hash
+    std::vector<std::unique_ptr<Set>> retiredSets;          // Sets no client uses, kept while voices read them
+
+    std::atomic<int> entering { 0 };                        // Voices between loading a client's set and registering as its reader
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImpulseResponses)
+};
@@ -10,9 +10,211 @@ Author:  Ruthu Prem Kumar
 
 #include "Note.h"
 
+Note::Note() {
+    // Strings are created once, so that starting a note does not allocate
+    for (int i = 0; i < maxStrings; i++) {
+        str.push_back(new String);
+        guide.push_back(new WaveguideString);
+    }
+    unisonHistory.resize(size_t(String::maxPickups * maxUnisonDelay), 0.0f);
+}
+
+Note::~Note() {
+    for (auto* s : str) {
+        delete s;
+    }
+    for (auto* g : guide) {
+        delete g;
+    }
+}
+
+void Note::reserve(float samplerate) {
+    // N is at most sampleRate / (2 * frequency), sized for the lowest piano key detuned by the largest freqParam
+    int size = int(samplerate / (2.0f * (KeyGeometry::getFrequency(lowestKey) - 5.0f))) + 1;
+    for (auto* s : str) {
+        s->reserveGrid(size);
+    }
+    // The waveguide loop is about 2 N samples long
+    for (auto* g : guide) {
+        g->reserveGrid(2 * size + 4);
+    }
+}
+
+void Note::setKey(int midiNoteNumber, float velocity, bool struck, const NoteParameters& p,
+    const KeyTable* keyTable, const ForceTable* forceTable) {
+    // Below the piano range the grids could outgrow reserve(), and the frequency of key 0 detuned by freqParam is negative
+    midiNoteNumber = juce::jlimit(lowestKey, 127, midiNoteNumber);
+
+    // Restart the excitation intervals of the strings
+    sampleCount = 0;
+
+    // Geometry of the key, from the shared table when it matches the preset
+    KeyGeometry g;
+    if (keyTable != nullptr && keyTable->sampleRate == sampleRate && keyTable->hash == hashNoteParameters(p, sampleRate)) {
+        g = keyTable->keys[midiNoteNumber];
+    }
+    else {
+        g = KeyGeometry::compute(midiNoteNumber, p, sampleRate);
+    }
+    setNumStrings(g.numStrings);
+
+    // Set Note properties
+    setInterval(p.interval);
+    setMaterial(p.E * 1e9, p.rho);
+    setInputOutput(p.xi, p.xo);
+    if (p.freqParam == 0.0f) {
+        // Undetuned strings share the coefficients of the key
+        freq = g.frequency;
+        L = g.length;
+        r = g.radius / 1000.0f;
+        T60 = p.T60;
+        for (int i = 0; i < numStrings; i++) {
+            str[i]->setsampleRate(sampleRate);
+            str[i]->setCoefficients(g.coefficients);
+            str[i]->initGrid();
+        }
+    }
+    else {
+        setStringParams(g.frequency, p.freqParam, g.length, g.radius, p.T60);
+    }
+    chooseUnison();
+    chooseEngine();
+    setExcitation(velocity, struck, p, forceTable);
+}
+
+void Note::setExcitation(float velocity, bool struck, const NoteParameters& p, const ForceTable* forceTable) {
+    // Force signal, from the shared table when it matches the sample rate
+    float durationInMilliseconds = 3.0 - 2.0 * velocity;
+    float amplitudeInNewtons = p.baseVel + p.velCurve * (2.0f * velocity - 0.5f);
+    if (forceTable != nullptr && forceTable->sampleRate == sampleRate) {
+        durationInSamples = juce::jmin(int(round((durationInMilliseconds / 1000.0f) * sampleRate)), forceTable->maxDuration);
+        famp = amplitudeInNewtons;
+        excChoice = struck;
+        forceSignal = forceTable->get(durationInSamples, excChoice);
+        forceScale = famp;
+    }
+    else {
+        setForceParameters(durationInMilliseconds, amplitudeInNewtons, struck);
+    }
+}
+
+void Note::setImpulse() {
+    // A single sample of 1 N, so that the output is the response of the strings
+    static const float impulse = 1.0f;
+    durationInSamples = 1;
+    forceSignal = &impulse;
+    forceScale = 1.0f;
+}
+
+int Note::getForceLength() {
+    return durationInSamples;
+}
+
+float Note::getForce(int sample) {
+    return sample < durationInSamples ? forceScale * forceSignal[sample] : 0.0f;
+}
+
+void Note::chooseEngine() {
+    useWaveguide = false;
+    if (!waveguideAllowed) {
+        return;
+    }
+
+    // The first string decides for the note, its detuned copies have nearly the same partials
+    guide[0]->setsampleRate(sampleRate);
+    guide[0]->setParameters(str[0]->getFrequency(), L, r, T60);
+    float cost = WaveguideString::estimateCost(guide[0]->getNumAllpasses());
+    // Only nearly harmonic strings, which the waveguide reproduces closely and whose grids are the longest :
+    // stiffer strings keep the FDTD scheme, the reference sound, however cheap the waveguide would be
+    useWaveguide = guide[0]->getInharmonicity() <= maxInharmonicity && guide[0]->getTuningError() <= maxTuningError
+        && cost < gridPointCost * str[0]->getGridSize();
+    if (!useWaveguide) {
+        return;
+    }
+    for (int i = 0; i < numStrings; i++) {
+        if (i > 0 && !unison) {
+            guide[i]->setsampleRate(sampleRate);
+            guide[i]->setParameters(str[i]->getFrequency(), L, r, T60);
+        }
+        guide[i]->initGrid();
+    }
+}
+
+void Note::chooseUnison() {
+    // Strings on the same grid and tuned within unisonCents of the first are the first delayed by their onset
+    unison = numStrings > 1 && interval * (numStrings - 1) < maxUnisonDelay;
+    for (int i = 1; i < numStrings && unison; i++) {
+        float cents = 1200.0f * std::abs(std::log2(str[i]->getFrequency() / str[0]->getFrequency()));
+        unison = cents <= unisonCents && str[i]->getGridSize() == str[0]->getGridSize();
+    }
+    if (unison) {
+        std::fill(unisonHistory.begin(), unisonHistory.end(), 0.0f);
+        unisonIndex = 0;
+    }
+}
+
+void Note::processUnison(float* outputs, int count) {
+    // Force and output of the first string only
+    float force = stringSampleCount[0] < durationInSamples ? forceScale * forceSignal[stringSampleCount[0]] : 0.0f;
+    float first[String::maxPickups];
+    if (count == 0) {
+        if (useWaveguide) {
+            guide[0]->setForce(force);
+            first[0] = guide[0]->process();
+        }
+        else {
+            str[0]->setForce(force);
+            first[0] = str[0]->process();
+        }
+        count = 1;
+    }
+    else {
+        for (int p = 0; p < count; p++) {
+            first[p] = 0.0f;
+        }
+        if (useWaveguide) {
+            guide[0]->setForce(force);
+            guide[0]->process(first);
+        }
+        else {
+            str[0]->setForce(force);
+            str[0]->process(first);
+        }
+    }
+
+    // The copies read the history before their onset, which is silent
+    int delay = int(interval);
+    for (int p = 0; p < count; p++) {
+        float* history = unisonHistory.data() + p * maxUnisonDelay;
+        history[unisonIndex] = first[p];
+        float sum = 0.0f;
+        for (int i = 0; i < numStrings; i++) {
+            sum += history[(unisonIndex - delay * i) & (maxUnisonDelay - 1)];
+        }
+        outputs[p] += sum;
+    }
+    unisonIndex = (unisonIndex + 1) & (maxUnisonDelay - 1);
+
+    // Counters as if every string were simulated
+    for (int i = 0; i < numStrings; i++) {
+        if (sampleCount >= interval * i) {
+            stringSampleCount[i]++;
+        }
+    }
+    sampleCount++;
+}
+
+void Note::setSeed(juce::int64 seed) {
+    random.setSeed(seed);
+}
+
 float Note::process() {
     // Initialise sample
     float sample = 0.0f;
+    if (unison) {
+        processUnison(&sample, 0);
+        return sample;
+    }
 
     // For each string, add sample
     for (int i = 0; i < numStrings; i++) {
@@ -21,15 +223,17 @@ float Note::process() {
         if (sampleCount >= interval * i) {
 
             // If the sample number is within the input force time, add input force
-            if (stringSampleCount[i] < durationInSamples) {
-                str[i]->setForce(forceSignal[stringSampleCount[i]]);
-            }
+            float force = stringSampleCount[i] < durationInSamples ? forceScale * forceSignal[stringSampleCount[i]] : 0.0f;
 
+            // Obtain signal from i'th string (FDTD or waveguide) and add to sample 
+            if (useWaveguide) {
+                guide[i]->setForce(force);
+                sample += guide[i]->process();
+            }
             else {
-                str[i]->setForce(0.0f);
+                str[i]->setForce(force);
+                sample += str[i]->process();
             }
-            // Obtain signal from i'th string and add to sample 
-            sample += str[i]->process();
             // Sample count for string increases
             stringSampleCount[i]++;
         }
@@ -40,6 +244,141 @@ float Note::process() {
     return sample;
 }
 
+void Note::process(float* outputs) {
+    if (unison) {
+        processUnison(outputs, numPickups);
+        return;
+    }
+
+    // Same as process(), with every pickup of every string
+    for (int i = 0; i < numStrings; i++) {
+        if (sampleCount >= interval * i) {
+            float force = stringSampleCount[i] < durationInSamples ? forceScale * forceSignal[stringSampleCount[i]] : 0.0f;
+            if (useWaveguide) {
+                guide[i]->setForce(force);
+                guide[i]->process(outputs);
+            }
+            else {
+                str[i]->setForce(force);
+                str[i]->process(outputs);
+            }
+            stringSampleCount[i]++;
+        }
+    }
+    sampleCount++;
+}
+
+void Note::setPickups(const float* positions, int count, bool ramp) {
+    numPickups = juce::jlimit(1, String::maxPickups, count);
+    for (int i = 0; i < numStrings; i++) {
+        str[i]->setPickups(positions, count, ramp);
+        guide[i]->setPickups(positions, count, ramp);
+    }
+}
+
+bool Note::isExcitationFinished() {
+    for (int i = 0; i < numStrings; i++) {
+        if (stringSampleCount[i] < durationInSamples) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Note::addModes(ResonatorBank& bank, int modesPerString) {
+    for (int i = 0; i < numStrings; i++) {
+        firstMode[i] = bank.getNumModes();
+        if (unison && i > 0) {
+            // A copy is the first string as it was at its onset delay
+            numModes[i] = bank.addDelayedCopy(firstMode[0], numModes[0], int(interval) * i);
+        }
+        else {
+            numModes[i] = str[i]->addModes(bank, modesPerString);
+        }
+    }
+}
+
+void Note::restoreModes(const ResonatorBank& bank) {
+    // Every string gets its own state back, so the copies are simulated from now on
+    for (int i = 0; i < numStrings; i++) {
+        str[i]->setModes(bank, firstMode[i], numModes[i]);
+    }
+    unison = false;
+}
+
+bool Note::canHandOff() {
+    return !useWaveguide;
+}
+
+bool Note::isUnison() {
+    return unison;
+}
+
+bool Note::isWaveguide() {
+    return useWaveguide;
+}
+
+bool Note::isPlayable() {
+    // Waveguides are chosen per key, a key whose FDTD coefficients are not finite stays unplayable whatever the engine
+    for (int i = 0; i < (unison ? 1 : numStrings); i++) {
+        if (!str[i]->isStable()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+float Note::getEnergy() {
+    if (useWaveguide) {
+        return 0.0f;
+    }
+    float energy = 0.0f;
+    for (int i = 0; i < (unison ? 1 : numStrings); i++) {
+        energy += str[i]->getEnergy();
+    }
+    return energy;
+}
+
+void Note::silence() {
+    for (int i = 0; i < (unison ? 1 : numStrings); i++) {
+        if (useWaveguide) {
+            guide[i]->initGrid();
+        }
+        else {
+            str[i]->clearState();
+        }
+    }
+    if (unison) {
+        std::fill(unisonHistory.begin(), unisonHistory.end(), 0.0f);
+    }
+}
+
+void Note::setWaveguideAllowed(bool allowed) {
+    waveguideAllowed = allowed;
+}
+
+void Note::setHalfRounding(bool enabled) {
+    for (auto* s : str) {
+        s->setHalfRounding(enabled);
+    }
+}
+
+void Note::setGridPointCost(float cost) {
+    gridPointCost = cost;
+}
+
+void Note::getShape(int string, float* dest, int numPoints, const ResonatorBank* bank) {
+    if (bank != nullptr) {
+        bank->getShape(dest, numPoints, firstMode[string], numModes[string]);
+    }
+    else if (useWaveguide) {
+        guide[unison ? 0 : string]->getShape(dest, numPoints);
+    }
+    else {
+        str[unison ? 0 : string]->getShape(dest, numPoints);
+    }
+}
+
 void Note::setSampleRate(float samplerate) {
     sampleRate = samplerate;
 }
@@ -63,6 +402,7 @@ void Note::setMaterial(float youngsModulus, float density) {
     // Set material for each string
     for (int i = 0; i < numStrings; i++) {
         str[i]->setMaterial(youngsModulus, density);
+        guide[i]->setMaterial(youngsModulus, density);
     }
 }
 
@@ -70,6 +410,7 @@ void Note::setInputOutput(float xi, float xo) {
     // Set excitation coordinates for each string
     for (int i = 0; i < numStrings; i++) {
         str[i]->setExcCoordinates(xi, xo);
+        guide[i]->setExcCoordinates(xi, xo);
     }
 }
 
@@ -86,7 +427,8 @@ void Note::setForceParameters(float durationInMilliseconds, float amplitudeInNew
     // Struck or Plucked
     excChoice = choice;
 
-    // Store forceSignal
+    // Store forceSignal, with the amplitude already applied
+    forceScale = 1.0f;
     if (excChoice == true) {
         forceSignal = inputForce.fullHann();           // Struck
     }
@@ -96,12 +438,11 @@ void Note::setForceParameters(float durationInMilliseconds, float amplitudeInNew
 }
 
 void Note::setNumStrings(int number) {
-    // Set number of strings for note and initialise that many instances of String objects
-    numStrings = number;
+    // Set number of strings for note (the String objects already exist) and restart their sample counts
+    numStrings = juce::jlimit(1, maxStrings, number);
     for (int i = 0; i < numStrings; i++) {
-        str.push_back(new String);
+        stringSampleCount[i] = 0;
     }
-    stringSampleCount = new int[numStrings] {0};
 }
 
 int Note::getNumStrings() {
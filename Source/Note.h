@@ -18,16 +18,98 @@
 #pragma once
 
 #include "String.h"
+#include "WaveguideString.h"
 #include "Hann.h"
+#include "NoteTables.h"
 #include <vector>
 #include <JuceHeader.h>
 
 class Note {
 public:
 
+    static constexpr int maxStrings = 3;            // Most strings in a note
+    static constexpr int maxUnisonDelay = 4096;     // Longest onset delay of a unison copy (samples, a power of two)
+    static constexpr int lowestKey = 21;            // Lowest piano key, setKey() plays lower MIDI keys as this one
+
+    /* Constructor, creates the strings*/
+    Note();
+
+    /* Destructor*/
+    ~Note();
+
+    /* Preallocates the string grids for every key at a sample rate, so that setKey() never allocates*/
+    void reserve(float samplerate);
+
+    /* Sets up every string of the note for a MIDI key and velocity (0-1), set SampleRate first.
+       Keys below lowestKey play as lowestKey : their strings would be longer than the grids reserve() allocates.
+       Shared key and force tables are used when given, otherwise everything is computed here*/
+    void setKey(int midiNoteNumber, float velocity, bool struck, const NoteParameters& p,
+        const KeyTable* keyTable = nullptr, const ForceTable* forceTable = nullptr);
+
+    /* Sets the force signal for a velocity (0-1), from the shared force table when given (called by setKey())*/
+    void setExcitation(float velocity, bool struck, const NoteParameters& p, const ForceTable* forceTable = nullptr);
+
+    /* Replaces the force signal by a unit impulse, so that the note outputs its impulse response (call after setKey())*/
+    void setImpulse();
+
+    /* Length of the force signal in samples*/
+    int getForceLength();
+
+    /* Sample of the force signal applied to a string that many samples after its onset (N)*/
+    float getForce(int sample);
+
+    /* Seeds the random detune of the strings so that a note can be reproduced exactly*/
+    void setSeed(juce::int64 seed);
+
     /* Process function for note which adds samples from str.process for each string(based on some interval) and returns the sample*/
     float process();
 
+    /* Process function for several pickups, adds each pickup's sample (summed over the strings) to outputs*/
+    void process(float* outputs);
+
+    /* Sets the pickup positions (0-1) of every string, ramping from the current positions if ramp is true*/
+    void setPickups(const float* positions, int count, bool ramp);
+
+    /* True once every string has been excited and the input force has ended*/
+    bool isExcitationFinished();
+
+    /* Hands every string over to bank, keeping its modesPerString loudest modes (see String::addModes())*/
+    void addModes(ResonatorBank& bank, int modesPerString);
+
+    /* Takes the strings back from the bank filled by addModes()*/
+    void restoreModes(const ResonatorBank& bank);
+
+    /* True if the strings can be handed over to a ResonatorBank, which waveguide strings cannot*/
+    bool canHandOff();
+
+    /* True if only the first string is simulated, the others being delayed copies of it*/
+    bool isUnison();
+
+    /* True if the note plays waveguide strings instead of FDTD strings*/
+    bool isWaveguide();
+
+    /* True if setKey() gave every simulated FDTD string a usable grid (see String::isStable()), also checked for waveguide notes,
+       the note must not be processed otherwise*/
+    bool isPlayable();
+
+    /* Mean squared displacement of the simulated FDTD strings (see String::getEnergy()), 0 for waveguide strings*/
+    float getEnergy();
+
+    /* Sets the state of every string to exactly zero*/
+    void silence();
+
+    /* Lets setKey() choose waveguide strings (true by default), otherwise it always plays FDTD strings*/
+    void setWaveguideAllowed(bool allowed);
+
+    /* Rounds the FDTD grids to fp16 after every timestep, for accuracy reports only (see String::setHalfRounding())*/
+    void setHalfRounding(bool enabled);
+
+    /* Sets the cost of a grid point per sample against WaveguideString::estimateCost(), measured by EngineTuner*/
+    void setGridPointCost(float cost);
+
+    /* Writes the shape of a string (see String::getShape()), from the bank filled by addModes() if bank is given*/
+    void getShape(int string, float* dest, int numPoints, const ResonatorBank* bank = nullptr);
+
     /* Sets the sample rate*/
     void setSampleRate(float samplerate);
 
@@ -62,13 +144,30 @@ private:
     float r;                                        // Radius of the strings of the note
     float T60;                                      // T60 time of the note
 
+    /* Designs waveguide strings for the strings set up by setKey() and plays them instead if they are nearly harmonic, in tune and cheaper*/
+    void chooseEngine();
+
+    /* Simulates only the first string if the others are tuned within unisonCents of it*/
+    void chooseUnison();
+
+    /* Adds the output of the first string to outputs[0..count-1], and of the others as its delayed copies
+       (count 0 reads the single pickup of process())*/
+    void processUnison(float* outputs, int count);
+
     // Vector of string objects
-    std::vector<String*> str;                       // vector of string objects
+    std::vector<String*> str;                       // vector of string objects (maxStrings, created once)
+    std::vector<WaveguideString*> guide;            // waveguide strings, one per string (created once)
+    bool useWaveguide = false;                      // Play guide instead of str
+    bool waveguideAllowed = true;                   // chooseEngine() may pick guide
+    const float maxTuningError = 1.5f;              // Worst waveguide partial error accepted (cents)
+    const float maxInharmonicity = 1.0e-4f;         // Stiffest string played by a waveguide (B, the default preset is 2.7e-4 and above)
+    float gridPointCost = 12.0f;                    // Operations per grid point per sample of String
 
     // Input Force parameters
     int durationInSamples;                          // duration of input force in samples
     float famp;                                     // Max amplitude of input force (N)
-    float *forceSignal;                             // Force signal 
+    const float *forceSignal;                       // Force signal 
+    float forceScale = 1.0f;                        // Amplitude applied to the force signal
     bool excChoice;                                 // Type of excitation(plucked/struck)
     Hann inputForce;                                // Object to return force signal        
 
@@ -81,5 +180,16 @@ private:
 
     // Counters to keep track of how many samples have passed for each string and the note in total
     int sampleCount = 0;                            
-    int *stringSampleCount;
+    int stringSampleCount[maxStrings];
+
+    // Unison strings
+    bool unison = false;                            // Strings after the first are delayed copies of it
+    const float unisonCents = 0.2f;                 // Detune below which strings are copies (cents)
+    std::vector<float> unisonHistory;               // Output of the first string at each pickup (maxPickups x maxUnisonDelay)
+    int unisonIndex = 0;                            // Position of the newest sample in unisonHistory
+    int numPickups = 1;                             // Pickups set by setPickups()
+
+    // Modes of each string in the bank filled by addModes()
+    int firstMode[maxStrings];
+    int numModes[maxStrings];
 };
\ No newline at end of file
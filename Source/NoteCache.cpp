@@ -0,0 +1,569 @@
+/*
+==============================================================================
+
+NoteCache.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "NoteCache.h"
+
+namespace {
+    // File layout : Header, slot table, then maxEntries notes starting at a page boundary
+    struct Header {
+        char magic[4];                                      // "APNC"
+        juce::int32 version;                                // File format version
+        juce::int64 hash;                                   // Hash of the preset
+        double sampleRate;                                  // Sample rate of the notes
+        juce::int32 entryLength;                            // Length of a note in samples
+        juce::int32 numSlots;                               // Number of slots in the slot table
+        juce::int32 maxEntries;                             // Number of notes the file can hold
+        juce::int32 numEntries;                             // Number of entries claimed so far, by any process (may overshoot maxEntries)
+        juce::int32 users;                                  // Number of processes mapping the file (changed under the file lock)
+    };
+
+    const juce::int32 fileVersion = 2;
+    const size_t blockBytes = sizeof(float) + NoteCache::blockSize * sizeof(juce::int16);
+    const size_t slotTableOffset = sizeof(Header);
+    const size_t dataOffset = (slotTableOffset + NoteCache::numSlots * sizeof(juce::int32) + 4095) & ~size_t(4095);
+
+    // Entry counter and slot table are shared with other processes through the mapping
+    static_assert(sizeof(std::atomic<juce::int32>) == sizeof(juce::int32) && std::atomic<juce::int32>::is_always_lock_free,
+                  "mapped counters need address-free atomics");
+
+    std::atomic<juce::int32>& atomicAt(juce::int32& value) {
+        return *reinterpret_cast<std::atomic<juce::int32>*>(&value);
+    }
+
+    bool isValidHeader(const Header& header) {
+        return memcmp(header.magic, "APNC", 4) == 0 && header.version == fileVersion;
+    }
+}
+
+// =================================
+// Store : one memory-mapped cache file, created and closed under the file lock
+class NoteCache::Store {
+public:
+    Store(const juce::File& f, juce::int64 presetHash, const NoteParameters& p, double sr)
+        : parameters(p), sampleRate(sr), hash(presetHash), file(f) {
+        entryLength = juce::roundToInt(noteSeconds * sampleRate / blockSize) * blockSize;
+        entryBytes = (entryLength / blockSize) * blockBytes;
+        const juce::int64 fileSize = juce::int64(dataOffset + maxEntries * entryBytes);
+
+        // Never recreate an existing file : another process may have it mapped.
+        // A damaged one is left unused until it is trimmed.
+        if (file.existsAsFile()) {
+            if (!mapFile(fileSize) || !hasValidHeader()) {
+                map.reset();
+                return;
+            }
+            getHeader()->users++;
+            return;
+        }
+
+        // No other process can map a file being created while the file lock is held
+        if (!createFile(fileSize) || !mapFile(fileSize)) {
+            map.reset();
+            file.deleteFile();
+            return;
+        }
+        Header* header = getHeader();
+        memcpy(header->magic, "APNC", 4);
+        header->version = fileVersion;
+        header->hash = hash;
+        header->sampleRate = sampleRate;
+        header->entryLength = entryLength;
+        header->numSlots = numSlots;
+        header->maxEntries = maxEntries;
+        header->numEntries = 0;
+        header->users = 1;
+        for (int i = 0; i < numSlots; i++) {
+            getSlotTable()[i] = -1;
+        }
+    }
+
+    ~Store() {
+        if (map != nullptr) {
+            getHeader()->users = juce::jmax(0, getHeader()->users - 1);
+        }
+    }
+
+    bool isValid() const {
+        return map != nullptr;
+    }
+
+    const juce::File& getFile() const {
+        return file;
+    }
+
+    bool isFull() {
+        return atomicAt(getHeader()->numEntries).load() >= maxEntries;
+    }
+
+    bool hasSlot(int slot) {
+        return getSlotEntry(slot) >= 0;
+    }
+
+    /* Entry index of a slot, -1 if no process has rendered it yet*/
+    int getSlotEntry(int slot) {
+        return atomicAt(getSlotTable()[slot]).load(std::memory_order_acquire);
+    }
+
+    char* getEntry(int index) {
+        return static_cast<char*>(map->getData()) + dataOffset + size_t(index) * entryBytes;
+    }
+
+    /* Claims the next free entry for this process, -1 if the file is full. Fill it before calling publish()*/
+    int addEntry() {
+        const int index = atomicAt(getHeader()->numEntries).fetch_add(1);
+        return index < maxEntries ? index : -1;
+    }
+
+    /* Makes a rendered entry visible to the voices of every process.
+       If another process rendered the slot first, its entry is kept and this one is wasted*/
+    void publish(int slot, int index) {
+        juce::int32 expected = -1;
+        atomicAt(getSlotTable()[slot]).compare_exchange_strong(expected, index, std::memory_order_acq_rel);
+    }
+
+    const NoteParameters parameters;                        // Preset of the notes
+    const double sampleRate;                                // Sample rate of the notes
+    const juce::int64 hash;                                 // hashNoteParameters(parameters, sampleRate)
+    int entryLength = 0;                                    // Length of a note in samples
+    size_t entryBytes = 0;                                  // Size of a note in the file
+    int numClients = 0;                                     // Number of clients on this preset (under the cache lock)
+    std::atomic<int> readers { 0 };                         // Number of voices playing from this store
+
+private:
+
+    Header* getHeader() {
+        return static_cast<Header*>(map->getData());
+    }
+
+    juce::int32* getSlotTable() {
+        return reinterpret_cast<juce::int32*>(static_cast<char*>(map->getData()) + slotTableOffset);
+    }
+
+    bool mapFile(juce::int64 fileSize) {
+        if (file.getSize() != fileSize) {
+            return false;
+        }
+        map.reset(new juce::MemoryMappedFile(file, juce::MemoryMappedFile::readWrite));
+        return map->getData() != nullptr && juce::int64(map->getSize()) == fileSize;
+    }
+
+    bool hasValidHeader() {
+        const Header* header = getHeader();
+        return isValidHeader(*header)
+            && header->hash == hash && header->sampleRate == sampleRate
+            && header->entryLength == entryLength && header->numSlots == numSlots
+            && header->maxEntries == maxEntries && header->numEntries >= 0;
+    }
+
+    bool createFile(juce::int64 fileSize) {
+        // Sparse file : only the rendered notes take up disk space
+        juce::FileOutputStream out(file);
+        if (out.failedToOpen()) {
+            return false;
+        }
+        out.setPosition(fileSize - 1);
+        out.writeByte(0);
+        out.flush();
+        return out.getStatus().wasOk();
+    }
+
+    juce::File file;                                        // Cache file
+    std::unique_ptr<juce::MemoryMappedFile> map;            // Mapping of the cache file
+};
+
+// =================================
+// Player
+NoteCache::Player::~Player() {
+    stop();
+}
+
+float NoteCache::Player::nextSample() {
+    if (position >= length) {
+        return 0.0f;
+    }
+
+    // Each block is a scale followed by blockSize 16 bit samples
+    const char* block = entry + size_t(position / blockSize) * blockBytes;
+    float scale;
+    juce::int16 value;
+    memcpy(&scale, block, sizeof(float));
+    memcpy(&value, block + sizeof(float) + (position % blockSize) * sizeof(juce::int16), sizeof(juce::int16));
+    position++;
+
+    return scale * float(value);
+}
+
+bool NoteCache::Player::isActive() const {
+    return store != nullptr && position < length;
+}
+
+void NoteCache::Player::stop() {
+    if (store != nullptr) {
+        store->readers--;
+        store = nullptr;
+    }
+    entry = nullptr;
+    position = 0;
+    length = 0;
+}
+
+// =================================
+// Client
+NoteCache::Client::Client(NoteCache& c, juce::AudioProcessorValueTreeState& state) : cache(c), parameters(state) {
+    choice = parameters.getRawParameterValue("choice");
+
+    for (auto& count : playCount) {
+        count.store(0);
+    }
+
+    const juce::ScopedLock sl(cache.lock);
+    cache.clients.add(this);
+}
+
+NoteCache::Client::~Client() {
+    const juce::ScopedLock sl(cache.lock);
+    cache.clients.removeFirstMatchingValue(this);
+    activeStore.store(nullptr);
+    if (store != nullptr) {
+        cache.releaseStore(store);
+    }
+}
+
+void NoteCache::Client::prepare(double newSampleRate) {
+    sampleRate = newSampleRate;
+    cache.startThread(2);
+    cache.notify();
+}
+
+void NoteCache::Client::release() {
+    // The cache thread drops the store on its next pass
+    sampleRate = 0.0;
+    activeStore.store(nullptr);
+    cache.notify();
+}
+
+void NoteCache::Client::notePlayed(int midiNoteNumber, float velocity) {
+    playCount[midiNoteNumber * numVelocityBuckets + getVelocityBucket(velocity)]++;
+}
+
+bool NoteCache::Client::startPlayer(Player& player, int midiNoteNumber, float velocity, bool excChoice, int seed) {
+    player.stop();
+
+    // Register as a reader before the cache can see this voice as gone (see freeRetiredStores())
+    cache.entering++;
+    Store* store = activeStore.load();
+    if (store != nullptr) {
+        store->readers++;
+    }
+    cache.entering--;
+
+    if (store == nullptr) {
+        return false;
+    }
+
+    int index = store->getSlotEntry(getSlot(midiNoteNumber, getVelocityBucket(velocity), excChoice, seed));
+    if (index < 0) {
+        store->readers--;
+        return false;
+    }
+
+    player.store = store;
+    player.entry = store->getEntry(index);
+    player.length = store->entryLength;
+    player.position = 0;
+    return true;
+}
+
+// =================================
+// NoteCache
+NoteCache::NoteCache() : juce::Thread("AnyPiano note cache") {
+}
+
+NoteCache::~NoteCache() {
+    stopThread(4000);
+
+    // Every processor, and so every voice, is gone with the last client
+    jassert(clients.isEmpty());
+    const juce::ScopedLock sl(lock);
+    const juce::InterProcessLock::ScopedLockType fl(fileLock);
+    stores.clear();
+    retiredStores.clear();
+}
+
+juce::File NoteCache::getCacheDirectory() {
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("AnyPiano").getChildFile("NoteCache");
+}
+
+void NoteCache::run() {
+    juce::ScopedNoDenormals noDenormals;
+    while (!threadShouldExit()) {
+        updateClients();
+        freeRetiredStores();
+
+        // Render in idle time, with a pause between notes to leave the CPU to the host
+        if (renderNextEntry()) {
+            wait(20);
+        }
+        else {
+            wait(250);
+        }
+    }
+}
+
+void NoteCache::updateClients() {
+    const juce::ScopedLock sl(lock);
+    const juce::uint32 now = juce::Time::getMillisecondCounter();
+
+    for (Client* client : clients) {
+        const double sampleRate = client->sampleRate.load();
+        const NoteParameters p = NoteParameters::fromState(client->parameters);
+        const juce::int64 hash = sampleRate > 0.0 ? hashNoteParameters(p, sampleRate) : 0;
+
+        if (hash == client->storeHash) {
+            // Back to the preset of the current store
+            if (client->store != nullptr && client->store->isValid()) {
+                client->activeStore.store(client->store);
+            }
+            continue;
+        }
+
+        // Stop playing notes of the previous preset at once, but only open a file once the parameters have settled
+        client->activeStore.store(nullptr);
+        if (hash != client->pendingHash) {
+            client->pendingHash = hash;
+            client->pendingSince = now;
+        }
+        if (hash == 0 || client->store == nullptr || now - client->pendingSince >= settleMs) {
+            switchStore(*client, hash, p, sampleRate);
+        }
+    }
+}
+
+void NoteCache::switchStore(Client& client, juce::int64 hash, const NoteParameters& p, double sampleRate) {
+    client.activeStore.store(nullptr);
+    if (client.store != nullptr) {
+        releaseStore(client.store);
+    }
+
+    client.store = hash != 0 ? acquireStore(hash, p, sampleRate) : nullptr;
+    client.storeHash = hash;
+    if (client.store != nullptr && client.store->isValid()) {
+        client.activeStore.store(client.store);
+    }
+}
+
+NoteCache::Store* NoteCache::acquireStore(juce::int64 hash, const NoteParameters& p, double sampleRate) {
+    auto it = stores.find(hash);
+    if (it == stores.end()) {
+        auto retired = std::find_if(retiredStores.begin(), retiredStores.end(), [hash](const std::unique_ptr<Store>& s) {
+            return s->hash == hash;
+        });
+        if (retired != retiredStores.end()) {
+            // Still open : take it back rather than mapping the file twice
+            it = stores.emplace(hash, std::move(*retired)).first;
+            retiredStores.erase(retired);
+        }
+        else {
+            juce::File directory = getCacheDirectory();
+            directory.createDirectory();
+            juce::File file = directory.getChildFile(juce::String::toHexString(hash) + "_v" + juce::String(fileVersion) + ".notecache");
+
+            const juce::InterProcessLock::ScopedLockType fl(fileLock);
+            std::unique_ptr<Store> store(new Store(file, hash, p, sampleRate));
+            if (store->isValid()) {
+                file.setLastModificationTime(juce::Time::getCurrentTime());
+            }
+            it = stores.emplace(hash, std::move(store)).first;
+            trimCacheDirectory();
+        }
+    }
+
+    it->second->numClients++;
+    return it->second.get();
+}
+
+void NoteCache::releaseStore(Store* store) {
+    if (--store->numClients > 0) {
+        return;
+    }
+    auto it = stores.find(store->hash);
+    jassert(it != stores.end() && it->second.get() == store);
+    retiredStores.push_back(std::move(it->second));
+    stores.erase(it);
+}
+
+void NoteCache::trimCacheDirectory() {
+    juce::Array<juce::File> files = getCacheDirectory().findChildFiles(juce::File::findFiles, false, "*.notecache");
+
+    // Most recently used first
+    std::sort(files.begin(), files.end(), [](const juce::File& a, const juce::File& b) {
+        return a.getLastModificationTime() > b.getLastModificationTime();
+    });
+
+    const juce::Time staleTime = juce::Time::getCurrentTime() - juce::RelativeTime::days(staleDays);
+    int count = 0;
+    juce::int64 bytes = 0;
+    for (const juce::File& file : files) {
+        bool open = false;
+        for (auto& entry : stores) {
+            open = open || file == entry.second->getFile();
+        }
+        for (auto& store : retiredStores) {
+            open = open || file == store->getFile();
+        }
+
+        // Files mapped by other processes are kept too, unless they look abandoned by a crash
+        if (!open && file.getLastModificationTime() > staleTime) {
+            Header header;
+            juce::FileInputStream in(file);
+            open = in.openedOk() && in.read(&header, sizeof(Header)) == int(sizeof(Header))
+                && isValidHeader(header) && header.users > 0;
+        }
+
+        if (!open && (count >= maxStores || bytes + file.getSize() > maxCacheBytes)) {
+            file.deleteFile();
+            continue;
+        }
+        count++;
+        bytes += file.getSize();
+    }
+}
+
+void NoteCache::freeRetiredStores() {
+    const juce::ScopedLock sl(lock);
+
+    // A voice which loaded a retired store registers as its reader before it stops entering,
+    // so once no voice is entering, the reader counts can only go down
+    if (retiredStores.empty() || entering.load() != 0) {
+        return;
+    }
+
+    const juce::InterProcessLock::ScopedLockType fl(fileLock);
+    retiredStores.erase(std::remove_if(retiredStores.begin(), retiredStores.end(), [](const std::unique_ptr<Store>& s) {
+        return s->readers.load() == 0;
+    }), retiredStores.end());
+}
+
+bool NoteCache::renderNextEntry() {
+    Store* bestStore = nullptr;
+    int bestSlot = -1;
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        // Most played keys and velocities of any client first
+        int bestCount = 0;
+        for (Client* client : clients) {
+            Store* store = client->store;
+            if (store == nullptr || !store->isValid() || store->isFull()) {
+                continue;
+            }
+            const bool excChoice = *client->choice < 0.5f;
+            for (int i = 0; i < numKeys * numVelocityBuckets; i++) {
+                int count = client->playCount[i].load();
+                if (count <= bestCount) {
+                    continue;
+                }
+                for (int seed = 0; seed < numSeeds; seed++) {
+                    int slot = getSlot(i / numVelocityBuckets, i % numVelocityBuckets, excChoice, seed);
+                    if (!store->hasSlot(slot)) {
+                        bestCount = count;
+                        bestStore = store;
+                        bestSlot = slot;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Then the piano range at medium velocity, outwards from middle C
+        for (Client* client : clients) {
+            Store* store = client->store;
+            if (bestSlot >= 0 || store == nullptr || !store->isValid() || store->isFull()) {
+                continue;
+            }
+            const bool excChoice = *client->choice < 0.5f;
+            for (int offset = 0; bestSlot < 0 && offset <= 48; offset++) {
+                for (int key : { 60 + offset, 60 - offset }) {
+                    int slot = getSlot(key, numVelocityBuckets / 2, excChoice, 0);
+                    if (key >= 21 && key <= 108 && !store->hasSlot(slot)) {
+                        bestStore = store;
+                        bestSlot = slot;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Only this thread closes stores, so the store outlives the render without the lock
+    if (bestSlot < 0) {
+        return false;
+    }
+    renderEntry(*bestStore, bestSlot);
+    return true;
+}
+
+void NoteCache::renderEntry(Store& store, int slot) {
+    // Decode the slot
+    const int seed = slot % numSeeds;
+    const bool excChoice = (slot / numSeeds) % 2 == 0;
+    const int velocityBucket = (slot / (numSeeds * 2)) % numVelocityBuckets;
+    const int midiNoteNumber = slot / (numSeeds * 2 * numVelocityBuckets);
+
+    const int index = store.addEntry();
+    if (index < 0) {
+        return;
+    }
+
+    Note note;
+    note.setSampleRate(float(store.sampleRate));
+    note.setSeed(juce::int64(midiNoteNumber) * numSeeds + seed + 1);
+    note.setKey(midiNoteNumber, (velocityBucket + 0.5f) / numVelocityBuckets, excChoice, store.parameters);
+    const bool playable = note.isPlayable();                // Keys with non-finite coefficients are stored silent
+
+    char* entry = store.getEntry(index);
+    const int fadeLength = juce::roundToInt(fadeSeconds * store.sampleRate);
+
+    float samples[blockSize];
+    for (int start = 0; start < store.entryLength; start += blockSize) {
+        // Render a block, fading out the end of the note
+        float peak = 0.0f;
+        for (int i = 0; i < blockSize; i++) {
+            int remaining = store.entryLength - (start + i);
+            float fade = remaining < fadeLength ? float(remaining) / float(fadeLength) : 1.0f;
+            samples[i] = playable ? fade * note.process() : 0.0f;
+            peak = juce::jmax(peak, std::abs(samples[i]));
+        }
+
+        // Store as 16 bit integers with one scale per block
+        float scale = peak > 0.0f ? peak / 32767.0f : 1.0f;
+        char* block = entry + size_t(start / blockSize) * blockBytes;
+        memcpy(block, &scale, sizeof(float));
+        for (int i = 0; i < blockSize; i++) {
+            juce::int16 value = juce::int16(juce::roundToInt(samples[i] / scale));
+            memcpy(block + sizeof(float) + i * sizeof(juce::int16), &value, sizeof(juce::int16));
+        }
+
+        if (threadShouldExit()) {
+            return;
+        }
+    }
+
+    store.publish(slot, index);
+}
+
+int NoteCache::getSlot(int midiNoteNumber, int velocityBucket, bool excChoice, int seed) {
+    return ((midiNoteNumber * numVelocityBuckets + velocityBucket) * 2 + (excChoice ? 0 : 1)) * numSeeds + seed;
+}
+
+int NoteCache::getVelocityBucket(float velocity) {
+    return juce::jlimit(0, numVelocityBuckets - 1, int(velocity * numVelocityBuckets));
+}
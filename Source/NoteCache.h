@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+
+    NoteCache.h
+    Author:  Ruthu Prem Kumar
+
+    Cache of pre-rendered notes, used as a fallback when the voices can no
+    longer afford to simulate every string.
+
+    For a given preset a note only depends on its key, velocity bucket,
+    excitation (struck/plucked) and detune seed, so a background thread
+    renders notes in idle time (most played keys first) and stores them in a
+    memory-mapped file named after a hash of the preset parameters.
+    Samples are stored in blocks of 16 bit integers with one scale per block.
+
+    There is one cache per process, held by SharedResources : each processor
+    registers a Client, and clients on the same preset share one store and
+    one renderer. Several processes may map the same file, so entries are
+    claimed with an atomic counter in the mapped header, and files are only
+    created, opened, closed or deleted under an inter-process lock. A file
+    still mapped by another process is never deleted or recreated.
+
+    A change of parameters stops the voices of a client from reading the old
+    file at once, and switches to the file of the new preset once the
+    parameters have settled, so that moving a slider does not create a file
+    per value. Existing files are mapped instantly on startup. The least
+    recently used files are deleted past maxStores files or maxCacheBytes.
+    Call Client::prepare() from prepareToPlay(), then use startPlayer() and
+    Player::nextSample() from the audio thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <map>
+#include "Note.h"
+
+class NoteCache : private juce::Thread {
+public:
+
+    static constexpr int numKeys = 128;                     // MIDI keys
+    static constexpr int numVelocityBuckets = 4;            // Velocity resolution of cached notes
+    static constexpr int numSeeds = 2;                      // Detune variations per cached note
+    static constexpr int numSlots = numKeys * numVelocityBuckets * 2 * numSeeds;
+    static constexpr int maxEntries = 128;                  // Number of notes stored per preset
+    static constexpr int blockSize = 256;                   // Samples per compressed block
+    static constexpr float noteSeconds = 4.0f;              // Length of a cached note (s)
+    static constexpr float fadeSeconds = 0.05f;             // Fade out at the end of a cached note (s)
+    static constexpr juce::uint32 settleMs = 1000;          // Time the parameters must stay unchanged before a store is opened (ms)
+    static constexpr int maxStores = 16;                    // Number of cache files kept
+    static constexpr juce::int64 maxCacheBytes = juce::int64(1) << 30;  // Total size of the cache files kept (bytes, sparse files count in full)
+    static constexpr int staleDays = 7;                     // Files unused for longer are deleted even if a crashed process left them marked open
+
+    class Store;
+    class Client;
+
+    /* Streams one cached note, owned by a voice*/
+    class Player {
+    public:
+        ~Player();
+
+        /* Returns the next sample of the cached note, 0 once the note has ended*/
+        float nextSample();
+
+        /* True while a cached note is being played*/
+        bool isActive() const;
+
+        /* Stops playing and releases the store*/
+        void stop();
+
+    private:
+        friend class NoteCache;
+        friend class Client;
+
+        Store* store = nullptr;                             // Store the note is read from
+        const char* entry = nullptr;                        // Start of the note in the mapped file
+        int position = 0;                                   // Sample position in the note
+        int length = 0;                                     // Length of the note in samples
+    };
+
+    /* The cache as seen by one processor : its preset, and the notes it plays*/
+    class Client {
+    public:
+        Client(NoteCache& cache, juce::AudioProcessorValueTreeState& parameters);
+        ~Client();
+
+        /* Sets the sample rate and starts caching the notes of this processor*/
+        void prepare(double sampleRate);
+
+        /* Stops caching and playing the notes of this processor*/
+        void release();
+
+        /* Counts a note on, so that the most played keys are rendered first (audio thread)*/
+        void notePlayed(int midiNoteNumber, float velocity);
+
+        /* Starts playing a cached note, returns false if it has not been rendered yet (audio thread)*/
+        bool startPlayer(Player& player, int midiNoteNumber, float velocity, bool excChoice, int seed);
+
+    private:
+        friend class NoteCache;
+
+        NoteCache& cache;                                   // Cache this client is registered with
+        juce::AudioProcessorValueTreeState& parameters;     // Parameters of the processor
+        std::atomic<float>* choice;                         // Struck or plucked
+
+        std::atomic<double> sampleRate { 0.0 };             // Sample rate of the processor, 0 when released
+        Store* store = nullptr;                             // Store of the current preset (cache thread)
+        juce::int64 storeHash = 0;                          // Hash of the preset in the store
+        juce::int64 pendingHash = 0;                        // Hash of the parameters waiting to settle
+        juce::uint32 pendingSince = 0;                      // Time the pending hash was first seen (ms)
+        std::atomic<Store*> activeStore { nullptr };        // Store the voices read from
+
+        std::atomic<int> playCount[numKeys * numVelocityBuckets];   // Note ons per key and velocity bucket
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Client)
+    };
+
+    NoteCache();
+    ~NoteCache() override;
+
+    /* Folder holding the cache files*/
+    static juce::File getCacheDirectory();
+
+private:
+
+    void run() override;
+
+    /* Follows the preset of every client, switching stores once the parameters have settled*/
+    void updateClients();
+
+    /* Points the client at the store of the given preset (0 for none)*/
+    void switchStore(Client& client, juce::int64 hash, const NoteParameters& p, double sampleRate);
+
+    /* Returns the store of a preset, mapping its file if no client uses it yet*/
+    Store* acquireStore(juce::int64 hash, const NoteParameters& p, double sampleRate);
+
+    /* Drops a client's use of a store, retiring it when no client is left*/
+    void releaseStore(Store* store);
+
+    /* Deletes the least recently used cache files past maxStores or maxCacheBytes, except the open ones*/
+    void trimCacheDirectory();
+
+    /* Closes the retired stores once no voice can be reading them*/
+    void freeRetiredStores();
+
+    /* Renders the most wanted missing note, returns false if there is nothing left to render*/
+    bool renderNextEntry();
+
+    /* Renders one note into the store*/
+    void renderEntry(Store& store, int slot);
+
+    static int getSlot(int midiNoteNumber, int velocityBucket, bool excChoice, int seed);
+    static int getVelocityBucket(float velocity);
+
+    juce::CriticalSection lock;                             // Guards the clients and stores (never taken on the audio thread)
+    juce::InterProcessLock fileLock { "AnyPianoNoteCache" };    // Guards the cache files against other processes
+    juce::Array<Client*> clients;                           // Registered processors
+    std::map<juce::int64, std::unique_ptr<Store>> stores;   // Open stores by preset hash
+    std::vector<std::unique_ptr<Store>> retiredStores;      // Stores no client uses, kept while voices read them
+
+    std::atomic<int> entering { 0 };                        // Voices between loading a client's store and registering as its reader
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(NoteCache)
+};
@@ -0,0 +1,165 @@
+/*
+  ==============================================================================
+
+    NoteTables.h
+    Author:  Ruthu Prem Kumar
+
+    Immutable tables shared between notes (and between plugin instances, see
+    SharedResources.h).
+
+    NoteParameters is a snapshot of the preset parameters which shape a note.
+    KeyTable holds the geometry and FDTD coefficients of every key for one
+    preset and sample rate, ForceTable holds unit amplitude Hann windows for
+    every force duration at one sample rate.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "String.h"
+#include "Hann.h"
+#include <vector>
+#include <JuceHeader.h>
+
+/* Snapshot of the preset parameters which shape the output of a note */
+struct NoteParameters {
+    float T60;                                      // T60 time (s)
+    float interval;                                 // Interval between string strikes (ms)
+    float freqParam;                                // Frequency randomising scaler
+    float baseVel;                                  // Least value for input force (N)
+    float velCurve;                                 // Velocity scaling
+    float E;                                        // Young's Modulus (GPa)
+    float rho;                                      // Density (kg/m^3)
+    float xi;                                       // Coordinate of excitation
+    float xo;                                       // Coordinate of output
+    float lengthParam;                              // Parameter to adjust length of strings
+    float radiusParam;                              // Parameter to adjust radius of strings
+    float lim1;                                     // MIDI range till which note has 1 string
+    float lim2;                                     // MIDI range till which note has 2 strings
+
+    /* Reads the current values from the processor parameters (not for the audio thread)*/
+    static NoteParameters fromState(juce::AudioProcessorValueTreeState& state) {
+        NoteParameters p;
+        p.T60 = *state.getRawParameterValue("T60time");
+        p.interval = *state.getRawParameterValue("interval");
+        p.freqParam = *state.getRawParameterValue("freqParam");
+        p.baseVel = *state.getRawParameterValue("baseVel");
+        p.velCurve = *state.getRawParameterValue("velCurve");
+        p.E = *state.getRawParameterValue("youngsModulus");
+        p.rho = *state.getRawParameterValue("density");
+        p.xi = *state.getRawParameterValue("xi");
+        p.xo = *state.getRawParameterValue("xo");
+        p.lengthParam = *state.getRawParameterValue("lengthParam");
+        p.radiusParam = *state.getRawParameterValue("radiusParam");
+        p.lim1 = *state.getRawParameterValue("lim1");
+        p.lim2 = *state.getRawParameterValue("lim2");
+        return p;
+    }
+};
+
+/* Hash of the note parameters and the sample rate (FNV-1a)*/
+inline juce::int64 hashNoteParameters(const NoteParameters& p, double sampleRate) {
+    juce::uint64 hash = 14695981039346656037ull;
+    auto add = [&hash](const void* data, size_t size) {
+        const auto* bytes = static_cast<const juce::uint8*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    add(&p, sizeof(NoteParameters));
+    add(&sampleRate, sizeof(double));
+    return juce::int64(hash & 0x7fffffffffffffffull);
+}
+
+/* Pickup positions (0-1) spread evenly around xo*/
+inline void spreadPickups(float xo, float spread, int count, float* positions) {
+    for (int p = 0; p < count; p++) {
+        float offset = count > 1 ? spread * (float(p) / float(count - 1) - 0.5f) : 0.0f;
+        positions[p] = juce::jlimit(0.01f, 0.99f, xo + offset);
+    }
+}
+
+/* Properties of the strings of one key*/
+struct KeyGeometry {
+    int numStrings;                                 // Number of strings in the note
+    float frequency;                                // Nominal frequency (Hz)
+    float length;                                   // Length of the strings (m)
+    float radius;                                   // Radius of the strings (mm)
+    StringCoefficients coefficients;                // Coefficients of an undetuned string
+
+    /* Nominal frequency of a key (Hz), stretched from equal temperament*/
+    static float getFrequency(int midiNoteNumber) {
+        return juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber) + 0.1443 * midiNoteNumber - 7.766;
+    }
+
+    /* Computes the geometry of a key from the preset parameters*/
+    static KeyGeometry compute(int midiNoteNumber, const NoteParameters& p, double sampleRate) {
+        KeyGeometry g;
+
+        // Number of strings in Note (based on lim1 and lim2)
+        if (midiNoteNumber < int(p.lim1)) {
+            g.numStrings = 1;
+        }
+        else if (midiNoteNumber < int(p.lim2)) {
+            g.numStrings = 2;
+        }
+        else {
+            g.numStrings = 3;
+        }
+
+        // Set length and radius of strings of note
+        g.frequency = getFrequency(midiNoteNumber);
+        g.length = p.lengthParam * (-0.019196429 * float(midiNoteNumber) + 1.815625);
+        g.radius = p.radiusParam * (-2.08333e-03 * float(midiNoteNumber) + 0.62875);
+
+        g.coefficients = String::computeCoefficients(float(sampleRate), p.E * 1e9, p.rho,
+            g.frequency, g.length, g.radius / 1000.0f, p.T60);
+        g.length = g.coefficients.L;                        // Top keys are lengthened to the smallest grid
+        return g;
+    }
+};
+
+/* Geometry of all 128 keys for one preset and sample rate*/
+struct KeyTable {
+    KeyTable(const NoteParameters& p, double sr) : parameters(p), sampleRate(sr), hash(hashNoteParameters(p, sr)) {
+        for (int i = 0; i < 128; i++) {
+            keys[i] = KeyGeometry::compute(i, p, sr);
+        }
+    }
+
+    const NoteParameters parameters;                // Preset the table was built for
+    const double sampleRate;                        // Sample rate the table was built for
+    const juce::int64 hash;                         // hashNoteParameters(parameters, sampleRate)
+    KeyGeometry keys[128];                          // Geometry per MIDI key
+};
+
+/* Unit amplitude force signals for every duration at one sample rate*/
+struct ForceTable {
+    /* Builds windows up to the longest force duration (3 ms, velocity 0)*/
+    ForceTable(double sr) : sampleRate(sr), maxDuration(juce::jmax(1, int(round(0.003 * sr)))) {
+        full.resize(maxDuration + 1);
+        half.resize(maxDuration + 1);
+
+        Hann window;
+        window.setFamp(1.0f);
+        for (int d = 1; d <= maxDuration; d++) {
+            window.setDur(d);
+            float* f = window.fullHann();
+            full[d].assign(f, f + d);
+            f = window.halfHann();
+            half[d].assign(f, f + d);
+        }
+    }
+
+    /* Returns the window for a duration in samples, struck (full) or plucked (half)*/
+    const float* get(int durationInSamples, bool struck) const {
+        int d = juce::jlimit(1, maxDuration, durationInSamples);
+        return struck ? full[d].data() : half[d].data();
+    }
+
+    const double sampleRate;                        // Sample rate the table was built for
+    const int maxDuration;                          // Longest window in samples
+    std::vector<std::vector<float>> full;           // Full Hann windows (struck)
+    std::vector<std::vector<float>> half;           // Half Hann windows (plucked)
+};
@@ -11,11 +11,22 @@
 
 //==============================================================================
 PluginAudioProcessorEditor::PluginAudioProcessorEditor (PluginAudioProcessor& p)
-    : AudioProcessorEditor (&p), audioProcessor (p)
+    : AudioProcessorEditor (&p), audioProcessor (p),
+      parameterEditor (p), stringView (p.getSnapshots())
 {
+    addAndMakeVisible (parameterEditor);
+    addAndMakeVisible (stringView);
+
+    captureButton.setButtonText (p.getCapture().isCapturing() ? "Stop Capture" : "Capture Session");
+    captureButton.setTooltip ("Records MIDI, block sizes and parameters for the SessionReplay tool");
+    captureButton.onClick = [this] { toggleCapture(); };
+    addAndMakeVisible (captureButton);
+
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
+    setResizable (true, true);
+    setResizeLimits (800, 400, 2400, 1600);
+    setSize (1100, 640);
 }
 
 PluginAudioProcessorEditor::~PluginAudioProcessorEditor()
@@ -27,14 +38,38 @@ void PluginAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Piano Synthesiser", getLocalBounds(), juce::Justification::centred, 1);
 }
 
 void PluginAudioProcessorEditor::resized()
 {
-    // This is generally where you'll want to lay out the positions of any
-    // subcomponents in your editor..
+    // Parameters on the left, strings on the right
+    auto area = getLocalBounds();
+    auto left = area.removeFromLeft (420);
+    captureButton.setBounds (left.removeFromBottom (32).reduced (4));
+    parameterEditor.setBounds (left);
+    stringView.setBounds (area);
+}
+
+void PluginAudioProcessorEditor::toggleCapture()
+{
+    auto& capture = audioProcessor.getCapture();
+    if (capture.isCapturing())
+    {
+        bool complete = ! capture.hasOverflowed();
+        capture.stop();
+        captureButton.setButtonText ("Capture Session");
+        if (! complete)
+            juce::AlertWindow::showMessageBoxAsync (juce::AlertWindow::WarningIcon, "Session Capture",
+                "The capture could not keep up and stopped early :\n" + capture.getFile().getFullPathName());
+        return;
+    }
+
+    auto file = juce::File::getSpecialLocation (juce::File::userDocumentsDirectory)
+                    .getChildFile ("AnyPiano Sessions")
+                    .getChildFile ("session-" + juce::Time::getCurrentTime().formatted ("%Y%m%d-%H%M%S") + ".aptrace");
+    if (capture.start (file))
+        captureButton.setButtonText ("Stop Capture");
+    else
+        juce::AlertWindow::showMessageBoxAsync (juce::AlertWindow::WarningIcon, "Session Capture",
+            "Cannot write " + file.getFullPathName());
 }
@@ -10,6 +10,7 @@
 
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "StringView.h"
 
 //==============================================================================
 /**
@@ -29,5 +30,12 @@ private:
     // access the processor object that created it.
     PluginAudioProcessor& audioProcessor;
 
+    juce::GenericAudioProcessorEditor parameterEditor;      // Sliders for every parameter
+    StringView stringView;                                  // State of the voices
+    juce::TextButton captureButton;                         // Starts and stops a session capture
+
+    /* Starts a capture to a new file in the sessions folder, or stops the current one*/
+    void toggleCapture();
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginAudioProcessorEditor)
 };
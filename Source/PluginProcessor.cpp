@@ -11,7 +11,7 @@
 #include "JuceHeader.h"
 
 //==============================================================================
-PluginAudioProcessor::PluginAudioProcessor()
+PluginAudioProcessor::PluginAudioProcessor(bool renderInBackground)
 #ifndef JucePlugin_PreferredChannelConfigurations
      : AudioProcessor (BusesProperties()
                      #if ! JucePlugin_IsMidiEffect
@@ -22,29 +22,8 @@ PluginAudioProcessor::PluginAudioProcessor()
                      #endif
                        ),
 #endif
-parameters(*this, nullptr, "ParamTree", {
-// Parameter layout 
-// id, description, min val, max val, default val
-std::make_unique<juce::AudioParameterFloat>("gain","Gain",0.5f, 200.0f, 50.0f),
-std::make_unique<juce::AudioParameterFloat>("choice","Struck or Plucked(0 or 1)",0.0f,1.0f,0.1f),
-std::make_unique<juce::AudioParameterFloat>("T60time","T60(s)",1.0f, 10.0f, 5.0f),
-std::make_unique<juce::AudioParameterFloat>("interval","Interval(milliseconds)",0.0f, 1000.0f, 20.0f),
-std::make_unique<juce::AudioParameterFloat>("freqParam","Frequency Random Parameter",0.0f, 10.0f, 1.0f),
-std::make_unique<juce::AudioParameterFloat>("baseVel","Strike force(N)",0.0f, 100.0f, 15.0f),
-std::make_unique<juce::AudioParameterFloat>("velCurve","Velocity Curve",0.0f, 15.0f, 5.0f),
-std::make_unique<juce::AudioParameterFloat>("youngsModulus","Young's Modulus(GPa)",10.0f, 1000.0f, 190.0f),
-std::make_unique<juce::AudioParameterFloat>("density","Density (kg/m^3)",1000.0f, 20000.0f, 8000.0f),
-std::make_unique<juce::AudioParameterFloat>("xi","Striking Point",0.01f, 0.99f, 0.3f),
-std::make_unique<juce::AudioParameterFloat>("xo","Microphone Position", 0.01f, 0.99f, 0.5f),
-std::make_unique<juce::AudioParameterFloat>("lengthParam","Length",0.1f, 10.0f, 1.0f),
-std::make_unique<juce::AudioParameterFloat>("radiusParam","Radius",0.1f, 10.0f, 1.0f),
-std::make_unique<juce::AudioParameterFloat>("lim1","MIDI limit for 1 string note", 1, 127, 14),
-std::make_unique<juce::AudioParameterFloat>("lim2","MIDI limit for 2 string note", 1, 127, 30),
-std::make_unique<juce::AudioParameterFloat>("attack","Attack(s)",0.01f, 2.0f, 0.05f),
-std::make_unique<juce::AudioParameterFloat>("decay","Decay(s)",0.01f, 2.0f, 0.05f),
-std::make_unique<juce::AudioParameterFloat>("sustain","Sustain(level)",0.1f, 1.0f, 0.5f),
-std::make_unique<juce::AudioParameterFloat>("release","Release(s)",0.01f, 5.0f, 0.2f),
-})
+parameters(*this, nullptr, "ParamTree", createParameterLayout()),
+backgroundRenderers(renderInBackground)
 
 {   // Constructor
 
@@ -69,6 +48,7 @@ std::make_unique<juce::AudioParameterFloat>("release","Release(s)",0.01f, 5.0f,
 
     xi = parameters.getRawParameterValue("xi");
     xo = parameters.getRawParameterValue("xo");
+    pickupSpread = parameters.getRawParameterValue("pickupSpread");
 
     lengthParam = parameters.getRawParameterValue("lengthParam");
     radiusParam = parameters.getRawParameterValue("radiusParam");
@@ -76,24 +56,39 @@ std::make_unique<juce::AudioParameterFloat>("release","Release(s)",0.01f, 5.0f,
     lim1 = parameters.getRawParameterValue("lim1");
     lim2 = parameters.getRawParameterValue("lim2");
 
+    tailTime = parameters.getRawParameterValue("tailTime");
+    renderAhead = parameters.getRawParameterValue("renderAhead");
+    resonance = parameters.getRawParameterValue("resonance");
+
     // Adding Synth voices
     for (int i = 0; i < voiceCount; i++) {
         synth.addVoice(new SynthVoice());
     }
-    // Adding Synth sound
-    synth.addSound(new SynthSound());
+    synth.setSnapshotBuffer(&snapshots);
+    synth.setResonancePointers(resonance, &keyTable);
+    synth.setEngineProfile(sharedResources->getEngineTuner().getProfilePointer());
+    capture.setParameters(parameters);
 
     // Variable Parameters
     for (int i = 0; i < voiceCount; i++) {
-        SynthVoice* v = dynamic_cast<SynthVoice*>(synth.getVoice(i));
+        SynthVoice* v = synth.getVoice(i);
         v->setParamPointers(T60time, gain, velCurve, baseVel, choice, youngsModulus, density);
         v->setNotePointers(interval, freqParam, xi, xo, lengthParam, radiusParam, lim1, lim2);
         v->setADSRPointers(attack, decay, sustain, release);
+        v->setFallback(&noteCache, &budget);
+        v->setResponses(backgroundRenderers ? &impulseResponses : nullptr);
+        v->setHealth(&health);
+        v->setTablePointers(&keyTable, &forceTable);
+        v->setTailPointer(tailTime);
     }
+
+    // Follow preset changes with the shared key tables
+    startTimer(100);
 }
 
 PluginAudioProcessor::~PluginAudioProcessor()
 {
+    stopTimer();
 }
 
 //==============================================================================
@@ -165,6 +160,9 @@ void PluginAudioProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
+    noteCache.release();
+    impulseResponses.release();
+    pipeline.release();
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -175,11 +173,10 @@ bool PluginAudioProcessor::isBusesLayoutSupported (const BusesLayout& layouts) c
     return true;
   #else
     // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // Each output channel is fed by its own pickup on the strings, so any
+    // layout with up to String::maxPickups channels is supported.
+    if (layouts.getMainOutputChannelSet().isDisabled()
+     || layouts.getMainOutputChannelSet().size() > String::maxPickups)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -201,20 +198,157 @@ void PluginAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
 
+    // Stop the render thread before changing the synthesiser it renders
+    pipeline.release();
+
     synth.setCurrentPlaybackSampleRate(sampleRate);             // Set sample rate for synthesiser
 
     for (int i = 0; i < voiceCount; i++) {
-        SynthVoice* v = dynamic_cast<SynthVoice*>(synth.getVoice(i));
+        SynthVoice* v = synth.getVoice(i);
         v->init(sampleRate);
+        v->setPickupPointers(pickupSpread, getTotalNumOutputChannels());
+    }
+
+    // Shared tables and worker pool
+    forceTableOwner = sharedResources->getForceTable(sampleRate);
+    forceTable = forceTableOwner.get();
+    updateSharedTables();
+    synth.prepare(&sharedResources->getWorkerPool(), samplesPerBlock, getTotalNumOutputChannels());
+    qualityProfile = -1;
+    updateQuality();
+
+    // Render ahead on a background thread at the cost of latency, only switched on or off here
+    if (*renderAhead >= 0.5f) {
+        pipeline.prepare(sampleRate, samplesPerBlock, getTotalNumOutputChannels());
+        setLatencySamples(pipeline.getLatencySamples());
+    }
+    else {
+        setLatencySamples(0);
+    }
+
+    // Start rendering the note cache and the key responses for this sample rate
+    if (backgroundRenderers) {
+        noteCache.prepare(sampleRate);
+        impulseResponses.prepare(sampleRate, getTotalNumOutputChannels());
     }
 }
 
 void PluginAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
     juce::ScopedNoDenormals noDenormals;
+    auto startTicks = juce::Time::getHighResolutionTicks();
+
+    // The host may start or stop bouncing between any two blocks
+    updateQuality();
+
+    // Record the block as the host gave it, before anything consumes the MIDI
+    capture.recordBlock(getSampleRate(), getBlockSize(), buffer.getNumChannels(), buffer.getNumSamples(), midiMessages);
     
-    // Calling render block for synth
-    synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    // Calling render block for synth, or mixing what was rendered ahead
+    if (pipeline.isActive()) {
+        pipeline.process(buffer, midiMessages, isNonRealtime());
+    }
+    else {
+        synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+    }
+
+    // Smoothed CPU load, used to fall back on cached notes when overloaded
+    if (pipeline.isActive()) {
+        budget.cpuLoad = pipeline.getLoad();
+    }
+    else if (buffer.getNumSamples() > 0) {
+        double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+        float load = float(seconds * getSampleRate() / buffer.getNumSamples());
+        budget.cpuLoad = 0.9f * budget.cpuLoad.load() + 0.1f * load;
+    }
+}
+
+void PluginAudioProcessor::updateQuality()
+{
+    int profile = isNonRealtime() ? 1 : 0;
+    if (profile == qualityProfile) {
+        return;
+    }
+    qualityProfile = profile;
+
+    // Notes already playing keep their engine, the rest applies from the next block
+    QualityProfile quality = profile == 1 ? QualityProfile::offline() : QualityProfile::realtime();
+    budget.maxSimulating = quality.maxSimulating;
+    budget.maxCpuLoad = quality.maxCpuLoad;
+    synth.setOffline(profile == 1);
+}
+
+void PluginAudioProcessor::updateSharedTables()
+{
+    if (getSampleRate() <= 0.0) {
+        return;
+    }
+
+    // Free the previous table once the synth has finished the block it may have been rendering with it,
+    // counted by the thread which renders (the render-ahead thread can lag behind the callback)
+    if (retiredKeyTable != nullptr && synth.getBlocksRendered() - retiredAtRender >= 1) {
+        retiredKeyTable.reset();
+    }
+
+    NoteParameters p = NoteParameters::fromState(parameters);
+    if (keyTableOwner != nullptr && keyTableOwner->sampleRate == getSampleRate()
+        && keyTableOwner->hash == hashNoteParameters(p, getSampleRate())) {
+        return;
+    }
+    if (retiredKeyTable != nullptr) {
+        return;                                                     // Try again once the previous table is free
+    }
+
+    // Counted after publishing, so that any block started with the previous table completes past retiredAtRender
+    retiredKeyTable = keyTableOwner;
+    keyTableOwner = sharedResources->getKeyTable(p, getSampleRate());
+    keyTable = keyTableOwner.get();
+    retiredAtRender = synth.getBlocksRendered();
+}
+
+void PluginAudioProcessor::timerCallback()
+{
+    updateSharedTables();
+
+    // The convolvers are only allocated once the impulse response mode is turned on, off the audio thread
+    if (impulseResponses.isEnabled()) {
+        for (int i = 0; i < synth.getNumVoices(); i++) {
+            synth.getVoice(i)->prepareConvolver();
+        }
+    }
+}
+
+juce::AudioProcessorValueTreeState::ParameterLayout PluginAudioProcessor::createParameterLayout()
+{
+    juce::AudioProcessorValueTreeState::ParameterLayout layout;
+
+    // Parameter layout
+    // id, description, min val, max val, default val
+    layout.add(std::make_unique<juce::AudioParameterFloat>("gain","Gain",0.5f, 200.0f, 50.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("choice","Struck or Plucked(0 or 1)",0.0f,1.0f,0.1f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("T60time","T60(s)",1.0f, 10.0f, 5.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("interval","Interval(milliseconds)",0.0f, 1000.0f, 20.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("freqParam","Frequency Random Parameter",0.0f, 10.0f, 1.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("baseVel","Strike force(N)",0.0f, 100.0f, 15.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("velCurve","Velocity Curve",0.0f, 15.0f, 5.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("youngsModulus","Young's Modulus(GPa)",10.0f, 1000.0f, 190.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("density","Density (kg/m^3)",1000.0f, 20000.0f, 8000.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("xi","Striking Point",0.01f, 0.99f, 0.3f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("xo","Microphone Position", 0.01f, 0.99f, 0.5f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("pickupSpread","Microphone Spread", 0.0f, 0.5f, 0.1f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("lengthParam","Length",0.1f, 10.0f, 1.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("radiusParam","Radius",0.1f, 10.0f, 1.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("lim1","MIDI limit for 1 string note", 1, 127, 14));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("lim2","MIDI limit for 2 string note", 1, 127, 30));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("attack","Attack(s)",0.01f, 2.0f, 0.05f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("decay","Decay(s)",0.01f, 2.0f, 0.05f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("sustain","Sustain(level)",0.1f, 1.0f, 0.5f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("release","Release(s)",0.01f, 5.0f, 0.2f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("tailTime","Resonator Hand-off(s)",0.25f, 20.0f, 2.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("renderAhead","Render Ahead (0 or 1)",0.0f, 1.0f, 0.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("irMode","Impulse Response Mode (0 or 1)",0.0f, 1.0f, 0.0f));
+    layout.add(std::make_unique<juce::AudioParameterFloat>("resonance","Sympathetic Resonance",0.0f, 1.0f, 0.0f));
+    return layout;
 }
 
 //==============================================================================
@@ -225,8 +359,23 @@ bool PluginAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* PluginAudioProcessor::createEditor()
 {
-    return new juce::GenericAudioProcessorEditor (*this);
-} 
+    return new PluginAudioProcessorEditor (*this);
+}
+
+SnapshotBuffer& PluginAudioProcessor::getSnapshots()
+{
+    return snapshots;
+}
+
+SessionCapture& PluginAudioProcessor::getCapture()
+{
+    return capture;
+}
+
+const HealthCounters& PluginAudioProcessor::getHealth() const
+{
+    return health;
+}
 
 //==============================================================================
 void PluginAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
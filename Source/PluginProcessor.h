@@ -12,16 +12,24 @@
 #include "Hann.h"
 #include "Note.h"
 #include "Synth.h"
+#include "NoteCache.h"
+#include "ImpulseResponses.h"
+#include "SharedResources.h"
+#include "RenderPipeline.h"
+#include "SessionCapture.h"
 
 
 //==============================================================================
 /**
 */
-class PluginAudioProcessor  : public juce::AudioProcessor
+class PluginAudioProcessor  : public juce::AudioProcessor,
+                              private juce::Timer
 {
 public:
     //==============================================================================
-    PluginAudioProcessor();
+    /* Tools which measure or compare renders pass backgroundRenderers = false, so that no note cache or
+       key responses are rendered behind their back (nor written to the user's cache folder)*/
+    PluginAudioProcessor(bool backgroundRenderers = true);
     ~PluginAudioProcessor() override;
 
     //==============================================================================
@@ -57,7 +65,31 @@ public:
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
 
+    //==============================================================================
+    /* Snapshots of the voices for the editor*/
+    SnapshotBuffer& getSnapshots();
+
+    /* Recorder of the blocks, MIDI and parameters fed to the processor (see SessionCapture.h)*/
+    SessionCapture& getCapture();
+
+    /* Counters of the numerical watchdog of the voices (see HealthCounters)*/
+    const HealthCounters& getHealth() const;
+
+    /* Parameters of the plugin, for tools which need them without building a processor*/
+    static juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
+
+    /* Picks up the shared key table for the current preset (message thread, also called from a timer)*/
+    void updateSharedTables();
+
 private:
+    void timerCallback() override;
+
+    /* Applies the quality profile of the current processing mode (see QualityProfile)*/
+    void updateQuality();
+
+    /// Resources shared by all instances in the process
+    juce::SharedResourcePointer<SharedResources> sharedResources;
+
     /// Audio Processor value parameters
     juce::AudioProcessorValueTreeState parameters;
 
@@ -87,6 +119,7 @@ private:
     // Excitation Properties
     std::atomic<float>* xi;
     std::atomic<float>* xo;
+    std::atomic<float>* pickupSpread;
 
     // Length and Radius
     std::atomic<float>* lengthParam;
@@ -96,9 +129,46 @@ private:
     std::atomic<float>* lim1;
     std::atomic<float>* lim2;
 
+    // Time after which ringing notes continue as a resonator bank
+    std::atomic<float>* tailTime;
+
+    // Render ahead of the callback, applied in prepareToPlay
+    std::atomic<float>* renderAhead;
+
+    // Level of the sympathetic resonance while the sustain pedal is down
+    std::atomic<float>* resonance;
+
+    const bool backgroundRenderers;                                 // The note cache and key responses are rendered
+
+    /// Overload fallback (declared before the synth, whose voices read from the cache)
+    NoteCache::Client noteCache { sharedResources->getNoteCache(), parameters };
+    VoiceBudget budget;
+    HealthCounters health;
+
+    /// Key responses for the convolution mode (declared before the synth, whose voices read from them)
+    ImpulseResponses::Client impulseResponses { sharedResources->getImpulseResponses(), parameters };
+
+    /// Shared tables, published to the voices through the atomics
+    std::shared_ptr<const KeyTable> keyTableOwner;
+    std::shared_ptr<const KeyTable> retiredKeyTable;                // Kept until the audio thread has moved on
+    std::shared_ptr<const ForceTable> forceTableOwner;
+    std::atomic<const KeyTable*> keyTable { nullptr };
+    std::atomic<const ForceTable*> forceTable { nullptr };
+    juce::uint32 retiredAtRender = 0;                               // Blocks rendered by the synth when retiredKeyTable was replaced
+
     /// Synth parameters
-    juce::Synthesiser synth;
+    PianoSynthesiser synth;
     int voiceCount = 16;
+    int qualityProfile = -1;                                        // Applied profile, 1 while bouncing offline
+
+    /// Voice state published to the editor
+    SnapshotBuffer snapshots;
+
+    /// Session trace for SessionReplay
+    SessionCapture capture { sharedResources->getCaptureWriter() };
+
+    /// Optional render-ahead mode (declared after the synth, which it renders)
+    RenderPipeline pipeline { synth, sharedResources->getRenderAhead(), health };
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginAudioProcessor)
 };
@@ -0,0 +1,244 @@
+/*
+==============================================================================
+
+RenderPipeline.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "RenderPipeline.h"
+
+namespace {
+    thread_local bool renderThread = false;
+}
+
+// =================================
+// Renderer
+RenderPipeline::Renderer::Renderer() : juce::Thread("AnyPiano render ahead") {
+}
+
+RenderPipeline::Renderer::~Renderer() {
+    stopThread(1000);
+}
+
+void RenderPipeline::Renderer::add(RenderPipeline* pipeline) {
+    {
+        const juce::ScopedLock sl(lock);
+        pipelines.addIfNotAlreadyThere(pipeline);
+    }
+    startThread(9);
+}
+
+void RenderPipeline::Renderer::remove(RenderPipeline* pipeline) {
+    const juce::ScopedLock sl(lock);
+    pipelines.removeFirstMatchingValue(pipeline);
+}
+
+void RenderPipeline::Renderer::wake() {
+    wakeUp.signal();
+}
+
+void RenderPipeline::Renderer::run() {
+    renderThread = true;
+    while (!threadShouldExit()) {
+        // One chunk per pipeline and pass, so that no instance starves the others
+        bool renderedAny = false;
+        {
+            const juce::ScopedLock sl(lock);
+            for (auto* pipeline : pipelines) {
+                renderedAny = pipeline->renderNext() || renderedAny;
+            }
+        }
+        if (!renderedAny) {
+            wakeUp.wait(10);
+        }
+    }
+}
+
+// =================================
+// RenderPipeline
+RenderPipeline::RenderPipeline(PianoSynthesiser& s, Renderer& r, HealthCounters& h)
+    : synth(s), renderer(r), health(h) {}
+
+RenderPipeline::~RenderPipeline() {
+    release();
+}
+
+void RenderPipeline::prepare(double sr, int samplesPerBlock, int numChannels) {
+    release();
+
+    sampleRate = sr;
+    chunkSize = juce::jmax(1, samplesPerBlock);
+    // Host blocks need not line up with the chunks, so one more chunk of delay covers any block size up to samplesPerBlock
+    latency = (blocksAhead + 1) * chunkSize;
+    // Room for the delayed samples, the chunk being rendered and one spare
+    ringLength = (blocksAhead + 3) * chunkSize;
+
+    // One ring per voice, and one for the sympathetic resonance
+    rings.clear();
+    for (int i = 0; i < synth.getNumVoices() + 1; i++) {
+        rings.add(new juce::AudioBuffer<float>(numChannels, ringLength));
+        rings.getLast()->clear();
+    }
+    scratch.setSize(numChannels, chunkSize);
+    chunkMidi.ensureSize(maxEvents * 16);
+
+    fifo.reset();
+    hasPending = false;
+    received = 0;
+    rendered = 0;
+    consumed = 0;
+    underruns = 0;
+    load = 0.0f;
+
+    active = true;
+    renderer.add(this);
+}
+
+void RenderPipeline::release() {
+    if (!active) {
+        return;
+    }
+    renderer.remove(this);
+    active = false;
+}
+
+bool RenderPipeline::isActive() const {
+    return active;
+}
+
+bool RenderPipeline::isRenderThread() {
+    return renderThread;
+}
+
+int RenderPipeline::getLatencySamples() const {
+    return latency;
+}
+
+float RenderPipeline::getLoad() const {
+    return load;
+}
+
+juce::int64 RenderPipeline::getUnderruns() const {
+    return underruns;
+}
+
+void RenderPipeline::process(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, bool waitForRender) {
+    const int numSamples = buffer.getNumSamples();
+    const juce::int64 now = received.load(std::memory_order_relaxed);
+
+    // Queue the events with their absolute time, so they keep their exact position once delayed
+    for (const auto metadata : midiMessages) {
+        const int room = releasesNotes(metadata.data, metadata.numBytes) ? 0 : reservedEvents;
+        if (metadata.numBytes > 3 || fifo.getFreeSpace() <= room) {
+            health.midiDropped++;                                       // SysEx is not used by the synth
+            continue;
+        }
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+        Event& e = events[start1];
+        e.time = now + metadata.samplePosition;
+        e.size = metadata.numBytes;
+        std::memcpy(e.data, metadata.data, size_t(metadata.numBytes));
+        fifo.finishedWrite(1);
+    }
+    received.store(now + numSamples, std::memory_order_release);
+    renderer.wake();
+
+    // Output the samples of latency samples ago, silence where they are not rendered yet
+    const juce::int64 start = now - latency;
+    const juce::int64 end = start + numSamples;
+    if (waitForRender) {
+        // The render thread has all the MIDI of these samples, the timeout only guards against blocks longer than prepared
+        for (int timeout = 0; rendered.load(std::memory_order_acquire) < end && timeout < 1000; timeout++) {
+            chunkRendered.wait(1);
+        }
+    }
+    const juce::int64 available = rendered.load(std::memory_order_acquire);
+    juce::int64 from = juce::jmax(start, juce::int64(0));
+    juce::int64 to = juce::jmin(end, available);
+    if (end > juce::jmax(from, available)) {
+        underruns += end - juce::jmax(from, available);
+    }
+    while (from < to) {
+        int length = int(juce::jmin(to - from, juce::int64(ringLength) - from % ringLength));
+        mix(buffer, int(from - start), from, length);
+        from += length;
+    }
+    consumed.store(end, std::memory_order_release);
+}
+
+bool RenderPipeline::releasesNotes(const juce::uint8* data, int size) {
+    if (size < 3) {
+        return false;
+    }
+    const int status = data[0] & 0xf0;
+    return status == 0x80                                               // Note off
+        || (status == 0x90 && data[2] == 0)                             // Note on with velocity 0
+        || (status == 0xb0 && data[1] == 64 && data[2] < 64)            // Sustain pedal up
+        || (status == 0xb0 && (data[1] == 120 || data[1] == 123));      // All sound off, all notes off
+}
+
+void RenderPipeline::mix(juce::AudioBuffer<float>& buffer, int offset, juce::int64 start, int numSamples) {
+    int ringStart = int(start % ringLength);
+    for (auto* ring : rings) {
+        for (int chan = 0; chan < juce::jmin(buffer.getNumChannels(), ring->getNumChannels()); chan++) {
+            buffer.addFrom(chan, offset, *ring, chan, ringStart, numSamples);
+        }
+    }
+}
+
+bool RenderPipeline::renderNext() {
+    juce::int64 next = rendered.load(std::memory_order_relaxed) + chunkSize;
+
+    // Render once the chunk's MIDI is complete and the callback has taken the samples it overwrites
+    if (received.load(std::memory_order_acquire) < next
+        || next - ringLength > consumed.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    auto startTicks = juce::Time::getHighResolutionTicks();
+    renderChunk();
+    chunkRendered.signal();
+    double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+    load = 0.9f * load.load() + 0.1f * float(seconds * sampleRate / chunkSize);
+    return true;
+}
+
+void RenderPipeline::renderChunk() {
+    juce::ScopedNoDenormals noDenormals;
+    const juce::int64 start = rendered.load(std::memory_order_relaxed);
+    const juce::int64 end = start + chunkSize;
+
+    // Collect the events of this chunk, in the order they were received
+    chunkMidi.clear();
+    for (;;) {
+        if (!hasPending) {
+            if (fifo.getNumReady() == 0) {
+                break;
+            }
+            int start1, size1, start2, size2;
+            fifo.prepareToRead(1, start1, size1, start2, size2);
+            pending = events[start1];
+            fifo.finishedRead(1);
+            hasPending = true;
+        }
+        if (pending.time >= end) {
+            break;
+        }
+        chunkMidi.addEvent(pending.data, pending.size, int(juce::jmax(pending.time - start, juce::int64(0))));
+        hasPending = false;
+    }
+
+    // Render each voice into its ring, the synthesiser splits the chunk at the events
+    int offset = int(start % ringLength);
+    for (auto* ring : rings) {
+        ring->clear(offset, chunkSize);
+    }
+    synth.setVoiceTargets(&rings, offset);
+    synth.renderNextBlock(scratch, chunkMidi, 0, chunkSize);
+    synth.setVoiceTargets(nullptr, 0);
+
+    rendered.store(end, std::memory_order_release);
+}
@@ -0,0 +1,143 @@
+/*
+  ==============================================================================
+
+    RenderPipeline.h
+    Author:  Ruthu Prem Kumar
+
+    Optional render-ahead mode for the synthesiser.
+
+    Instead of rendering the voices inside the audio callback, the callback
+    pushes its MIDI events (stamped with their absolute sample time) into a
+    lock-free FIFO and returns audio rendered earlier by a background thread.
+    One Renderer thread, held by SharedResources, serves the pipelines of
+    every instance in turn, a chunk each per pass.
+    It renders the synthesiser in chunks of the prepared block size,
+    each voice into its own ring buffer, so the callback only sums finished
+    samples. The output is delayed by getLatencySamples(), which the
+    processor reports to the host.
+
+    If the thread falls behind in real time, the missing samples are output as
+    silence and counted in getUnderruns(). Offline, the callback waits for
+    them instead, so that a bounce keeps the same latency and has no gaps.
+    When the FIFO fills up, its last reservedEvents places are kept for note
+    offs, sustain releases and all notes/sound off, so that a flood of MIDI
+    cannot leave notes hanging. Events which find no room, and those longer
+    than 3 bytes, are counted in HealthCounters::midiDropped.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Synth.h"
+
+class RenderPipeline {
+public:
+
+    static constexpr int blocksAhead = 1;                   // Chunks rendered ahead of the callback
+    static constexpr int maxEvents = 4096;                  // Capacity of the MIDI FIFO
+    static constexpr int reservedEvents = 256;              // Room in the FIFO only for events which release notes
+
+    /* Render thread shared by the pipelines of every instance*/
+    class Renderer : private juce::Thread {
+    public:
+        Renderer();
+        ~Renderer() override;
+
+        /* Starts rendering a pipeline*/
+        void add(RenderPipeline* pipeline);
+
+        /* Stops rendering a pipeline, waiting for a chunk in progress*/
+        void remove(RenderPipeline* pipeline);
+
+        /* Wakes the thread up to look for chunks to render (audio thread)*/
+        void wake();
+
+    private:
+        void run() override;
+
+        juce::CriticalSection lock;                         // Held while rendering (never taken on the audio thread)
+        juce::Array<RenderPipeline*> pipelines;
+        juce::WaitableEvent wakeUp;                         // Signalled by the callbacks
+
+        JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Renderer)
+    };
+
+    RenderPipeline(PianoSynthesiser& synth, Renderer& renderer, HealthCounters& health);
+    ~RenderPipeline();
+
+    /* Allocates the ring buffers and starts rendering ahead (voices must be added and prepared)*/
+    void prepare(double sampleRate, int samplesPerBlock, int numChannels);
+
+    /* Stops rendering ahead*/
+    void release();
+
+    /* True between prepare() and release()*/
+    bool isActive() const;
+
+    /* True on the render-ahead thread, which must not block or allocate while rendering*/
+    static bool isRenderThread();
+
+    /* Delay between the MIDI input and the audio output*/
+    int getLatencySamples() const;
+
+    /* Queues the block's MIDI and adds the delayed output to the buffer (audio thread),
+       waiting for the render thread to catch up if waitForRender (offline rendering)*/
+    void process(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages, bool waitForRender);
+
+    /* Smoothed load of the render thread, relative to real time*/
+    float getLoad() const;
+
+    /* Number of samples output as silence because they were not rendered in time*/
+    juce::int64 getUnderruns() const;
+
+private:
+
+    /* MIDI message stamped with its absolute sample time*/
+    struct Event {
+        juce::int64 time = 0;
+        juce::uint8 data[3] = {};
+        int size = 0;
+    };
+
+    /* Renders the next chunk if its MIDI is complete and there is room for it, returns false otherwise (render thread)*/
+    bool renderNext();
+
+    /* Renders the next chunk into the ring buffers*/
+    void renderChunk();
+
+    /* True for events which release notes, allowed into the reserved part of the FIFO*/
+    static bool releasesNotes(const juce::uint8* data, int size);
+
+    /* Adds ring samples [start, start + numSamples) to the buffer at offset (must not wrap)*/
+    void mix(juce::AudioBuffer<float>& buffer, int offset, juce::int64 start, int numSamples);
+
+    PianoSynthesiser& synth;
+    Renderer& renderer;
+    HealthCounters& health;                                 // Counts the dropped events
+
+    double sampleRate = 0.0;
+    int chunkSize = 0;                                      // Samples rendered at a time
+    int ringLength = 0;                                     // Length of each ring buffer, a multiple of chunkSize
+    int latency = 0;                                        // Output delay in samples
+
+    juce::OwnedArray<juce::AudioBuffer<float>> rings;       // Ring buffer of each voice
+    juce::AudioBuffer<float> scratch;                       // Output passed to the synthesiser (unused in this mode)
+    juce::MidiBuffer chunkMidi;                             // Events of the chunk being rendered
+
+    juce::AbstractFifo fifo { maxEvents };                  // Events from the callback to the render thread
+    Event events[maxEvents];
+    Event pending;                                          // Event read from the FIFO but belonging to a later chunk
+    bool hasPending = false;
+
+    std::atomic<juce::int64> received { 0 };                // Samples of MIDI received from the callback
+    std::atomic<juce::int64> rendered { 0 };                // Samples rendered into the rings
+    std::atomic<juce::int64> consumed { 0 };                // Samples taken from the rings by the callback
+    std::atomic<juce::int64> underruns { 0 };
+    std::atomic<float> load { 0.0f };
+    std::atomic<bool> active { false };
+    juce::WaitableEvent chunkRendered;                      // Signalled by the render thread after each chunk
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderPipeline)
+};
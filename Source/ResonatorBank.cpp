@@ -0,0 +1,147 @@
+/*
+==============================================================================
+
+ResonatorBank.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "ResonatorBank.h"
+#include <math.h>
+
+void ResonatorBank::clear() {
+    numModes = 0;
+    rampRemaining = 0;
+}
+
+bool ResonatorBank::addMode(float wavenumber, int gridSize, float cIn, float dIn, float a1In, float a2In) {
+    if (numModes >= maxModes) {
+        return false;
+    }
+    c[numModes] = cIn;
+    d[numModes] = dIn;
+    a1[numModes] = a1In;
+    a2[numModes] = a2In;
+    w[numModes] = wavenumber;
+    size[numModes] = gridSize;
+    for (int p = 0; p < maxPickups; p++) {
+        gain[p][numModes] = 0.0f;
+        gainStep[p][numModes] = 0.0f;
+    }
+    numModes++;
+    return true;
+}
+
+int ResonatorBank::addDelayedCopy(int first, int count, int delay) {
+    int added = 0;
+    for (int m = first; m < first + count; m++) {
+        // Run the recursion backwards, a[n-1] = (a[n+1] - c a[n]) / d
+        double next = a1[m], current = a2[m];
+        for (int n = 0; n < delay; n++) {
+            double previous = (next - c[m] * current) / d[m];
+            next = current;
+            current = previous;
+        }
+        if (!addMode(w[m], size[m], c[m], d[m], float(next), float(current))) {
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+int ResonatorBank::getNumModes() const {
+    return numModes;
+}
+
+void ResonatorBank::getMode(int index, float& wavenumber, float& amplitude1, float& amplitude2) const {
+    wavenumber = w[index];
+    amplitude1 = a1[index];
+    amplitude2 = a2[index];
+}
+
+void ResonatorBank::getShape(float* dest, int numPoints, int first, int count) const {
+    for (int j = 0; j < numPoints; j++) {
+        dest[j] = 0.0f;
+    }
+    for (int m = first; m < first + count && m < numModes; m++) {
+        // sin(w (l + 1)) at l + 1 = x (N + 1), with x stepping evenly from 0 to 1, by recurrence
+        double step = double(w[m]) * (size[m] + 1) / (numPoints - 1);
+        double twoCos = 2.0 * cos(step);
+        double sPrev = -sin(step);
+        double s = 0.0;
+        for (int j = 0; j < numPoints; j++) {
+            dest[j] += float(a1[m] * s);
+            double sNext = twoCos * s - sPrev;
+            sPrev = s;
+            s = sNext;
+        }
+    }
+}
+
+void ResonatorBank::setPickups(const float* positions, int count, bool ramp) {
+    count = count < 1 ? 1 : (count > maxPickups ? maxPickups : count);
+
+    // The gains are only recomputed when the pickups move
+    bool moved = !ramp || count != numPickups;
+    for (int p = 0; p < count && !moved; p++) {
+        moved = positions[p] != pickupPosition[p];
+    }
+    if (!moved) {
+        return;
+    }
+
+    numPickups = count;
+    for (int p = 0; p < numPickups; p++) {
+        pickupPosition[p] = positions[p];
+        for (int m = 0; m < numModes; m++) {
+            // Same index as String::setPickups() for the string of the mode
+            float target = readMode(w[m], size[m], positions[p] * size[m]);
+            gainStep[p][m] = ramp ? (target - gain[p][m]) / rampLength : 0.0f;
+            if (!ramp) {
+                gain[p][m] = target;
+            }
+        }
+    }
+    rampRemaining = ramp ? rampLength : 0;
+}
+
+void ResonatorBank::process(float* outputs) {
+    for (int m = 0; m < numModes; m++) {
+        float a0 = c[m] * a1[m] + d[m] * a2[m];
+        a2[m] = a1[m];
+        a1[m] = a0;
+    }
+    for (int p = 0; p < numPickups; p++) {
+        float sum = 0.0f;
+        for (int m = 0; m < numModes; m++) {
+            sum += gain[p][m] * a1[m];
+        }
+        outputs[p] += sum;
+    }
+    if (rampRemaining > 0) {
+        for (int p = 0; p < numPickups; p++) {
+            for (int m = 0; m < numModes; m++) {
+                gain[p][m] += gainStep[p][m];
+            }
+        }
+        rampRemaining--;
+    }
+}
+
+float ResonatorBank::readMode(float wavenumber, int gridSize, float index) {
+    // Same 4 point Lagrange interpolation as String::readPosition()
+    index = fmin(fmax(index, 1.0f), float(gridSize - 2));
+    int l = int(index);
+    if (l > gridSize - 3) {
+        l = gridSize - 3;
+    }
+    float f = index - float(l);
+    float c0 = -f * (f - 1) * (f - 2) / 6.0f;
+    float c1 = (f + 1) * (f - 1) * (f - 2) / 2.0f;
+    float c2 = -(f + 1) * f * (f - 2) / 2.0f;
+    float c3 = (f + 1) * f * (f - 1) / 6.0f;
+    return c0 * sinf(wavenumber * l) + c1 * sinf(wavenumber * (l + 1))
+        + c2 * sinf(wavenumber * (l + 2)) + c3 * sinf(wavenumber * (l + 3));
+}
@@ -0,0 +1,77 @@
+/*
+  ==============================================================================
+
+    ResonatorBank.h
+    Author:  Ruthu Prem Kumar
+
+    Bank of decaying modes read at several pickups, used to continue a note
+    once its strings only ring out.
+
+    With simply supported ends, the modes of the FDTD grid are the sines
+    sin(w (l + 1)) with w = p pi / (N + 1), and each mode follows the two
+    step recursion a[n+1] = c a[n] + d a[n-1] of the scheme. A string
+    projected onto its modes (String::addModes()) therefore continues
+    exactly, apart from the modes that were left out.
+
+    Plain arrays per mode so that process() vectorises.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+class ResonatorBank {
+public:
+
+    static constexpr int maxModes = 96;             // Most modes in a bank
+    static constexpr int maxPickups = 8;            // Same as String::maxPickups
+
+    /* Removes every mode*/
+    void clear();
+
+    /* Adds a mode of a grid of gridSize points with wavenumber w, recursion coefficients c, d and
+       state a1 (newest), a2. Returns false if the bank is full*/
+    bool addMode(float w, int gridSize, float c, float d, float a1, float a2);
+
+    /* Adds modes [first, first + count) again as they were delay samples ago, for a string which is a delayed copy
+       of theirs. Returns the number added*/
+    int addDelayedCopy(int first, int count, int delay);
+
+    /* Returns the number of modes*/
+    int getNumModes() const;
+
+    /* Returns the wavenumber and current state of a mode*/
+    void getMode(int index, float& wavenumber, float& amplitude1, float& amplitude2) const;
+
+    /* Writes the displacement of modes [first, first + count) at numPoints evenly spaced points along their string*/
+    void getShape(float* dest, int numPoints, int first, int count) const;
+
+    /* Sets the pickup positions (0-1), ramping the gains over rampLength samples if ramp is true*/
+    void setPickups(const float* positions, int count, bool ramp);
+
+    /* Advances every mode by one sample and adds each pickup's output to outputs[0..count-1]*/
+    void process(float* outputs);
+
+    /* Value read at a fractional grid index from the mode shape sin(w (l + 1)), interpolated as in String::readPosition()*/
+    static float readMode(float w, int gridSize, float index);
+
+private:
+
+    int numModes = 0;
+    int numPickups = 1;
+
+    // Modes
+    float c[maxModes];                              // Coefficient of the current state
+    float d[maxModes];                              // Coefficient of the previous state (decay)
+    float a1[maxModes];                             // Amplitude at time n
+    float a2[maxModes];                             // Amplitude at time n-1
+    float w[maxModes];                              // Wavenumber of the mode shape
+    int size[maxModes];                             // Grid size of the string the mode came from
+
+    // Output gain of each mode at each pickup
+    float pickupPosition[maxPickups];               // Positions the gains are computed for (0-1)
+    float gain[maxPickups][maxModes];
+    float gainStep[maxPickups][maxModes];           // Gain increment per sample while ramping
+    int rampRemaining = 0;                          // Samples left in the current ramp
+    const int rampLength = 256;                     // Length of a pickup ramp in samples (as in String)
+};
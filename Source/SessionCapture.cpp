@@ -0,0 +1,209 @@
+/*
+==============================================================================
+
+SessionCapture.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "SessionCapture.h"
+
+SessionCapture::SessionCapture(juce::TimeSliceThread& w) : writer(w) {
+}
+
+SessionCapture::~SessionCapture() {
+    stop();
+}
+
+void SessionCapture::setParameters(juce::AudioProcessorValueTreeState& state) {
+    jassert(!isCapturing());
+    parameterIds.clear();
+    parameterValues.clear();
+    for (auto* p : state.processor.getParameters()) {
+        if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(p)) {
+            if (parameterIds.size() < maxParameters) {
+                parameterIds.add(ranged->paramID);
+                parameterValues.add(state.getRawParameterValue(ranged->paramID));
+            }
+        }
+    }
+}
+
+bool SessionCapture::start(const juce::File& traceFile) {
+    stop();
+
+    file = traceFile;
+    file.getParentDirectory().createDirectory();
+    file.deleteFile();
+    stream.reset(new juce::FileOutputStream(file));
+    if (stream->failedToOpen()) {
+        stream.reset();
+        return false;
+    }
+
+    // Header
+    stream->write("APTR", 4);
+    stream->writeInt(int(version));
+    stream->writeShort(short(parameterIds.size()));
+    for (auto& id : parameterIds) {
+        auto utf8 = id.toUTF8();
+        int length = juce::jmin(255, int(utf8.sizeInBytes()) - 1);
+        stream->writeByte(char(length));
+        stream->write(utf8.getAddress(), size_t(length));
+    }
+
+    // The ring is allocated once, on the first capture
+    if (ring == nullptr) {
+        ring.malloc(size_t(ringSize));
+    }
+    fifo.reset();
+    for (int i = 0; i < maxParameters; i++) {
+        lastValues[i] = std::numeric_limits<float>::quiet_NaN();  // Every parameter goes into the first block
+    }
+    prepareWritten = false;
+    overflowed = false;
+
+    writer.addTimeSliceClient(this);
+    writer.startThread(4);
+    active = true;
+    return true;
+}
+
+void SessionCapture::stop() {
+    if (!active.exchange(false)) {
+        return;
+    }
+    // Let a block being recorded finish before the last drain
+    while (recording.load()) {
+        juce::Thread::yield();
+    }
+    // Waits for a drain in progress on the writer thread
+    writer.removeTimeSliceClient(this);
+
+    drain();
+    if (!overflowed.load()) {
+        stream->writeByte('E');
+    }
+    stream->flush();
+    stream.reset();
+}
+
+bool SessionCapture::isCapturing() const {
+    return active.load();
+}
+
+bool SessionCapture::hasOverflowed() const {
+    return overflowed.load();
+}
+
+juce::File SessionCapture::getFile() const {
+    return file;
+}
+
+void SessionCapture::recordBlock(double sampleRate, int samplesPerBlock, int numChannels, int numSamples, const juce::MidiBuffer& midi) {
+    recording = true;
+    if (!active.load() || overflowed.load()) {
+        recording = false;
+        return;
+    }
+
+    // Size of the records, with the parameters read once so that they cannot change in between
+    bool prepareChanged = !prepareWritten || sampleRate != lastSampleRate || samplesPerBlock != lastBlockSize
+        || numChannels != lastNumChannels;
+    int size = prepareChanged ? 1 + 8 + 4 + 4 : 0;
+
+    int numChanged = 0;
+    for (int i = 0; i < parameterValues.size(); i++) {
+        currentValues[i] = parameterValues.getUnchecked(i)->load();
+        if (currentValues[i] != lastValues[i]) {
+            numChanged++;
+        }
+    }
+    juce::uint32 numEvents = 0;
+    for (const auto metadata : midi) {
+        size += 4 + 2 + juce::jmin(metadata.numBytes, 0xffff);
+        numEvents++;
+    }
+    size += 1 + 4 + 2 + numChanged * (2 + 4) + 4;
+
+    // Stop recording rather than leave a gap in the trace
+    if (fifo.getFreeSpace() < size) {
+        overflowed = true;
+        recording = false;
+        return;
+    }
+    fifo.prepareToWrite(size, putIndex1, putSize1, putIndex2, putSize2);
+    putDone = 0;
+
+    if (prepareChanged) {
+        put("P", 1);
+        put(&sampleRate, 8);
+        put(&samplesPerBlock, 4);
+        put(&numChannels, 4);
+        prepareWritten = true;
+        lastSampleRate = sampleRate;
+        lastBlockSize = samplesPerBlock;
+        lastNumChannels = numChannels;
+    }
+
+    put("B", 1);
+    put(&numSamples, 4);
+    juce::uint16 count = juce::uint16(numChanged);
+    put(&count, 2);
+    for (int i = 0; i < parameterValues.size(); i++) {
+        if (currentValues[i] != lastValues[i]) {
+            juce::uint16 index = juce::uint16(i);
+            put(&index, 2);
+            put(&currentValues[i], 4);
+            lastValues[i] = currentValues[i];
+        }
+    }
+    put(&numEvents, 4);
+    for (const auto metadata : midi) {
+        juce::int32 position = metadata.samplePosition;
+        juce::uint16 eventSize = juce::uint16(juce::jmin(metadata.numBytes, 0xffff));
+        put(&position, 4);
+        put(&eventSize, 2);
+        put(metadata.data, eventSize);
+    }
+
+    fifo.finishedWrite(size);
+    recording = false;
+}
+
+void SessionCapture::put(const void* data, int size) {
+    auto* bytes = static_cast<const juce::uint8*>(data);
+    while (size > 0) {
+        int n;
+        if (putDone < putSize1) {
+            n = juce::jmin(size, putSize1 - putDone);
+            memcpy(ring + putIndex1 + putDone, bytes, size_t(n));
+        }
+        else {
+            n = juce::jmin(size, putSize1 + putSize2 - putDone);
+            memcpy(ring + putIndex2 + putDone - putSize1, bytes, size_t(n));
+        }
+        putDone += n;
+        bytes += n;
+        size -= n;
+    }
+}
+
+void SessionCapture::drain() {
+    int index1, size1, index2, size2;
+    fifo.prepareToRead(fifo.getNumReady(), index1, size1, index2, size2);
+    if (size1 > 0) {
+        stream->write(ring + index1, size_t(size1));
+    }
+    if (size2 > 0) {
+        stream->write(ring + index2, size_t(size2));
+    }
+    fifo.finishedRead(size1 + size2);
+}
+
+int SessionCapture::useTimeSlice() {
+    // Polled, as signalling the thread from the audio thread could block
+    drain();
+    return 50;
+}
@@ -0,0 +1,109 @@
+/*
+  ==============================================================================
+
+    SessionCapture.h
+    Author:  Ruthu Prem Kumar
+
+    Records what the host feeds the processor (block sizes, MIDI, sample
+    rate and parameter values) to a compact binary trace, which the
+    SessionReplay tool plays back headless.
+
+    The audio thread writes each block as one record into a lock-free ring,
+    and a writer thread shared by every instance (held by SharedResources)
+    writes the ring to the file. Nothing is allocated, locked or written to
+    disk on the audio thread. If the ring
+    fills up the capture stops recording and the trace is marked incomplete
+    by a missing end record.
+
+    Trace format (little endian) :
+
+    header          : "APTR", uint32 version, uint16 numParameters,
+                      then each parameter ID as uint8 length + UTF-8
+    'P' (prepare)   : float64 sampleRate, int32 samplesPerBlock, int32 numChannels
+    'B' (block)     : int32 numSamples,
+                      uint16 count, count x (uint16 parameter, float32 value),
+                      uint32 count, count x (int32 position, uint16 size, size bytes of MIDI)
+    'E' (end)       : nothing, written when the capture is stopped
+
+    A prepare record comes before the first block and whenever the sample
+    rate, block size or channel count change. A block record only holds the
+    parameters which changed since the previous one (all of them in the
+    first), with the values in the parameters' ranges.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class SessionCapture : private juce::TimeSliceClient {
+public:
+
+    static constexpr juce::uint32 version = 1;
+    static constexpr int ringSize = 1 << 22;        // Bytes buffered between the audio thread and the file
+    static constexpr int maxParameters = 256;       // Most parameters recorded
+
+    SessionCapture(juce::TimeSliceThread& writer);
+    ~SessionCapture() override;
+
+    /* Sets the parameters to record (message thread, while not capturing)*/
+    void setParameters(juce::AudioProcessorValueTreeState& state);
+
+    /* Starts writing a trace to file, returns false if it cannot be opened (message thread)*/
+    bool start(const juce::File& file);
+
+    /* Stops the capture and closes the trace (message thread)*/
+    void stop();
+
+    /* True while capturing, also after an overflow*/
+    bool isCapturing() const;
+
+    /* True if the ring filled up since start(), from which point nothing more was recorded*/
+    bool hasOverflowed() const;
+
+    /* File written by the current or last capture*/
+    juce::File getFile() const;
+
+    /* Records a block about to be processed (audio thread)*/
+    void recordBlock(double sampleRate, int samplesPerBlock, int numChannels, int numSamples, const juce::MidiBuffer& midi);
+
+private:
+    int useTimeSlice() override;
+
+    /* Moves whatever the audio thread has written from the ring to the file*/
+    void drain();
+
+    /* Copies bytes into the ring region reserved by recordBlock()*/
+    void put(const void* data, int size);
+
+    juce::TimeSliceThread& writer;                  // Thread draining the ring
+
+    // Parameters
+    juce::StringArray parameterIds;
+    juce::Array<std::atomic<float>*> parameterValues;
+    float lastValues[maxParameters];                // Values in the previous block record
+    float currentValues[maxParameters];             // Values read for the current block
+
+    // Ring
+    juce::AbstractFifo fifo { ringSize };
+    juce::HeapBlock<juce::uint8> ring;
+    int putIndex1 = 0, putSize1 = 0;                // Regions reserved by recordBlock()
+    int putIndex2 = 0, putSize2 = 0;
+    int putDone = 0;                                // Bytes copied into them
+
+    // State
+    std::atomic<bool> active { false };             // recordBlock() records
+    std::atomic<bool> recording { false };          // Set by the audio thread while in recordBlock()
+    std::atomic<bool> overflowed { false };
+    bool prepareWritten = false;                    // A prepare record was written since start()
+    double lastSampleRate = 0.0;
+    int lastBlockSize = 0;
+    int lastNumChannels = 0;
+
+    // File
+    juce::File file;
+    std::unique_ptr<juce::FileOutputStream> stream;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SessionCapture)
+};
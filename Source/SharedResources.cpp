@@ -0,0 +1,67 @@
+/*
+==============================================================================
+
+SharedResources.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "SharedResources.h"
+
+SharedResources::SharedResources() : workerPool(juce::jmax(1, juce::SystemStats::getNumCpus() - 1)) {
+    engineTuner.start();
+}
+
+std::shared_ptr<const KeyTable> SharedResources::getKeyTable(const NoteParameters& p, double sampleRate) {
+    const juce::ScopedLock sl(lock);
+
+    auto& entry = keyTables[{ sampleRate, hashNoteParameters(p, sampleRate) }];
+    std::shared_ptr<const KeyTable> table = entry.lock();
+    if (table == nullptr) {
+        table = std::make_shared<const KeyTable>(p, sampleRate);
+        entry = table;
+    }
+
+    // Forget tables which no instance holds any more
+    for (auto it = keyTables.begin(); it != keyTables.end();) {
+        it = it->second.expired() ? keyTables.erase(it) : std::next(it);
+    }
+    return table;
+}
+
+std::shared_ptr<const ForceTable> SharedResources::getForceTable(double sampleRate) {
+    const juce::ScopedLock sl(lock);
+
+    auto& entry = forceTables[sampleRate];
+    std::shared_ptr<const ForceTable> table = entry.lock();
+    if (table == nullptr) {
+        table = std::make_shared<const ForceTable>(sampleRate);
+        entry = table;
+    }
+    return table;
+}
+
+WorkerPool& SharedResources::getWorkerPool() {
+    return workerPool;
+}
+
+EngineTuner& SharedResources::getEngineTuner() {
+    return engineTuner;
+}
+
+NoteCache& SharedResources::getNoteCache() {
+    return noteCache;
+}
+
+ImpulseResponses& SharedResources::getImpulseResponses() {
+    return impulseResponses;
+}
+
+RenderPipeline::Renderer& SharedResources::getRenderAhead() {
+    return renderAhead;
+}
+
+juce::TimeSliceThread& SharedResources::getCaptureWriter() {
+    return captureWriter;
+}
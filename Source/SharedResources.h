@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    SharedResources.h
+    Author:  Ruthu Prem Kumar
+
+    Resources shared by every AnyPiano instance in the host process, held by
+    each PluginAudioProcessor through a juce::SharedResourcePointer so that
+    they are created with the first instance and deleted with the last.
+
+    Key and force tables are immutable and handed out as shared pointers:
+    instances asking for the same sample rate and preset get the same table,
+    and a change of preset builds a new table instead of modifying the one
+    other instances may be reading.
+    The worker pool has one thread per core (less the caller), whatever the
+    number of instances, and the engine tuner measures the settings of this
+    machine once (see EngineTuner.h).
+    Background work is done by services which instances register with, so
+    that the number of threads does not grow with the number of instances :
+    the note cache and impulse responses render on one thread each (see
+    NoteCache.h and ImpulseResponses.h), one thread renders ahead for every
+    RenderPipeline and one writes every SessionCapture.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <map>
+#include "NoteTables.h"
+#include "WorkerPool.h"
+#include "EngineTuner.h"
+#include "NoteCache.h"
+#include "ImpulseResponses.h"
+#include "RenderPipeline.h"
+
+class SharedResources {
+public:
+
+    SharedResources();
+
+    /* Returns the key table for a preset and sample rate, building it if no instance uses it yet*/
+    std::shared_ptr<const KeyTable> getKeyTable(const NoteParameters& p, double sampleRate);
+
+    /* Returns the force table for a sample rate, building it if no instance uses it yet*/
+    std::shared_ptr<const ForceTable> getForceTable(double sampleRate);
+
+    /* Returns the worker pool which all instances submit voice work to*/
+    WorkerPool& getWorkerPool();
+
+    /* Returns the tuner holding the engine profile of this machine*/
+    EngineTuner& getEngineTuner();
+
+    /* Returns the note cache which all instances register with*/
+    NoteCache& getNoteCache();
+
+    /* Returns the impulse response renderer which all instances register with*/
+    ImpulseResponses& getImpulseResponses();
+
+    /* Returns the thread rendering ahead for the RenderPipeline of every instance*/
+    RenderPipeline::Renderer& getRenderAhead();
+
+    /* Returns the thread writing the SessionCapture of every instance to disk*/
+    juce::TimeSliceThread& getCaptureWriter();
+
+private:
+
+    juce::CriticalSection lock;                                                 // Guards the table maps (never taken on the audio thread)
+    std::map<std::pair<double, juce::int64>, std::weak_ptr<const KeyTable>> keyTables;
+    std::map<double, std::weak_ptr<const ForceTable>> forceTables;
+
+    WorkerPool workerPool;
+    EngineTuner engineTuner { workerPool };                                     // Benchmarks run on the pool (declared after it)
+    NoteCache noteCache;
+    ImpulseResponses impulseResponses;
+    RenderPipeline::Renderer renderAhead;
+    juce::TimeSliceThread captureWriter { "AnyPiano capture" };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SharedResources)
+};
@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    StateSnapshot.h
+    Author:  Ruthu Prem Kumar
+
+    Snapshots of the voices for the editor, passed from the audio thread
+    through a wait-free triple buffer.
+
+    The synthesiser fills the write buffer at most snapshotRate times per
+    second, and only while an editor has set wanted. Nothing is allocated or
+    locked on either side : the writer and the reader each own one buffer and
+    swap it with the third one atomically.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Note.h"
+
+/* State of one voice*/
+struct VoiceSnapshot {
+    static constexpr int numPoints = 128;           // Points of each string shape, ends included
+
+    enum Mode { idle, simulated, modal, cached, convolved };
+
+    Mode mode = idle;
+    int midiNote = -1;
+    float loudness = 0.0f;                          // Smoothed output RMS
+    float cpuLoad = 0.0f;                           // Render time / real time
+    int numStrings = 0;
+    float shape[Note::maxStrings][numPoints];       // Displacement of each string along its length
+};
+
+/* State of every voice at one time*/
+struct StateSnapshot {
+    static constexpr int maxVoices = 32;
+
+    int numVoices = 0;
+    VoiceSnapshot voices[maxVoices];
+};
+
+/* Wait-free triple buffer of snapshots, one writer (the audio thread) and one reader (the editor)*/
+class SnapshotBuffer {
+public:
+
+    static constexpr int snapshotRate = 60;         // Most snapshots per second
+
+    /* Buffer to fill before publish() (writer)*/
+    StateSnapshot& getWriteBuffer() {
+        return buffers[back];
+    }
+
+    /* Makes the write buffer the latest snapshot (writer)*/
+    void publish() {
+        back = middle.exchange(back | newFlag) & indexMask;
+    }
+
+    /* Returns the latest snapshot, or nullptr if none was published since the last call (reader).
+       The snapshot stays valid until the next call*/
+    const StateSnapshot* read() {
+        if ((middle.load() & newFlag) == 0) {
+            return nullptr;
+        }
+        front = middle.exchange(front) & indexMask;
+        return &buffers[front];
+    }
+
+    std::atomic<bool> wanted { false };             // Set while an editor shows the snapshots
+
+private:
+    static constexpr int newFlag = 4;               // Set on middle when it holds an unread snapshot
+    static constexpr int indexMask = 3;
+
+    StateSnapshot buffers[3];
+    int back = 0;                                   // Owned by the writer
+    int front = 1;                                  // Owned by the reader
+    std::atomic<int> middle { 2 };                  // Swapped by both
+};
@@ -9,6 +9,9 @@ Author:  Ruthu Prem Kumar
 */
 
 #include "String.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 
 String::~String() {
 	delete[] u0;
@@ -23,8 +26,9 @@ float String::process() {
 	updateBoundary();
 	// Adds the force value at xi
 	addForce();
-	// Sample is taken from xo
-	float sample = u0[lo];
+	if (halfRounding) {
+		roundToHalf();
+	}
 
 	// Copy array values after timestep
 	float* tempPtr = u2;
@@ -32,7 +36,66 @@ float String::process() {
 	u1 = u0;
 	u0 = tempPtr;
 
-	return sample;
+	// Sample is taken from xo
+	return readPosition(pickupIndex[0]);
+}
+
+void String::process(float* outputs) {
+	// Same timestep as process()
+	updateGrid();
+	updateBoundary();
+	addForce();
+	if (halfRounding) {
+		roundToHalf();
+	}
+
+	float* tempPtr = u2;
+	u2 = u1;
+	u1 = u0;
+	u0 = tempPtr;
+
+	// Read every pickup while the new state is still in cache, moving any ramping pickups
+	for (int p = 0; p < numPickups; p++) {
+		outputs[p] += readPosition(pickupIndex[p]);
+	}
+	if (rampRemaining > 0) {
+		for (int p = 0; p < numPickups; p++) {
+			pickupIndex[p] += pickupStep[p];
+		}
+		rampRemaining--;
+	}
+}
+
+float String::readPosition(float index) {
+	// 4 point Lagrange interpolation between grid points
+	index = fmin(fmax(index, 1.0f), float(N - 2));
+	int l = int(index);
+	if (l > N - 3) {
+		l = N - 3;
+	}
+	float f = index - float(l);
+	float c0 = -f * (f - 1) * (f - 2) / 6.0f;
+	float c1 = (f + 1) * (f - 1) * (f - 2) / 2.0f;
+	float c2 = -(f + 1) * f * (f - 2) / 2.0f;
+	float c3 = (f + 1) * f * (f - 1) / 6.0f;
+	return c0 * u1[l - 1] + c1 * u1[l] + c2 * u1[l + 1] + c3 * u1[l + 2];
+}
+
+void String::setPickups(const float* positions, int count, bool ramp) {
+	numPickups = count < 1 ? 1 : (count > maxPickups ? maxPickups : count);
+	for (int p = 0; p < numPickups; p++) {
+		pickupPosition[p] = positions[p];
+		float target = positions[p] * N;
+		pickupStep[p] = ramp ? (target - pickupIndex[p]) / rampLength : 0.0f;
+		if (!ramp) {
+			pickupIndex[p] = target;
+		}
+	}
+	rampRemaining = ramp ? rampLength : 0;
+}
+
+int String::getNumPickups() {
+	return numPickups;
 }
 
 void String::updateGrid() {
@@ -64,10 +127,89 @@ void String::addForce() {
 	u0[li] += forceCoeff * force;
 }
 
+void String::setHalfRounding(bool enabled) {
+	halfRounding = enabled;
+}
+
+void String::roundToHalf() {
+	// Power of two scale bringing the peak to 2^11 - 2^12, as fp16 storage would need to keep its precision
+	float peak = 0.0f;
+	for (int l = 0; l < N; l++) {
+		peak = fmax(peak, fabs(u0[l]));
+	}
+	if (peak == 0.0f || !std::isfinite(peak)) {
+		return;
+	}
+	int exponent;
+	frexp(peak, &exponent);
+	const float scale = ldexp(1.0f, 12 - exponent);
+
+	for (int l = 0; l < N; l++) {
+		float value = u0[l] * scale;
+		if (fabs(value) < 6.103515625e-05f) {
+			// Subnormal fp16 : steps of 2^-24
+			value = nearbyint(value * 16777216.0f) / 16777216.0f;
+		}
+		else {
+			// 10 bit mantissa, rounded to nearest even
+			std::uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			bits = (bits + 0xfffu + ((bits >> 13) & 1u)) & ~0x1fffu;
+			memcpy(&value, &bits, sizeof(bits));
+		}
+		u0[l] = value / scale;
+	}
+}
+
+void String::getShape(float* dest, int numPoints) {
+	// Linear interpolation of the newest state, grid indices -1 and N are the fixed ends
+	for (int j = 0; j < numPoints; j++) {
+		float index = float(j) * float(N + 1) / float(numPoints - 1) - 1.0f;
+		int l = int(floor(index));
+		float f = index - float(l);
+		float a = (l >= 0 && l < N) ? u1[l] : 0.0f;
+		float b = (l + 1 >= 0 && l + 1 < N) ? u1[l + 1] : 0.0f;
+		dest[j] = a + f * (b - a);
+	}
+}
+
 float String::getFrequency() {
 	return freq;
 }
 
+int String::getGridSize() {
+	return N;
+}
+
+bool String::isStable() {
+	return N >= minGridSize && std::isfinite(lambdasq) && std::isfinite(musq) && std::isfinite(param1)
+		&& std::isfinite(param2) && std::isfinite(forceCoeff) && param2 > 0.0f;
+}
+
+float String::getEnergy() {
+	// Four partial sums, so that the loop is not one long dependency chain
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	int l = 0;
+	for (; l + 4 <= N; l += 4) {
+		sum[0] += u1[l] * u1[l];
+		sum[1] += u1[l + 1] * u1[l + 1];
+		sum[2] += u1[l + 2] * u1[l + 2];
+		sum[3] += u1[l + 3] * u1[l + 3];
+	}
+	for (; l < N; l++) {
+		sum[0] += u1[l] * u1[l];
+	}
+	return (sum[0] + sum[1] + sum[2] + sum[3]) / float(N);
+}
+
+void String::clearState() {
+	for (int l = 0; l < N; l++) {
+		u0[l] = 0.0f;
+		u1[l] = 0.0f;
+		u2[l] = 0.0f;
+	}
+}
+
 void String::setsampleRate(float samprate) {
 	SR = samprate;
 }
@@ -94,36 +236,88 @@ void String::setForce(float f) {
 }
 
 void String::setParameters(float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds) {
-	freq = frequencyInHz;
-	L = lengthInMetres;
-	r = radiusInMetres;
-	T60 = T60InSeconds;
+	setCoefficients(computeCoefficients(SR, E, rho, frequencyInHz, lengthInMetres, radiusInMetres, T60InSeconds));
+}
+
+void String::setCoefficients(const StringCoefficients& coefficients) {
+	freq = coefficients.freq;
+	L = coefficients.L;
+	r = coefficients.r;
+	T60 = coefficients.T60;
+	k = coefficients.k;
+	A = coefficients.A;
+	param1 = coefficients.param1;
+	param2 = coefficients.param2;
+	lambdasq = coefficients.lambdasq;
+	musq = coefficients.musq;
+	forceCoeff = coefficients.forceCoeff;
+	N = coefficients.N;
+	h = L / float(N);
+}
+
+StringCoefficients String::computeCoefficients(float sampleRate, float youngsModulus, float density,
+	float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds) {
+	StringCoefficients s;
+	s.freq = frequencyInHz;
+	s.L = lengthInMetres;
+	s.r = radiusInMetres;
+	s.T60 = T60InSeconds;
+	float rho = density;
+	float E = youngsModulus;
 
 	// Time step (1/sampleRate)
-	k = 1 / SR;
+	float k = 1 / sampleRate;
+	s.k = k;
+
+	// Stiffness Parameters
+	float A = M_PI * pow(s.r, 2);
+	float I = 0.25 * M_PI * pow(s.r, 4);
+	float K = sqrt(E * I / (rho * A));
+	s.A = A;
+
+	// Strings too short for minGridSize points (the top keys) are lengthened rather than refused
+	float minLength = getMinimumLength(s.freq, K, k);
+	if (minLength > s.L) {
+		s.L = minLength;
+	}
 
-	// String Parameters
-	T = 4 * M_PI * rho * pow(L, 2) * pow(freq, 2) * pow(r, 2);
-	A = M_PI * pow(r, 2);
-	I = 0.25 * M_PI * pow(r, 4);
-	c = sqrt(T / (rho * A));
+	// String Parameters (the tension follows the length, so that the pitch is kept)
+	float T = 4 * M_PI * rho * pow(s.L, 2) * pow(s.freq, 2) * pow(s.r, 2);
+	float c = sqrt(T / (rho * A));
 
 	// Loss Parameters
-	sig = 6 * log(10) / T60;
-	param1 = sig * k - 1.0f;
-	param2 = sig * k + 1.0f;
-	K = sqrt(E * I / (rho * A));
+	float sig = 6 * log(10) / s.T60;
+	s.param1 = sig * k - 1.0f;
+	s.param2 = sig * k + 1.0f;
 
 	// Stability condition
-	hmin = sqrt(0.5 * (pow(c, 2) * pow(k, 2) + sqrt(pow(c, 4) * pow(k, 4) + 16 * pow(K, 2) * pow(k, 2))));
-	N = floor(L / hmin);
-	h = L / float(N);
-	lambdasq = pow((c * k / h), 2);
-	musq = k * k * K * K / pow(h, 4);
+	float hmin = sqrt(0.5 * (pow(c, 2) * pow(k, 2) + sqrt(pow(c, 4) * pow(k, 4) + 16 * pow(K, 2) * pow(k, 2))));
+	s.N = floor(s.L / hmin);
+	float h = s.L / float(s.N);
+	s.lambdasq = pow((c * k / h), 2);
+	s.musq = k * k * K * K / pow(h, 4);
 
 	// Input Force
-	forceCoeff = pow(k, 2) / (rho * A * h);
+	s.forceCoeff = pow(k, 2) / (rho * A * h);
 
+	return s;
+}
+
+float String::getMinimumLength(float& frequencyInHz, float K, float k) {
+	// Without stiffness N = 1 / (2 f k) whatever the length, so notes above that pitch are flattened to the highest one the grid holds
+	const double maxFrequency = 0.98 / (2.0 * minGridSize * k);
+	if (frequencyInHz > maxFrequency) {
+		frequencyInHz = float(maxFrequency);
+	}
+
+	// L / hmin >= minGridSize, with c = 2 L f, solved for L
+	const double fk2 = double(frequencyInHz) * frequencyInHz * k * k;
+	const double a = 2.0 / (minGridSize * minGridSize) - 4.0 * fk2;
+	const double b = 4.0 * fk2;
+	const double length = std::sqrt(4.0 * K * k / std::sqrt(a * a - b * b));
+
+	// Margin against rounding, so that floor(L / hmin) is not one short
+	return float(length * 1.001);
 }
 
 void String::setExcCoordinates(float inCoordinate, float outCoordinate) {
@@ -136,15 +330,117 @@ void String::setMaterial(float youngsModulus, float density) {
 	rho = density;
 }
 
+void String::reserveGrid(int size) {
+	if (size <= capacity) {
+		return;
+	}
+	delete[] u0;
+	delete[] u1;
+	delete[] u2;
+	u0 = new float[size] {0};
+	u1 = new float[size] {0};
+	u2 = new float[size] {0};
+	capacity = size;
+}
+
 void String::initGrid() {
-	// Initialise an N-size dynamic array for n-1,n and n+1 states of the string 
-	u0 = new float[N] {0};
-	u1 = new float[N] {0};
-	u2 = new float[N] {0};
+	// Initialise N-size arrays for n-1,n and n+1 states of the string, reusing the previous arrays when large enough
+	reserveGrid(N);
+	for (int l = 0; l < N; l++) {
+		u0[l] = 0.0f;
+		u1[l] = 0.0f;
+		u2[l] = 0.0f;
+	}
 
 	lend = N - 2;
 	li = floor(xi * N);
-	lo = floor(xo * N);
+
+	// Single pickup at xo, until setPickups() is called
+	numPickups = 1;
+	pickupPosition[0] = xo;
+	pickupIndex[0] = xo * N;
+	rampRemaining = 0;
 }
 
 
+
+int String::addModes(ResonatorBank& bank, int maxModes) {
+	// The grid points l = 0..N-1 lie between fixed ends at -1 and N, so the modes are sin(w (l + 1)) with w = p pi / (N + 1)
+	int numCandidates = N < maxCandidateModes ? N : maxCandidateModes;
+	float amp1[maxCandidateModes];
+	float amp2[maxCandidateModes];
+	float loudness[maxCandidateModes];
+	float d = param1 / param2;
+
+	for (int p = 0; p < numCandidates; p++) {
+		// Project u1 and u2 onto the mode, generating the sines by recurrence
+		double w = (p + 1) * M_PI / (N + 1);
+		double twoCos = 2.0 * cos(w);
+		double sPrev = 0.0;
+		double s = sin(w);
+		double sum1 = 0.0;
+		double sum2 = 0.0;
+		for (int l = 0; l < N; l++) {
+			sum1 += u1[l] * s;
+			sum2 += u2[l] * s;
+			double sNext = twoCos * s - sPrev;
+			sPrev = s;
+			s = sNext;
+		}
+		amp1[p] = float(2.0 * sum1 / (N + 1));
+		amp2[p] = float(2.0 * sum2 / (N + 1));
+
+		// Loudness of the mode at the loudest pickup
+		float shape = 0.0f;
+		for (int i = 0; i < numPickups; i++) {
+			shape = fmax(shape, fabs(ResonatorBank::readMode(float(w), N, pickupIndex[i])));
+		}
+		loudness[p] = (fabs(amp1[p]) + fabs(amp2[p])) * shape;
+	}
+
+	// Add the loudest modes, picking the loudest remaining one each time (maxModes is small)
+	int added = 0;
+	for (; added < maxModes && added < numCandidates; added++) {
+		int best = 0;
+		for (int p = 1; p < numCandidates; p++) {
+			if (loudness[p] > loudness[best]) {
+				best = p;
+			}
+		}
+		if (loudness[best] <= 0.0f) {
+			break;
+		}
+		loudness[best] = -1.0f;
+
+		// Eigenvalues of the second and fourth differences, as in updateGrid()
+		float w = float((best + 1) * M_PI / (N + 1));
+		float D = 4.0f * sinf(0.5f * w) * sinf(0.5f * w);
+		float c = (2.0f - lambdasq * D - musq * D * D) / param2;
+		if (!bank.addMode(w, N, c, d, amp1[best], amp2[best])) {
+			break;
+		}
+	}
+	return added;
+}
+
+void String::setModes(const ResonatorBank& bank, int first, int count) {
+	// Inverse of addModes(), the kept modes carry on exactly as they did in the bank
+	for (int l = 0; l < N; l++) {
+		u1[l] = 0.0f;
+		u2[l] = 0.0f;
+	}
+	for (int m = first; m < first + count; m++) {
+		float w, a1, a2;
+		bank.getMode(m, w, a1, a2);
+		double twoCos = 2.0 * cos(w);
+		double sPrev = 0.0;
+		double s = sin(w);
+		for (int l = 0; l < N; l++) {
+			u1[l] += float(a1 * s);
+			u2[l] += float(a2 * s);
+			double sNext = twoCos * s - sPrev;
+			sPrev = s;
+			s = sNext;
+		}
+	}
+}
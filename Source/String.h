@@ -12,6 +12,9 @@
 	setForce() must also be called to set the input force for the current sample
 
 	process() can then be called to return the per sample output of the string at location xo 
+	Once the force has ended, addModes() hands the string over to a ResonatorBank
+	Several pickups can be read at once with setPickups() and process(outputs), each pickup
+	position is interpolated (cubic Lagrange) so that positions can move smoothly
 
   ==============================================================================
 */
@@ -19,21 +22,52 @@
 #pragma once
 #include<math.h>
 #include<vector>
+#include "ResonatorBank.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+/* Coefficients of the FDTD scheme, which only depend on the string and the sample rate*/
+struct StringCoefficients {
+	float freq;                         // Frequency of note
+	float L;                            // Length of string
+	float r;                            // radius of string
+	float T60;							// T60 time
+	float k;							// Timestep
+	float A;                            // Area of cross section of string
+	float param1;						// Loss parameters
+	float param2;
+	float lambdasq;						// Courant Number (squared)
+	float musq;							// Numerical Stiffness Constant (squared)
+	float forceCoeff;                   // Force Coefficient
+	int N;                              // Number of Grid spaces
+	int capacity = 0;                   // Allocated size of the grids
+};
+
 class String {
 
 public:
 
+	static constexpr int maxPickups = 8;    // Most pickups read by process(outputs)
+	static constexpr int minGridSize = 5;   // Fewest grid points updateBoundary() handles
+
 	/* Destructor*/
 	~String();
 
 	/* Process returns the signal at xo of the string for each sample using FDTD*/	
 	float process();
 
+	/* Process adds the signal at each pickup of the string to outputs[0..numPickups-1]*/
+	void process(float* outputs);
+
+	/* Sets pickup positions (0-1), ramping from the current positions if ramp is true.
+	   Until this is called there is a single pickup at xo */
+	void setPickups(const float* positions, int count, bool ramp);
+
+	/* Returns the number of pickups*/
+	int getNumPickups();
+
 	/* Updates the grid for n+1 timestep*/
 	void updateGrid();
 
@@ -43,9 +77,27 @@ public:
 	/* Adds the input force at coordinate xi*/
 	void addForce();
 
+	/* Returns the interpolated displacement at a fractional grid index of the newest state*/
+	float readPosition(float index);
+
+	/* Writes the displacement at numPoints evenly spaced points along the string, the fixed ends included*/
+	void getShape(float* dest, int numPoints);
+
 	/* Returns the frequency of the string*/
 	float getFrequency();
 
+	/* Returns the number of grid points N*/
+	int getGridSize();
+
+	/* True if the coefficients are finite (computeCoefficients() keeps at least minGridSize points), process() must not be called otherwise*/
+	bool isStable();
+
+	/* Mean squared displacement of the newest state, not finite once the grid has diverged*/
+	float getEnergy();
+
+	/* Sets every state to exactly zero, keeping the coefficients and pickups*/
+	void clearState();
+
 	/* Set sample rate*/
 	void setsampleRate(float samprate);
 
@@ -67,6 +119,16 @@ public:
 	/* Sets Parameters of String */
 	void setParameters(float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds);
 
+	/* Sets precomputed coefficients instead of calling setParameters()*/
+	void setCoefficients(const StringCoefficients& coefficients);
+
+	/* Computes the coefficients for a string (material in SI units)*/
+	static StringCoefficients computeCoefficients(float sampleRate, float youngsModulus, float density,
+		float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds);
+
+	/* Shortest length giving minGridSize points for a stiffness K and time step k, frequencies the grid cannot hold being lowered*/
+	static float getMinimumLength(float& frequencyInHz, float K, float k);
+
 	/* Sets the coordinates for excitation and output (0-1)*/
 	void setExcCoordinates(float inCoordinate, float outCoordinate);
 	
@@ -76,6 +138,22 @@ public:
 	/* Initialises grids */
 	void initGrid();
 
+	/* Allocates grids of at least size points, so that initGrid() does not allocate for N <= size*/
+	void reserveGrid(int size);
+
+	/* Projects the current state onto the lowest modes of the grid and adds the maxModes loudest
+	   (at the current pickups) to bank, which then continues the string. Returns the number added*/
+	int addModes(ResonatorBank& bank, int maxModes);
+
+	/* Rebuilds the state from modes [first, first + count) of bank, added by addModes() of this string*/
+	void setModes(const ResonatorBank& bank, int first, int count);
+
+	static constexpr int maxCandidateModes = 128;   // Modes considered by addModes()
+
+	/* Rounds the newest state to fp16 (under a power of two scale) after every timestep, to measure what
+	   fp16 grids would do to the pitch and decay (SweepRenderer --half-report). Slower than fp32, never for playback*/
+	void setHalfRounding(bool enabled);
+
 
 // Private variables
 private:
@@ -84,11 +162,8 @@ private:
 	float SR;                           // Sample Rate 
 	float r;                            // radius of string
 	float L;                            // Length of string
-	float T;                            // Tension
 	float A;                            // Area of cross section of string
-	float I;                            // Moment of inertia
 
-	float sig;                          // Loss Parameter
 	float T60;							// T60 time
 	float param1;
 	float param2;
@@ -96,27 +171,33 @@ private:
 	float rho;				            // Density
 	float E;							// Young's Modulus
 		
-	float K;							// Stiffness Constant
 	float k;							// Timestep
 
-	float c;							// Wavespeed
 	float h;							// Grid Spacing
-	float hmin;                         // Minimum grid spacing
 	
 	// Coefficients
 	float lambdasq;						// Courant Number (squared)
 	float musq;							// Numerical Stiffness Constant (squared)
 
 	// Grid Parameters
-	float *u0;							// State at time n+1
-	float *u1;							// State at time n
-	float *u2;							// State at time n-1
+	float *u0 = nullptr;				// State at time n+1
+	float *u1 = nullptr;				// State at time n
+	float *u2 = nullptr;				// State at time n-1
+	bool halfRounding = false;          // setHalfRounding() was asked for
 
 	int N;                              // Number of Grid spaces
+	int capacity = 0;                   // Allocated size of the grids
 	int lstart = 2;                     // Start index
 	int lend;							// End Index
 	int li;								// Index of Excitation
-	int lo;								// Index of Output
+
+	// Pickups (output positions, in grid spaces)
+	int numPickups = 1;                 // Number of pickups
+	float pickupPosition[maxPickups];   // Target positions of the pickups (0-1)
+	float pickupIndex[maxPickups];      // Current fractional grid index of each pickup
+	float pickupStep[maxPickups];       // Index increment per sample while ramping
+	int rampRemaining = 0;              // Samples left in the current ramp
+	const int rampLength = 256;         // Length of a pickup ramp in samples
 
 	// Input force parameters
 	float force;                        // Force at current timestep (N)
@@ -124,4 +205,7 @@ private:
 	float xo;							// Coordinate of output (0-1)
 	float forceCoeff;                   // Force Coefficient 
 
+	/* Rounds u0 as fp16 storage would*/
+	void roundToHalf();
+
 };
\ No newline at end of file
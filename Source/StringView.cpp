@@ -0,0 +1,105 @@
+/*
+==============================================================================
+
+StringView.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "StringView.h"
+
+StringView::StringView(SnapshotBuffer& buffer) : snapshots(buffer) {
+    snapshots.wanted = true;
+    startTimerHz(SnapshotBuffer::snapshotRate);
+}
+
+StringView::~StringView() {
+    stopTimer();
+    snapshots.wanted = false;
+}
+
+void StringView::timerCallback() {
+    if (auto* snapshot = snapshots.read()) {
+        latest = snapshot;
+        repaint();
+    }
+}
+
+void StringView::paint(juce::Graphics& g) {
+    g.fillAll(juce::Colour(0xff15181c));
+
+    if (latest == nullptr || latest->numVoices == 0) {
+        g.setColour(juce::Colours::grey);
+        g.setFont(15.0f);
+        g.drawFittedText("Play some notes to see the strings", getLocalBounds(), juce::Justification::centred, 1);
+        return;
+    }
+
+    // Total CPU of the voices
+    float total = 0.0f;
+    for (int i = 0; i < latest->numVoices; i++) {
+        total += latest->voices[i].cpuLoad;
+    }
+    auto area = getLocalBounds().toFloat().reduced(6.0f);
+    g.setColour(juce::Colours::white);
+    g.setFont(14.0f);
+    g.drawText("Voices CPU " + juce::String(100.0f * total, 1) + "%", area.removeFromTop(20.0f), juce::Justification::centredLeft);
+
+    // One cell per voice
+    const int columns = 4;
+    const int rows = (latest->numVoices + columns - 1) / columns;
+    const float cellWidth = area.getWidth() / columns;
+    const float cellHeight = area.getHeight() / rows;
+    for (int i = 0; i < latest->numVoices; i++) {
+        juce::Rectangle<float> cell(area.getX() + (i % columns) * cellWidth, area.getY() + (i / columns) * cellHeight, cellWidth, cellHeight);
+        paintVoice(g, latest->voices[i], cell.reduced(3.0f));
+    }
+}
+
+void StringView::paintVoice(juce::Graphics& g, const VoiceSnapshot& voice, juce::Rectangle<float> area) {
+    static const juce::Colour modeColours[] = { juce::Colour(0xff2a2e34), juce::Colour(0xff3d7bd9), juce::Colour(0xff49b27c), juce::Colour(0xffc08a3a), juce::Colour(0xff9b6bd1) };
+    static const char* modeNames[] = { "idle", "FDTD", "modal", "cached", "IR" };
+    const juce::Colour colour = modeColours[voice.mode];
+
+    g.setColour(juce::Colour(0xff1f2328));
+    g.fillRoundedRectangle(area, 4.0f);
+    g.setColour(colour);
+    g.drawRoundedRectangle(area, 4.0f, 1.0f);
+    if (voice.mode == VoiceSnapshot::idle) {
+        return;
+    }
+
+    // Note, mode and CPU
+    auto label = area.reduced(4.0f).removeFromTop(16.0f);
+    g.setFont(12.0f);
+    g.drawText(juce::MidiMessage::getMidiNoteName(voice.midiNote, true, true, 4) + "  " + modeNames[voice.mode],
+        label, juce::Justification::centredLeft);
+    g.setColour(juce::Colours::lightgrey);
+    g.drawText(juce::String(100.0f * voice.cpuLoad, 1) + "%", label, juce::Justification::centredRight);
+
+    // Strings, scaled together so that their relative amplitudes show
+    auto plot = area.reduced(6.0f).withTrimmedTop(18.0f);
+    float peak = 1e-12f;
+    for (int s = 0; s < voice.numStrings; s++) {
+        for (float value : voice.shape[s]) {
+            peak = juce::jmax(peak, std::abs(value));
+        }
+    }
+    const float scale = 0.45f * plot.getHeight() / peak;
+    for (int s = 0; s < voice.numStrings; s++) {
+        juce::Path path;
+        for (int j = 0; j < VoiceSnapshot::numPoints; j++) {
+            float x = plot.getX() + plot.getWidth() * j / float(VoiceSnapshot::numPoints - 1);
+            float y = plot.getCentreY() - scale * voice.shape[s][j];
+            if (j == 0) {
+                path.startNewSubPath(x, y);
+            }
+            else {
+                path.lineTo(x, y);
+            }
+        }
+        g.setColour(colour.withAlpha(1.0f - 0.25f * s));
+        g.strokePath(path, juce::PathStrokeType(1.5f));
+    }
+}
@@ -0,0 +1,38 @@
+/*
+  ==============================================================================
+
+    StringView.h
+    Author:  Ruthu Prem Kumar
+
+    Component drawing the latest StateSnapshot : the displacement of every
+    string of every voice, with its note, mode (simulated, modal tail or
+    cached) and share of CPU. Polls the snapshot buffer at 60 fps.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "StateSnapshot.h"
+
+class StringView : public juce::Component, private juce::Timer {
+public:
+
+    StringView(SnapshotBuffer& buffer);
+    ~StringView() override;
+
+    void paint(juce::Graphics& g) override;
+
+private:
+
+    void timerCallback() override;
+
+    /* Draws one voice in its cell*/
+    void paintVoice(juce::Graphics& g, const VoiceSnapshot& voice, juce::Rectangle<float> area);
+
+    SnapshotBuffer& snapshots;
+    const StateSnapshot* latest = nullptr;          // Latest snapshot read, valid until the next read
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(StringView)
+};
@@ -0,0 +1,101 @@
+/*
+==============================================================================
+
+SympatheticResonance.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "SympatheticResonance.h"
+#include "WaveguideString.h"
+
+void SympatheticResonance::prepare(double newSampleRate) {
+    sampleRate = newSampleRate;
+    tuned = false;
+    tableHash = 0;
+    for (int m = 0; m < maxModes; m++) {
+        c1[m] = c2[m] = b[m] = gain[m] = 0.0f;
+        undamped1[m] = undamped2[m] = damped1[m] = damped2[m] = coupling[m] = 0.0f;
+    }
+    reset();
+}
+
+void SympatheticResonance::setKeys(const KeyTable& table) {
+    if (tuned && table.hash == tableHash) {
+        return;
+    }
+    tuned = true;
+    tableHash = table.hash;
+
+    const NoteParameters& p = table.parameters;
+    const double undampedRadius = exp(-6.9078 / (double(p.T60) * sampleRate));
+    const double dampedRadius = exp(-6.9078 / (double(damperSeconds) * sampleRate));
+    const double couplingRadius = exp(-6.9078 / (double(couplingSeconds) * sampleRate));
+
+    for (int k = 0; k < numKeys; k++) {
+        const KeyGeometry& g = table.keys[firstKey + k];
+        double B = WaveguideString::getInharmonicity(p.E * 1e9f, p.rho, g.frequency, g.length, g.radius / 1000.0f);
+        for (int n = 1; n <= partialsPerKey; n++) {
+            const int m = k * partialsPerKey + n - 1;
+            double f = n * g.frequency * sqrt(1.0 + B * n * n);
+            if (f >= 0.45 * sampleRate) {
+                // Above the band : a silent resonator keeps the arrays uniform
+                undamped1[m] = undamped2[m] = damped1[m] = damped2[m] = coupling[m] = gain[m] = 0.0f;
+                continue;
+            }
+            double theta = 2.0 * M_PI * f / sampleRate;
+            undamped1[m] = float(2.0 * undampedRadius * cos(theta));
+            undamped2[m] = float(-undampedRadius * undampedRadius);
+            damped1[m] = float(2.0 * dampedRadius * cos(theta));
+            damped2[m] = float(-dampedRadius * dampedRadius);
+            // Unity gain at resonance for a string decaying in couplingSeconds
+            coupling[m] = float((1.0 - couplingRadius * couplingRadius) * sin(theta));
+            gain[m] = 1.0f / float(n);
+        }
+    }
+}
+
+void SympatheticResonance::setDampers(bool sustainDown, const bool* sounding) {
+    for (int k = 0; k < numKeys; k++) {
+        const bool open = sustainDown && !sounding[k];
+        for (int m = k * partialsPerKey; m < (k + 1) * partialsPerKey; m++) {
+            c1[m] = open ? undamped1[m] : damped1[m];
+            c2[m] = open ? undamped2[m] : damped2[m];
+            b[m] = open ? coupling[m] : 0.0f;
+        }
+    }
+}
+
+void SympatheticResonance::process(const float* bridge, float* output, int numSamples) {
+    // Nothing rings once the dampers have been down for a while (b is 0 for every key then)
+    bool anyOpen = false;
+    for (int m = 0; m < maxModes && !anyOpen; m++) {
+        anyOpen = b[m] != 0.0f;
+    }
+    dampedSamples = anyOpen ? 0 : dampedSamples + numSamples;
+    if (!tuned || dampedSamples > 4.0 * damperSeconds * sampleRate) {
+        return;
+    }
+
+    for (int i = 0; i < numSamples; i++) {
+        const float x = bridge[i];
+        for (int m = 0; m < maxModes; m++) {
+            float y0 = c1[m] * y1[m] + c2[m] * y2[m] + b[m] * x;
+            y2[m] = y1[m];
+            y1[m] = y0;
+        }
+        float sum = 0.0f;
+        for (int m = 0; m < maxModes; m++) {
+            sum += gain[m] * y1[m];
+        }
+        output[i] += sum;
+    }
+}
+
+void SympatheticResonance::reset() {
+    for (int m = 0; m < maxModes; m++) {
+        y1[m] = y2[m] = 0.0f;
+    }
+    dampedSamples = 0;
+}
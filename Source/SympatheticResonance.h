@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    SympatheticResonance.h
+    Author:  Ruthu Prem Kumar
+
+    Resonance of the undamped strings while the sustain pedal is down.
+
+    Every piano key (21-108) is reduced to partialsPerKey two-pole
+    resonators tuned to the stiff string partials f_n = n f0 sqrt(1 + B n^2)
+    of its geometry (see KeyGeometry and WaveguideString::getInharmonicity()).
+    The bank is driven by the summed bridge signal of the voices, and only
+    the keys which are undamped and not sounding through a voice take in
+    energy : with the pedal up every idle key is damped, and a key played by
+    a voice is left to its strings.
+
+    All resonators are processed every sample whatever the number of
+    undamped keys, with plain arrays per resonator so that process()
+    vectorises across them. The bank is skipped once the pedal has been up
+    long enough for it to have died out.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "NoteTables.h"
+
+class SympatheticResonance {
+public:
+
+    static constexpr int firstKey = 21;                     // Lowest piano key
+    static constexpr int numKeys = 88;                      // Piano keys
+    static constexpr int partialsPerKey = 4;                // Resonators per key
+    static constexpr int maxModes = numKeys * partialsPerKey;
+    static constexpr float damperSeconds = 0.15f;           // T60 of a damped string (s)
+    static constexpr float couplingSeconds = 8.0f;          // Decay of a string the bridge would drive at unity gain (s), sets the coupling
+
+    /* Sets the sample rate and silences every resonator*/
+    void prepare(double sampleRate);
+
+    /* Tunes the resonators to the keys of a preset, if it differs from the current one*/
+    void setKeys(const KeyTable& table);
+
+    /* Pedal state, and keys sounding through a voice (numKeys flags from firstKey), applied to the next samples*/
+    void setDampers(bool sustainDown, const bool* sounding);
+
+    /* Adds the resonance driven by bridge[0..numSamples-1] to output[0..numSamples-1]*/
+    void process(const float* bridge, float* output, int numSamples);
+
+    /* Silences every resonator*/
+    void reset();
+
+private:
+
+    double sampleRate = 0.0;
+    juce::int64 tableHash = 0;                              // Hash of the key table the resonators are tuned to
+    bool tuned = false;                                     // setKeys() was called since prepare()
+    int dampedSamples = 0;                                  // Samples since the pedal went up
+
+    // Resonators, y[n] = c1 y[n-1] + c2 y[n-2] + b x[n]
+    float c1[maxModes];                                     // Current coefficients
+    float c2[maxModes];
+    float b[maxModes];                                      // Current input gain
+    float y1[maxModes];                                     // Output at n-1
+    float y2[maxModes];                                     // Output at n-2
+    float gain[maxModes];                                   // Output gain (1 / partial number)
+
+    // Coefficients of each resonator when undamped and damped
+    float undamped1[maxModes], undamped2[maxModes];
+    float damped1[maxModes], damped2[maxModes];
+    float coupling[maxModes];                               // Input gain when undamped
+};
@@ -5,7 +5,7 @@
     Created: 30 Apr 2021 
     Author: Ruthu Prem Kumar
 
-    Class to control Synthesiser voices and Synthesiser sounds.
+    Piano voices and the synthesiser which dispatches MIDI to them.
     Accesses Note.h to create instances of notes, and plays a sample-by-sample 
     output from Note.process()
 
@@ -15,18 +15,66 @@
 #pragma once
 #include "JuceHeader.h"
 #include "Note.h"
+#include "NoteCache.h"
+#include "ImpulseResponses.h"
+#include "SympatheticResonance.h"
+#include "WorkerPool.h"
+#include "EngineTuner.h"
+#include "StateSnapshot.h"
 
 // ===========================
 // ===========================
-// SOUND
-class SynthSound : public juce::SynthesiserSound
+// BUDGET
+/* Limits on simulated voices, beyond which voices play cached notes instead*/
+struct VoiceBudget
 {
-public:
-    bool appliesToNote(int) override { return true; }
-    //--------------------------------------------------------------------------
-    bool appliesToChannel(int) override { return true; }
+    std::atomic<int> simulating { 0 };                              // Number of voices simulating a note
+    std::atomic<float> cpuLoad { 0.0f };                            // Smoothed block time / block duration
+    std::atomic<int> maxSimulating { 12 };                          // Simulated voice limit
+    std::atomic<float> maxCpuLoad { 0.8f };                         // CPU load limit
+
+    bool isExceeded() const {
+        return simulating.load() >= maxSimulating || cpuLoad.load() >= maxCpuLoad;
+    }
+};
+
+// ===========================
+// ===========================
+// HEALTH
+/* Counters of the numerical watchdog of the voices and of dropped MIDI (written by the rendering threads, read by any thread)*/
+struct HealthCounters
+{
+    std::atomic<int> refused { 0 };                                 // Notes refused at note-on, their coefficients not being finite
+    std::atomic<int> quarantined { 0 };                             // Voices stopped and reset after their output or grid diverged
+    std::atomic<int> flushed { 0 };                                 // Finished notes flushed to zero once inaudible
+    std::atomic<int> midiDropped { 0 };                             // MIDI events the render-ahead FIFO had no room for, or too long for it
 };
 
+// ===========================
+// ===========================
+// QUALITY
+/* Settings which trade CPU for quality, lean for live playback and full for offline bounces*/
+struct QualityProfile
+{
+    int maxSimulating;                                              // Simulated voice limit (VoiceBudget)
+    float maxCpuLoad;                                               // CPU load limit (VoiceBudget)
+    bool levelOfDetail;                                             // Masked and ringing notes may continue as a resonator bank
+    bool waveguides;                                                // Keys may play waveguide strings instead of the FDTD grid
+    float threadShare;                                              // Share of the worker pool used by a block (0-1)
+    bool halfRounding;                                              // FDTD grids are rounded to fp16, for accuracy reports only (see String::setHalfRounding())
+    float gridPointCost;                                            // Cost of a grid point against a waveguide (see Note::setGridPointCost())
+    int maxHelpers;                                                 // Most workers helping with a block
+
+    /* Live playback : voices fall back on the cache and the modal tail, and cores are left to the host*/
+    static QualityProfile realtime(const EngineProfile& engine = EngineProfile()) {
+        return { 12, 0.8f, true, true, 0.5f, false, engine.gridPointCost, engine.maxHelpers };
+    }
+
+    /* Offline bounces : every voice simulates the finest engine to the end, on every core*/
+    static QualityProfile offline(const EngineProfile& engine = EngineProfile()) {
+        return { 1 << 16, std::numeric_limits<float>::max(), false, false, 1.0f, false, engine.gridPointCost, engine.maxHelpers };
+    }
+};
 
 // =================================
 // =================================
@@ -35,22 +83,75 @@ public:
 /*!
  @class SynthVoice
  @abstract struct defining the DSP associated with a specific voice.
- @discussion multiple SynthVoice objects will be created by the Synthesiser so that it can be played polyphicially
+ @discussion multiple SynthVoice objects will be created by the PianoSynthesiser so that it can be played polyphicially.
+             The class is final and called directly, so that rendering a voice is not a virtual call
 
  */
-class SynthVoice : public juce::SynthesiserVoice
+class SynthVoice final
 {
 public:
     SynthVoice() {}
 
+    /* Sets the sample rate of the voice, before init()*/
+    void setCurrentPlaybackSampleRate(double newRate) {
+        sampleRate = newRate;
+    }
+
+    double getSampleRate() const {
+        return sampleRate;
+    }
+
+    /* Key of the note being played, -1 once the voice is free*/
+    int getCurrentlyPlayingNote() const {
+        return currentNote;
+    }
+
+    bool isVoiceActive() const {
+        return currentNote >= 0;
+    }
+
+    /* Smoothed render time / real time of the voice*/
+    float getRenderLoad() const {
+        return renderLoad;
+    }
+
+    /* True once the note has been released and only its envelope is left*/
+    bool isEnding() const {
+        return ending;
+    }
+
+    /* True while the voice convolves the response of a key, which a re-strike of the key adds to*/
+    bool isConvolving(int midiNoteNumber) const {
+        return convolving && convolvedKey == midiNoteNumber && currentNote >= 0;
+    }
+
     void init(float sampleRate) {
         
         /// Note
         note.setSampleRate(sampleRate);
+        note.reserve(sampleRate);
         
         /// ADSR
         env.setSampleRate(sampleRate); 
 
+        /// Convolution, only allocated while the impulse response mode is on (about 2 MB per voice)
+        convolverReady = false;
+        convolver.release();
+        convolverSampleRate = sampleRate;
+        if (responses != nullptr && responses->isEnabled()) {
+            prepareConvolver();
+        }
+
+    }
+
+    /* Allocates the convolver, for as many channels as the strings have pickups, once the impulse response
+       mode is on (message thread). It is kept until the next init(), as the audio thread may be using it*/
+    void prepareConvolver() {
+        if (responses == nullptr || convolverReady.load() || convolverSampleRate <= 0.0f) {
+            return;
+        }
+        convolver.prepare(convolverSampleRate, String::maxPickups);
+        convolverReady.store(true, std::memory_order_release);
     }
 
     /* */
@@ -88,6 +189,95 @@ public:
         lim2 = lim2In;
     }
 
+    /* Set pointer for the spread of the pickups around xo, and the number of pickups (one per output channel)*/
+    void setPickupPointers(std::atomic<float>* spreadIn, int numPickupsIn) {
+        spread = spreadIn;
+        numPickups = juce::jlimit(1, String::maxPickups, numPickupsIn);
+    }
+
+    /* Set the note cache and the budget for simulated voices (optional, a voice without them always simulates)*/
+    void setFallback(NoteCache::Client* cache, VoiceBudget* voiceBudget) {
+        noteCache = cache;
+        budget = voiceBudget;
+    }
+
+    /* Set the impulse responses of the keys, played instead of the strings once rendered (optional)*/
+    void setResponses(ImpulseResponses::Client* impulseResponses) {
+        responses = impulseResponses;
+    }
+
+    /* Set the counters of the numerical watchdog (optional)*/
+    void setHealth(HealthCounters* counters) {
+        health = counters;
+    }
+
+    /* Set pointer for the time after which a ringing note is handed over to a resonator bank (optional, without it only released notes are)*/
+    void setTailPointer(std::atomic<float>* tailTimeIn) {
+        tailTime = tailTimeIn;
+    }
+
+    /* Sets the quality of the voice, the engine applies from the next note on*/
+    void setQuality(const QualityProfile& quality) {
+        levelOfDetail = quality.levelOfDetail;
+        note.setWaveguideAllowed(quality.waveguides);
+        note.setHalfRounding(quality.halfRounding);
+        note.setGridPointCost(quality.gridPointCost);
+        if (!levelOfDetail) {
+            reducedDetail = false;                                  // Masked voices go back to their strings
+        }
+    }
+
+    /* Smoothed RMS of the voice's output (after envelope and gain), which the synthesiser compares with the mix*/
+    float getLoudness() const {
+        return std::sqrt(meanSquare);
+    }
+
+    /* Asks for the modal tail while the voice is masked, or for the strings again once it is prominent*/
+    void setReducedDetail(bool reduced) {
+        reducedDetail = reduced;
+    }
+
+    bool hasReducedDetail() const {
+        return reducedDetail;
+    }
+
+    /* Copies the state of the voice for the editor (called by the thread rendering the voices)*/
+    void fillSnapshot(VoiceSnapshot& snapshot) {
+        snapshot.midiNote = getCurrentlyPlayingNote();
+        snapshot.loudness = getLoudness();
+        snapshot.cpuLoad = renderLoad;
+        snapshot.numStrings = 0;
+        if (!playing) {
+            snapshot.mode = VoiceSnapshot::idle;
+        }
+        else if (simulating) {
+            snapshot.mode = VoiceSnapshot::simulated;
+            snapshot.numStrings = note.getNumStrings();
+            for (int i = 0; i < snapshot.numStrings; i++) {
+                note.getShape(i, snapshot.shape[i], VoiceSnapshot::numPoints);
+            }
+        }
+        else if (convolving) {
+            snapshot.mode = VoiceSnapshot::convolved;
+        }
+        else if (resonating) {
+            snapshot.mode = VoiceSnapshot::modal;
+            snapshot.numStrings = note.getNumStrings();
+            for (int i = 0; i < snapshot.numStrings; i++) {
+                note.getShape(i, snapshot.shape[i], VoiceSnapshot::numPoints, &tail);
+            }
+        }
+        else {
+            snapshot.mode = VoiceSnapshot::cached;
+        }
+    }
+
+    /* Set pointers to the shared key and force tables*/
+    void setTablePointers(std::atomic<const KeyTable*>* keyTableIn, std::atomic<const ForceTable*>* forceTableIn) {
+        keyTable = keyTableIn;
+        forceTable = forceTableIn;
+    }
+
     /* Set pointers for ADSR variable parameters*/
     void setADSRPointers(std::atomic<float>* A, std::atomic<float>* D, std::atomic<float>* S, std::atomic<float>* R) {
         attack = A;
@@ -101,24 +291,25 @@ public:
 
      @param midiNoteNumber
      @param velocity
-     @param SynthesiserSound unused variable
-     @param / unused variable
+     @param seed seeds the detune of the note so that a session replays exactly (0 to leave it to the note)
      */
-    void startNote(int midiNoteNumber, float velocity, juce::SynthesiserSound*, int /*currentPitchWheelPosition*/) override
+    void startNote(int midiNoteNumber, float velocity, juce::int64 seed = 0)
     {
+        // A stolen voice is restarted without stopNote(), unless it convolves the same key so that the responses add
+        const bool restrike = convolving && midiNoteNumber == convolvedKey;
+        if (!restrike) {
+            finishNote();
+        }
+        currentNote = midiNoteNumber;
+
         playing = true;
         ending = false;
-
-        // Number of strings in Note (based on lim1 and lim2)
-        if (midiNoteNumber < int(*lim1)) {
-            note.setNumStrings(1);
-        }
-        else if(midiNoteNumber < int(*lim2)) {
-            note.setNumStrings(2);
-        }
-        else {
-            note.setNumStrings(3);
-        }
+        samplesSinceOnset = 0;
+        meanSquare = 0.0f;
+        peakEnergy = 0.0f;
+        energyMeasured = false;
+        reducedDetail = false;
+        tailForDetail = false;
 
         bool excChoice;
         /// Struck or plucked
@@ -129,20 +320,56 @@ public:
             excChoice = false;      // Plucked
         }
 
-        // Set length and radius of strings of note
-        float frequency = juce::MidiMessage::getMidiNoteInHertz(midiNoteNumber) + 0.1443 * midiNoteNumber - 7.766;
-        float length =  (*lengthParam) * (-0.019196429 * float(midiNoteNumber) + 1.815625);
-        float radius = (*radiusParam) * (-2.08333e-03 * float(midiNoteNumber) + 0.62875);
-        
-        // Set Note properties
-        note.setInterval(*interval);
-        note.setMaterial((*E) * 1e9, *rho);
-        note.setInputOutput(*xi, *xo);
-        note.setStringParams(frequency, *freqParam, length, radius, *T60time);
-        note.setForceParameters(3.0 - 2.0 * velocity, *baseVel + (*velCurve) * (2.0f * velocity - 0.5f), excChoice);
+        /// Convolve the force with the response of the key once it has been rendered
+        convolving = false;
+        if (responses != nullptr) {
+            responses->keyPlayed(midiNoteNumber);
+            convolving = convolverReady.load(std::memory_order_acquire) && responses->start(convolver, midiNoteNumber);
+        }
+        if (convolving) {
+            note.setExcitation(velocity, excChoice, getNoteParameters(), forceTable != nullptr ? forceTable->load() : nullptr);
+            convolvedKey = midiNoteNumber;
+            forceSample = 0;
+        }
 
-        /// ADSR
-        env.reset();
+        /// Play a cached note when the budget for simulated voices is exceeded
+        bool cached = false;
+        if (!convolving && noteCache != nullptr && budget != nullptr) {
+            noteCache->notePlayed(midiNoteNumber, velocity);
+            cacheSeed = (cacheSeed + 1) % NoteCache::numSeeds;
+            cached = budget->isExceeded() && noteCache->startPlayer(cachePlayer, midiNoteNumber, velocity, excChoice, cacheSeed);
+        }
+        if (!convolving && !cached) {
+            if (seed != 0) {
+                note.setSeed(seed);
+            }
+            note.setKey(midiNoteNumber, velocity, excChoice, getNoteParameters(),
+                keyTable != nullptr ? keyTable->load() : nullptr, forceTable != nullptr ? forceTable->load() : nullptr);
+
+            // Parameters giving non-finite coefficients : the note is refused rather than simulated
+            if (!note.isPlayable()) {
+                if (health != nullptr) {
+                    health->refused++;
+                }
+                playing = false;
+                clearCurrentNote();
+                return;
+            }
+            if (budget != nullptr) {
+                budget->simulating++;
+            }
+            simulating = true;
+
+            // Start with the pickups in place
+            float positions[String::maxPickups];
+            getPickupPositions(positions);
+            note.setPickups(positions, numPickups, false);
+        }
+
+        /// ADSR, a re-strike attacks from the current level rather than clicking back to zero
+        if (!restrike) {
+            env.reset();
+        }
         env.noteOn();
 
     }
@@ -154,7 +381,7 @@ public:
      @param / unused variable
      @param allowTailOff bool to decie if the should be any volume decay
      */
-    void stopNote(float /*velocity*/, bool allowTailOff) override
+    void stopNote(float /*velocity*/, bool allowTailOff)
     {   
         if (allowTailOff) {
             env.noteOff();
@@ -162,7 +389,7 @@ public:
         }
         else {
             clearCurrentNote();
-            playing = false;
+            finishNote();
         }
     }
 
@@ -170,17 +397,19 @@ public:
     /**
      The Main DSP Block: Put your DSP code in here
 
-     If the sound that the voice is playing finishes during the course of this rendered block, it must call clearCurrentNote(), to tell the synthesiser that it has finished
+     If the sound that the voice is playing finishes during the course of this rendered block, it calls clearCurrentNote(), which frees the voice
 
      @param outputBuffer pointer to output
      @param startSample position of first sample in buffer
      @param numSamples number of smaples in output buffer
      */
-    void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples) override
+    void renderNextBlock(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples)
     {   
 
         if (playing) // check to see if this voice should be playing
         {
+            auto startTicks = juce::Time::getHighResolutionTicks();
+
             /// ADSR variable parameters (variable while note is playing)
             juce::ADSR::Parameters envParams;
             envParams.attack = *attack;
@@ -192,6 +421,51 @@ public:
             /// Gain value
             float G = *gain;
 
+            /// Hand a ringing note over to the resonator bank, cross-fading from the strings
+            bool timedOut = ending || (tailTime != nullptr && samplesSinceOnset >= *tailTime * getSampleRate());
+            bool masked = reducedDetail && samplesSinceOnset >= minDetailSeconds * getSampleRate();
+            if (levelOfDetail && simulating && !resonating && note.canHandOff() && note.isExcitationFinished() && (timedOut || masked)) {
+                tail.clear();
+                note.addModes(tail, ResonatorBank::maxModes / Note::maxStrings);
+                float positions[String::maxPickups];
+                getPickupPositions(positions);
+                tail.setPickups(positions, numPickups, false);
+                resonating = true;
+                handoffRemaining = handoffLength;
+                tailForDetail = !timedOut;
+            }
+
+            /// Back to the strings once a masked note is prominent again, rebuilt from the modes so that nothing jumps
+            if (tailForDetail && timedOut) {
+                tailForDetail = false;                              // The tail is kept from now on
+            }
+            if (tailForDetail && !reducedDetail && resonating && !simulating && (budget == nullptr || !budget->isExceeded())) {
+                note.restoreModes(tail);
+                resonating = false;
+                tailForDetail = false;
+                simulating = true;
+                if (budget != nullptr) {
+                    budget->simulating++;
+                }
+            }
+            samplesSinceOnset += numSamples;
+
+            /// Pickup positions (ramped by the strings and the bank when they move)
+            if (simulating || resonating) {
+                float positions[String::maxPickups];
+                getPickupPositions(positions);
+                if (simulating) {
+                    note.setPickups(positions, numPickups, true);
+                }
+                if (resonating) {
+                    tail.setPickups(positions, numPickups, true);
+                }
+            }
+
+            float blockPower = 0.0f;
+            float stringPower = 0.0f;
+            int blockSamples = 0;
+
             // iterate through the necessary number of samples (from startSample up to startSample + numSamples)
             for (int sampleIndex = startSample; sampleIndex < (startSample + numSamples); sampleIndex++)
             {
@@ -200,51 +474,246 @@ public:
                 // Get ADSR envelope value
                 float envVal = env.getNextSample();
 
-                // Get currentSample from note.process()
-                float currentSample = envVal * note.process();
+                // Get one sample per pickup from note.process(), or a single sample from the cached note
+                float outputs[String::maxPickups];
+                int numOutputs = 1;
+                if (simulating || resonating) {
+                    for (int p = 0; p < numPickups; p++) {
+                        outputs[p] = 0.0f;
+                    }
+                    if (simulating) {
+                        note.process(outputs);
+                    }
+                    if (resonating) {
+                        processTail(outputs);
+                    }
+                    numOutputs = numPickups;
+                }
+                else if (convolving) {
+                    for (int p = 0; p < convolver.getNumChannels(); p++) {
+                        outputs[p] = 0.0f;
+                    }
+                    convolver.process(note.getForce(forceSample++), outputs);
+                    numOutputs = convolver.getNumChannels();
+                }
+                else {
+                    outputs[0] = cachePlayer.nextSample();
+                }
 
-                // For each channel, write the currentSample float to the output
+                // Each channel gets its own pickup (the last pickup is repeated if there are more channels)
                 for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++)
                 {
-                    // The output sample is scaled by gain G 
-                    outputBuffer.addSample(chan, sampleIndex, currentSample * G);
+                    // The output sample is scaled by envelope and gain G 
+                    outputBuffer.addSample(chan, sampleIndex, envVal * outputs[juce::jmin(chan, numOutputs - 1)] * G);
                 }
+                blockPower += juce::square(envVal * outputs[0] * G);
+                stringPower += juce::square(outputs[0]);
+                blockSamples++;
 
                 // Check if the end of the note has been reached
                 if (ending) {
                     if (envVal < 0.001f) {
                         clearCurrentNote();
-                        playing = false;
+                        finishNote();
+                        break;
                     }
                 }
             }
+
+            // Watchdog, before a diverged output reaches the loudness
+            if (playing && (simulating || resonating) && blockSamples > 0) {
+                checkHealth(outputBuffer, startSample, numSamples, stringPower / float(blockSamples));
+            }
+
+            // Running loudness for the level of detail
+            if (blockSamples > 0 && std::isfinite(blockPower)) {
+                meanSquare = 0.8f * meanSquare + 0.2f * blockPower / float(blockSamples);
+            }
+
+            // Running render time relative to real time, shown by the editor
+            double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+            renderLoad = 0.9f * renderLoad + 0.1f * float(seconds * getSampleRate() / numSamples);
         }
     }
     //--------------------------------------------------------------------------
-    void pitchWheelMoved(int) override {}
-    //--------------------------------------------------------------------------
-    void controllerMoved(int, int) override {}
+private:
     //--------------------------------------------------------------------------
-    /**
-     Can this voice play a sound. 
+    /* Frees the voice*/
+    void clearCurrentNote() {
+        currentNote = -1;
+    }
 
-     @param sound a juce::SynthesiserSound* base class pointer
-     @return sound cast as a pointer to an instance of SynthSound
-     */
-    bool canPlaySound(juce::SynthesiserSound* sound) override
-    {
-        return dynamic_cast<SynthSound*> (sound) != nullptr;
+    /* Releases the simulated or cached note of the voice*/
+    void finishNote() {
+        if (simulating) {
+            if (budget != nullptr) {
+                budget->simulating--;
+            }
+            simulating = false;
+        }
+        cachePlayer.stop();
+        if (convolverReady.load(std::memory_order_acquire)) {
+            convolver.stop();
+        }
+        convolving = false;
+        resonating = false;
+        playing = false;
     }
-    //--------------------------------------------------------------------------
-private:
-    //--------------------------------------------------------------------------
 
+    /* Numerical health of a simulated voice, checked once per block from the mean square of its strings' output.
+       A voice whose output or grid is not finite, or whose grid gains energy once the force has ended, is stopped and reset.
+       A finished note below silentLevel is flushed to exact zero and stops simulating, so that its decay never reaches denormals*/
+    void checkHealth(juce::AudioSampleBuffer& outputBuffer, int startSample, int numSamples, float stringMeanSquare) {
+        const bool excited = simulating && !note.isExcitationFinished();
+        const float energy = simulating ? note.getEnergy() : 0.0f;
+        if (excited || !energyMeasured) {
+            // The force usually ends within the first block, whose end is then the reference
+            peakEnergy = juce::jmax(peakEnergy, energy);
+            energyMeasured = !excited;
+        }
+
+        if (!std::isfinite(stringMeanSquare) || !std::isfinite(energy) || (!excited && energy > divergenceRatio * peakEnergy)) {
+            // The other voices are finite, so every non-finite sample of the block comes from this one
+            for (int chan = 0; chan < outputBuffer.getNumChannels(); chan++) {
+                float* samples = outputBuffer.getWritePointer(chan, startSample);
+                for (int i = 0; i < numSamples; i++) {
+                    if (!std::isfinite(samples[i])) {
+                        samples[i] = 0.0f;
+                    }
+                }
+            }
+            note.silence();
+            tail.clear();
+            meanSquare = 0.0f;
+            clearCurrentNote();
+            finishNote();
+            if (health != nullptr) {
+                health->quarantined++;
+            }
+            return;
+        }
+
+        const float silentPower = silentLevel * silentLevel;
+        if (!excited && stringMeanSquare < silentPower && energy < silentPower) {
+            note.silence();
+            tail.clear();
+            if (simulating && budget != nullptr) {
+                budget->simulating--;
+            }
+            simulating = false;
+            resonating = false;
+            cachePlayer.stop();                                     // The voice outputs zeros until its note off
+            if (health != nullptr) {
+                health->flushed++;
+            }
+        }
+    }
+
+    /* Adds the resonator bank to outputs, fading it in over the strings' output during the hand-off*/
+    void processTail(float* outputs) {
+        float tailOutputs[String::maxPickups];
+        for (int p = 0; p < numPickups; p++) {
+            tailOutputs[p] = 0.0f;
+        }
+        tail.process(tailOutputs);
+
+        if (!simulating) {
+            for (int p = 0; p < numPickups; p++) {
+                outputs[p] += tailOutputs[p];
+            }
+            return;
+        }
+
+        float t = 1.0f - float(handoffRemaining) / float(handoffLength);
+        for (int p = 0; p < numPickups; p++) {
+            outputs[p] = (1.0f - t) * outputs[p] + t * tailOutputs[p];
+        }
+
+        // The strings are no longer needed once the bank has taken over
+        if (--handoffRemaining == 0) {
+            if (budget != nullptr) {
+                budget->simulating--;
+            }
+            simulating = false;
+        }
+    }
+
+    /* Pickup positions (0-1) spread evenly around xo*/
+    void getPickupPositions(float* positions) {
+        spreadPickups(*xo, spread != nullptr ? float(*spread) : 0.0f, numPickups, positions);
+    }
+
+    /* Snapshot of the parameters which shape the note*/
+    NoteParameters getNoteParameters() {
+        NoteParameters p;
+        p.T60 = *T60time;
+        p.interval = *interval;
+        p.freqParam = *freqParam;
+        p.baseVel = *baseVel;
+        p.velCurve = *velCurve;
+        p.E = *E;
+        p.rho = *rho;
+        p.xi = *xi;
+        p.xo = *xo;
+        p.lengthParam = *lengthParam;
+        p.radiusParam = *radiusParam;
+        p.lim1 = *lim1;
+        p.lim2 = *lim2;
+        return p;
+    }
+
+    int currentNote = -1;                                           // Key being played, -1 when free
+    double sampleRate = 44100.0;                                    // Sample rate of the voice
     bool playing = false;
     bool ending = false;
+    bool simulating = false;                                        // Note is simulated, otherwise played from the cache
+    bool resonating = false;                                        // Note is continued by the resonator bank
+    bool convolving = false;                                        // Note is the force convolved with the key response
 
     /// Note object
     Note note;
 
+    /// Release tail
+    ResonatorBank tail;                                             // Modes of the strings once they only ring out
+    std::atomic<float>* tailTime = nullptr;                         // Time after which a ringing note is handed over (s)
+    int samplesSinceOnset = 0;                                      // Samples rendered since the note started
+    int handoffRemaining = 0;                                       // Samples left in the cross-fade to the bank
+    static constexpr int handoffLength = 256;                       // Length of the cross-fade to the bank
+
+    float renderLoad = 0.0f;                                        // Smoothed render time / real time
+
+    /// Numerical health
+    HealthCounters* health = nullptr;                               // Counters of the watchdog
+    float peakEnergy = 0.0f;                                        // Largest grid energy until the force has ended
+    bool energyMeasured = false;                                    // peakEnergy includes a block after the force
+    static constexpr float divergenceRatio = 1e4f;                  // Growth of the grid energy after the force taken as divergence (40 dB, a decaying string grows by 20 at most)
+    static constexpr float silentLevel = 5e-9f;                     // RMS of the strings below which a note is inaudible at the largest gain (about -166 dB)
+
+    /// Level of detail
+    bool levelOfDetail = true;                                      // Hand-offs to the resonator bank are allowed
+    float meanSquare = 0.0f;                                        // Smoothed mean square of the output
+    bool reducedDetail = false;                                     // Voice is masked by the others
+    bool tailForDetail = false;                                     // Tail was started because the voice was masked
+    static constexpr float minDetailSeconds = 0.1f;                 // Full detail kept after the onset (s)
+
+    /// Impulse responses
+    ImpulseResponses::Client* responses = nullptr;                  // Responses of the keys for the current preset
+    ImpulseResponses::Convolver convolver;                          // Response being played
+    std::atomic<bool> convolverReady { false };                     // The convolver is allocated (see prepareConvolver())
+    float convolverSampleRate = 0.0f;                               // Sample rate the convolver is allocated for
+    int convolvedKey = -1;                                          // Key of the response
+    int forceSample = 0;                                            // Force samples fed to the convolver
+
+    /// Overload fallback
+    NoteCache::Client* noteCache = nullptr;                         // Cache of pre-rendered notes
+    NoteCache::Player cachePlayer;                                  // Cached note being played
+    VoiceBudget* budget = nullptr;                                  // Budget shared by all voices
+    int cacheSeed = 0;                                              // Detune seed of the next cached note
+
+    /// Shared tables
+    std::atomic<const KeyTable*>* keyTable = nullptr;               // Geometry of every key for the current preset
+    std::atomic<const ForceTable*>* forceTable = nullptr;           // Force signals for the current sample rate
+
     /// Variable Parameters
     std::atomic<float>* T60time;                                    // T60 time
     std::atomic<float>* gain;                                       // Gain
@@ -265,6 +734,8 @@ private:
     // Excitation properties
     std::atomic<float>* xi;                                         // Coordinate of excitation
     std::atomic<float>* xo;                                         // Coordinate of output
+    std::atomic<float>* spread = nullptr;                           // Spread of the pickups around xo
+    int numPickups = 1;                                             // Number of pickups (output channels)
 
 
     // Physical properties
@@ -282,3 +753,614 @@ private:
     std::atomic<float>* release;
 
 };
+
+
+// =================================
+// =================================
+// Synthesiser
+
+/*!
+ @class PianoSynthesiser
+ @abstract voice manager which renders its SynthVoices in parallel on a WorkerPool
+ @discussion the MIDI of a block is dispatched in one pass before anything is rendered : each event becomes a start or a stop
+             at its sample on the voice it concerns, found through a key to voice map, or taken from the free list (stealing
+             the voice which is least audible for the CPU it takes when none is free). Each active voice then renders the whole
+             block as one job on the pool, split only at its own events, so that timing stays sample accurate and a chord costs
+             one dispatch instead of one per note. The voices render into their own buffers, which are then summed into the output
+
+ */
+class PianoSynthesiser
+{
+public:
+    static constexpr int maxEventsPerVoice = 32;                    // Events of one voice per pass, more split the block (a MIDI event adds at most two)
+    static constexpr int numChannels = 16;                          // MIDI channels
+
+    /* Adds a voice, owned by the synthesiser (before prepare())*/
+    SynthVoice* addVoice(SynthVoice* voice)
+    {
+        voice->setCurrentPlaybackSampleRate(sampleRate);
+        return voices.add(voice);
+    }
+
+    int getNumVoices() const
+    {
+        return voices.size();
+    }
+
+    SynthVoice* getVoice(int index) const
+    {
+        return voices[index];
+    }
+
+    /* Sets the sample rate of every voice, stopping them*/
+    void setCurrentPlaybackSampleRate(double newRate)
+    {
+        sampleRate = newRate;
+        for (auto* v : voices) {
+            if (v->isVoiceActive()) {
+                v->stopNote(0.0f, false);
+            }
+            v->setCurrentPlaybackSampleRate(newRate);
+        }
+        resetDispatch();
+    }
+
+    double getSampleRate() const
+    {
+        return sampleRate;
+    }
+
+    /* Sets the worker pool and allocates a buffer per voice (call after adding the voices)*/
+    void prepare(WorkerPool* pool, int samplesPerBlock, int numOutputChannels)
+    {
+        workerPool = pool;
+        voiceBuffers.clear();
+        for (int i = 0; i < voices.size(); i++) {
+            voiceBuffers.add(new juce::AudioBuffer<float>(numOutputChannels, samplesPerBlock));
+        }
+        activeVoices.ensureStorageAllocated(voices.size());
+        slots.assign(size_t(voices.size()), Slot());
+        freeVoices.ensureStorageAllocated(voices.size());
+        renderedInBlock.assign(size_t(voices.size()), false);
+
+        bridge.setSize(1, samplesPerBlock);
+        resonanceOutput.setSize(1, samplesPerBlock);
+        resonance.prepare(getSampleRate());
+        notesStarted = 0;
+        resetDispatch();
+    }
+
+    /* Asks for the offline or real-time quality profile, applied by the rendering thread before its next block (any thread)*/
+    void setOffline(bool offline)
+    {
+        offlineRequested = offline;
+    }
+
+    /* Sets the level of the sympathetic resonance and the key table it is tuned to (optional, without them there is none)*/
+    void setResonancePointers(std::atomic<float>* levelIn, std::atomic<const KeyTable*>* keyTableIn)
+    {
+        resonanceLevel = levelIn;
+        keyTable = keyTableIn;
+    }
+
+    /* Sets the buffer the state of the voices is published to while an editor wants it (optional)*/
+    void setSnapshotBuffer(SnapshotBuffer* buffer)
+    {
+        snapshots = buffer;
+    }
+
+    /* Sets the engine profile of this machine, applied with the quality profile (optional, see EngineTuner)*/
+    void setEngineProfile(std::atomic<const EngineProfile*>* profileIn)
+    {
+        engineProfile = profileIn;
+    }
+
+    /* Renders each voice into its own buffer from offset on, instead of summing into the output (nullptr to sum again)*/
+    void setVoiceTargets(juce::OwnedArray<juce::AudioBuffer<float>>* targets, int offset)
+    {
+        voiceTargets = targets;
+        targetOffset = offset;
+    }
+
+    /* Adds numSamples of every voice to outputAudio from startSample on, playing the MIDI events of the block at their sample*/
+    void renderNextBlock(juce::AudioBuffer<float>& outputAudio, const juce::MidiBuffer& midi, int startSample, int numSamples)
+    {
+        int profile = offlineRequested.load() ? 1 : 0;
+        const EngineProfile* engine = engineProfile != nullptr ? engineProfile->load() : nullptr;
+        if (profile != appliedProfile || engine != appliedEngine) {
+            const EngineProfile tuning = engine != nullptr ? *engine : EngineProfile();
+            setQuality(profile == 1 ? QualityProfile::offline(tuning) : QualityProfile::realtime(tuning));
+            appliedProfile = profile;
+            appliedEngine = engine;
+        }
+        if (levelOfDetail) {
+            updateDetail();
+        }
+        if (voices.isEmpty() || slots.size() != size_t(voices.size())) {
+            blocksRendered++;
+            return;                                                 // Not prepared
+        }
+        std::fill(renderedInBlock.begin(), renderedInBlock.end(), false);
+
+        // Dispatch the events of a pass, then render it, a pass ending early only if a voice has no room for more events
+        const int end = startSample + numSamples;
+        auto event = midi.findNextSamplePosition(startSample);
+        int position = startSample;
+        while (position < end) {
+            freeFinishedVoices();
+            int passEnd = end;
+            for (; event != midi.cend(); ++event) {
+                const auto metadata = *event;
+                if (metadata.samplePosition >= end) {
+                    break;
+                }
+                const int time = juce::jmax(metadata.samplePosition, position);
+                if (fullSlots > 0) {
+                    passEnd = time;
+                    break;
+                }
+                handleMidiEvent(metadata.getMessage(), time);
+            }
+            renderPass(outputAudio, position, passEnd - position);
+            position = passEnd;
+        }
+
+        renderResonance(outputAudio, startSample, numSamples);
+        publishSnapshot(numSamples);
+        blocksRendered++;
+    }
+
+    /* Number of renderNextBlock() calls completed, by whichever thread renders (any thread)*/
+    juce::uint32 getBlocksRendered() const
+    {
+        return blocksRendered.load();
+    }
+
+private:
+    //--------------------------------------------------------------------------
+    /* Start or stop of a voice at a sample of the block*/
+    struct VoiceEvent
+    {
+        int time;                                                   // Sample in the output buffer
+        int key;
+        float velocity;
+        juce::int64 seed;                                           // Detune seed of a start
+        bool start;                                                 // Start, otherwise stop
+        bool allowTailOff;                                          // Stop with the release of the envelope
+    };
+
+    /* Dispatch state of a voice*/
+    struct Slot
+    {
+        int channel = 0;                                            // MIDI channel (0-15) of the last note
+        int key = -1;                                               // Key of the last note, -1 once the voice is free
+        bool keyDown = false;                                       // Key still held
+        bool sustained = false;                                     // Released while the sustain pedal was down
+        bool free = false;                                          // In freeVoices
+        juce::uint32 order = 0;                                     // Note on count when the note started
+        int numEvents = 0;                                          // Events of the current pass
+        VoiceEvent events[maxEventsPerVoice];
+    };
+
+    /* Frees every voice and forgets every key*/
+    void resetDispatch()
+    {
+        for (auto& row : keyVoice) {
+            std::fill(std::begin(row), std::end(row), -1);
+        }
+        std::fill(std::begin(channelSustain), std::end(channelSustain), false);
+        sustainDown = false;
+        fullSlots = 0;
+        freeVoices.clearQuick();
+        for (int i = 0; i < int(slots.size()); i++) {
+            slots[size_t(i)] = Slot();
+            slots[size_t(i)].free = true;
+            freeVoices.add(i);
+        }
+    }
+
+    /* Returns the voices which ended by themselves (release over, refused or quarantined) to the free list*/
+    void freeFinishedVoices()
+    {
+        for (int i = 0; i < voices.size(); i++) {
+            Slot& slot = slots[size_t(i)];
+            if (!slot.free && slot.numEvents == 0 && !voices.getUnchecked(i)->isVoiceActive()) {
+                unmap(i);
+                slot.key = -1;
+                slot.keyDown = slot.sustained = false;
+                slot.free = true;
+                freeVoices.add(i);
+            }
+        }
+    }
+
+    void handleMidiEvent(const juce::MidiMessage& message, int time)
+    {
+        const int channel = juce::jlimit(1, numChannels, message.getChannel()) - 1;
+        if (message.isNoteOn()) {
+            noteOn(channel, message.getNoteNumber(), message.getFloatVelocity(), time);
+        }
+        else if (message.isNoteOff()) {
+            noteOff(channel, message.getNoteNumber(), message.getFloatVelocity(), time);
+        }
+        else if (message.isAllNotesOff() || message.isAllSoundOff()) {
+            allNotesOff(channel, time, !message.isAllSoundOff());
+        }
+        else if (message.isSustainPedalOn() || message.isSustainPedalOff()) {
+            sustainPedal(channel, message.isSustainPedalOn(), time);
+        }
+    }
+
+    void noteOn(int channel, int key, float velocity, int time)
+    {
+        // The key is already sounding : a convolved key is re-struck on its voice so that the responses add, others are released
+        int index = keyVoice[channel][key];
+        if (index >= 0) {
+            if (slots[size_t(index)].numEvents == 0 && voices.getUnchecked(index)->isConvolving(key)) {
+                Slot& slot = slots[size_t(index)];
+                slot.keyDown = true;
+                slot.sustained = false;
+                addEvent(index, { time, key, velocity, juce::int64(++notesStarted), true, false });
+                return;
+            }
+            unmap(index);
+            addEvent(index, { time, key, 1.0f, 0, false, true });
+        }
+
+        index = freeVoices.isEmpty() ? chooseVoiceToSteal() : freeVoices.removeAndReturn(freeVoices.size() - 1);
+        unmap(index);
+        Slot& slot = slots[size_t(index)];
+        slot.channel = channel;
+        slot.key = key;
+        slot.keyDown = true;
+        slot.sustained = false;
+        slot.free = false;
+        slot.order = ++notesStarted;
+        keyVoice[channel][key] = index;
+        addEvent(index, { time, key, velocity, juce::int64(slot.order), true, false });
+    }
+
+    void noteOff(int channel, int key, float velocity, int time)
+    {
+        const int index = keyVoice[channel][key];
+        if (index < 0) {
+            return;
+        }
+        Slot& slot = slots[size_t(index)];
+        slot.keyDown = false;
+        if (channelSustain[channel]) {
+            slot.sustained = true;                                  // Stopped when the pedal goes up
+            return;
+        }
+        unmap(index);
+        addEvent(index, { time, key, velocity, 0, false, true });
+    }
+
+    void sustainPedal(int channel, bool isDown, int time)
+    {
+        // The dampers of the whole piano follow the last pedal event, whichever channel it comes from
+        channelSustain[channel] = isDown;
+        sustainDown = isDown;
+        if (isDown) {
+            return;
+        }
+        for (int i = 0; i < int(slots.size()); i++) {
+            Slot& slot = slots[size_t(i)];
+            if (slot.channel == channel && slot.sustained && !slot.keyDown) {
+                slot.sustained = false;
+                unmap(i);
+                addEvent(i, { time, slot.key, 0.0f, 0, false, true });
+            }
+        }
+    }
+
+    /* Releases every voice of a channel, or cuts them without their tail if allowTailOff is false (All Sound Off)*/
+    void allNotesOff(int channel, int time, bool allowTailOff)
+    {
+        channelSustain[channel] = false;
+        for (int i = 0; i < int(slots.size()); i++) {
+            Slot& slot = slots[size_t(i)];
+            if (slot.channel == channel && slot.key >= 0 && !slot.free) {
+                slot.keyDown = slot.sustained = false;
+                unmap(i);
+                addEvent(i, { time, slot.key, 0.0f, 0, false, allowTailOff });
+            }
+        }
+    }
+
+    /* Voice to steal when none is free : released voices before held ones, then the least audible for the CPU it takes,
+       then the oldest. Voices started in the current pass go last*/
+    int chooseVoiceToSteal()
+    {
+        int best = -1;
+        float bestScore = 0.0f;
+        int bestRank = 0;
+        for (int i = 0; i < voices.size(); i++) {
+            const Slot& slot = slots[size_t(i)];
+            const SynthVoice* v = voices.getUnchecked(i);
+            bool starting = slot.numEvents > 0 && slot.events[slot.numEvents - 1].start;
+            int rank = (starting ? 2 : 0) + (slot.keyDown || slot.sustained ? 1 : 0);
+            float score = (v->getLoudness() + 1e-6f) / (v->getRenderLoad() + 0.01f);
+            if (best < 0 || rank < bestRank || (rank == bestRank && (score < bestScore
+                || (score == bestScore && slot.order < slots[size_t(best)].order)))) {
+                best = i;
+                bestRank = rank;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    /* Removes a voice from the key map if its key points to it*/
+    void unmap(int index)
+    {
+        const Slot& slot = slots[size_t(index)];
+        if (slot.key >= 0 && keyVoice[slot.channel][slot.key] == index) {
+            keyVoice[slot.channel][slot.key] = -1;
+        }
+    }
+
+    void addEvent(int index, const VoiceEvent& event)
+    {
+        Slot& slot = slots[size_t(index)];
+        slot.events[slot.numEvents++] = event;
+        if (slot.numEvents == maxEventsPerVoice - 1) {
+            fullSlots++;                                            // Room for one more MIDI event at most
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    /* Renders the voices with events or sound over [position, position + numSamples) of the output*/
+    void renderPass(juce::AudioBuffer<float>& outputAudio, int position, int numSamples)
+    {
+        activeVoices.clearQuick();
+        for (int i = 0; i < voices.size(); i++) {
+            if (slots[size_t(i)].numEvents > 0 || voices.getUnchecked(i)->isVoiceActive()) {
+                activeVoices.add(i);
+                renderedInBlock[size_t(i)] = true;
+            }
+        }
+        passStart = position;
+        numSamplesToRender = numSamples;
+
+        // Voices add into their own targets, which are cleared by the caller
+        if (voiceTargets != nullptr) {
+            renderTargets = voiceTargets;
+            renderStart = targetOffset + position;
+            clearTargets = false;
+            runVoices(activeVoices.size() > 1);
+        }
+        // Serially into the output when there is nothing to share, or the block is larger than prepared for
+        else if (workerPool == nullptr || activeVoices.size() < 2 || voiceBuffers.size() != voices.size()
+            || numSamples > voiceBuffers[0]->getNumSamples() || outputAudio.getNumChannels() > voiceBuffers[0]->getNumChannels()) {
+            renderTargets = nullptr;
+            renderOutput = &outputAudio;
+            renderStart = position;
+            clearTargets = false;
+            runVoices(false);
+        }
+        else {
+            renderTargets = &voiceBuffers;
+            renderStart = 0;
+            clearTargets = true;
+            runVoices(true);
+
+            // Sum the voices into the output
+            for (int v : activeVoices) {
+                for (int chan = 0; chan < outputAudio.getNumChannels(); chan++) {
+                    outputAudio.addFrom(chan, position, *voiceBuffers.getUnchecked(v), chan, 0, numSamples);
+                }
+            }
+        }
+
+        for (int v : activeVoices) {
+            slots[size_t(v)].numEvents = 0;
+        }
+        fullSlots = 0;
+    }
+
+    /* Renders the active voices, on the pool if parallel*/
+    void runVoices(bool parallel)
+    {
+        if (parallel && workerPool != nullptr) {
+            workerPool->run(&renderVoice, this, activeVoices.size(), getMaxHelpers());
+        }
+        else {
+            for (int i = 0; i < activeVoices.size(); i++) {
+                renderVoice(this, i);
+            }
+        }
+    }
+
+    /* Renders one active voice over the pass, applying its events at their sample (called from the pool)*/
+    static void renderVoice(void* context, int index)
+    {
+        auto* synth = static_cast<PianoSynthesiser*>(context);
+        const int v = synth->activeVoices.getUnchecked(index);
+        SynthVoice* voice = synth->voices.getUnchecked(v);
+        const Slot& slot = synth->slots[size_t(v)];
+        auto& buffer = synth->renderTargets != nullptr ? *synth->renderTargets->getUnchecked(v) : *synth->renderOutput;
+        const int numSamples = synth->numSamplesToRender;
+
+        if (synth->clearTargets) {
+            buffer.clear(synth->renderStart, numSamples);
+        }
+        int done = 0;
+        for (int e = 0; e < slot.numEvents; e++) {
+            const VoiceEvent& event = slot.events[e];
+            const int time = event.time - synth->passStart;
+            if (time > done && voice->isVoiceActive()) {
+                voice->renderNextBlock(buffer, synth->renderStart + done, time - done);
+            }
+            done = juce::jmax(done, time);
+            if (event.start) {
+                voice->startNote(event.key, event.velocity, event.seed);
+            }
+            else {
+                voice->stopNote(event.velocity, event.allowTailOff);
+            }
+        }
+        if (done < numSamples && voice->isVoiceActive()) {
+            voice->renderNextBlock(buffer, synth->renderStart + done, numSamples - done);
+        }
+    }
+
+    /* Adds the resonance of the undamped strings, driven by the voices rendered into the output or their targets*/
+    void renderResonance(juce::AudioBuffer<float>& outputAudio, int startSample, int numSamples)
+    {
+        const KeyTable* table = keyTable != nullptr ? keyTable->load() : nullptr;
+        float level = resonanceLevel != nullptr ? float(*resonanceLevel) : 0.0f;
+        if (table == nullptr || table->sampleRate != getSampleRate() || level <= 0.0f || numSamples > bridge.getNumSamples()) {
+            return;
+        }
+        resonance.setKeys(*table);
+
+        // Keys sounding through a voice are left to its strings
+        bool sounding[SympatheticResonance::numKeys] = {};
+        for (auto* v : voices) {
+            int key = v->getCurrentlyPlayingNote() - SympatheticResonance::firstKey;
+            if (v->isVoiceActive() && key >= 0 && key < SympatheticResonance::numKeys) {
+                sounding[key] = true;
+            }
+        }
+        resonance.setDampers(sustainDown, sounding);
+
+        // Bridge signal : the voices summed to mono, from the output or from each voice's target
+        juce::AudioBuffer<float>* target = nullptr;
+        int targetStart = startSample;
+        bridge.clear(0, numSamples);
+        if (voiceTargets != nullptr) {
+            targetStart = targetOffset + startSample;
+            for (int v = 0; v < voices.size(); v++) {
+                if (!renderedInBlock[size_t(v)]) {
+                    continue;
+                }
+                auto& voiceBuffer = *voiceTargets->getUnchecked(v);
+                for (int chan = 0; chan < voiceBuffer.getNumChannels(); chan++) {
+                    bridge.addFrom(0, 0, voiceBuffer, chan, targetStart, numSamples, 1.0f / voiceBuffer.getNumChannels());
+                }
+            }
+            if (voiceTargets->size() <= voices.size()) {
+                return;                                             // No target for the resonance
+            }
+            target = voiceTargets->getUnchecked(voices.size());
+        }
+        else {
+            for (int chan = 0; chan < outputAudio.getNumChannels(); chan++) {
+                bridge.addFrom(0, 0, outputAudio, chan, startSample, numSamples, 1.0f / outputAudio.getNumChannels());
+            }
+            target = &outputAudio;
+        }
+
+        resonanceOutput.clear(0, numSamples);
+        resonance.process(bridge.getReadPointer(0), resonanceOutput.getWritePointer(0), numSamples);
+        for (int chan = 0; chan < target->getNumChannels(); chan++) {
+            target->addFrom(chan, targetStart, resonanceOutput, 0, 0, numSamples, level);
+        }
+    }
+
+    /* Applies a quality profile to the voices and the share of the worker pool*/
+    void setQuality(const QualityProfile& quality)
+    {
+        levelOfDetail = quality.levelOfDetail;
+        threadShare = quality.threadShare;
+        maxHelpers = quality.maxHelpers;
+        for (auto* v : voices) {
+            v->setQuality(quality);
+        }
+    }
+
+    /* Workers of the pool which may help with a block, the rendering thread always helps*/
+    int getMaxHelpers() const
+    {
+        return juce::jmin(maxHelpers, juce::roundToInt(threadShare * float(workerPool->getNumThreads())));
+    }
+
+    /* Publishes the state of the voices, at most SnapshotBuffer::snapshotRate times per second*/
+    void publishSnapshot(int numSamples)
+    {
+        if (snapshots == nullptr || !snapshots->wanted.load()) {
+            return;
+        }
+        samplesSinceSnapshot += numSamples;
+        if (samplesSinceSnapshot < getSampleRate() / SnapshotBuffer::snapshotRate) {
+            return;
+        }
+        samplesSinceSnapshot = 0;
+
+        auto& snapshot = snapshots->getWriteBuffer();
+        snapshot.numVoices = juce::jmin(voices.size(), StateSnapshot::maxVoices);
+        for (int i = 0; i < snapshot.numVoices; i++) {
+            voices.getUnchecked(i)->fillSnapshot(snapshot.voices[i]);
+        }
+        snapshots->publish();
+    }
+
+    /* Level of detail : voices far below the mix switch to their modal tail, and back once they are close to it again*/
+    void updateDetail()
+    {
+        float mixPower = 0.0f;
+        for (auto* v : voices) {
+            if (v->isVoiceActive()) {
+                mixPower += juce::square(v->getLoudness());
+            }
+        }
+        float mix = std::sqrt(mixPower);
+
+        for (auto* v : voices) {
+            if (!v->isVoiceActive()) {
+                continue;
+            }
+            float loudness = v->getLoudness();
+            if (!v->hasReducedDetail() && loudness < maskedBelow * mix) {
+                v->setReducedDetail(true);
+            }
+            else if (v->hasReducedDetail() && loudness > prominentAbove * mix) {
+                v->setReducedDetail(false);
+            }
+        }
+    }
+
+    juce::OwnedArray<SynthVoice> voices;                            // Voices, called directly
+    double sampleRate = 44100.0;                                    // Sample rate of the voices
+
+    /// Dispatch
+    std::vector<Slot> slots;                                        // Dispatch state of each voice
+    int keyVoice[numChannels][128];                                 // Voice playing each key of each channel, -1 if none
+    juce::Array<int> freeVoices;                                    // Voices without a note, taken from the end
+    bool channelSustain[numChannels] = {};                          // Sustain pedal of each channel
+    int fullSlots = 0;                                              // Voices with no room for another MIDI event in the pass
+    juce::uint32 notesStarted = 0;                                  // Note ons, which seed the detune of each note so that a session replays exactly
+
+    WorkerPool* workerPool = nullptr;                               // Pool shared by all instances
+    juce::OwnedArray<juce::AudioBuffer<float>> voiceBuffers;        // Output of each voice
+    juce::Array<int> activeVoices;                                  // Voices rendered in the current pass
+    std::vector<bool> renderedInBlock;                              // Voices rendered in any pass of the current block
+    static constexpr float maskedBelow = 0.03f;                     // Loudness relative to the mix below which a voice is masked (-30 dB)
+    static constexpr float prominentAbove = 0.1f;                   // Loudness relative to the mix above which it is restored (-20 dB)
+    std::atomic<bool> offlineRequested { false };                   // Profile asked for by setOffline()
+    int appliedProfile = -1;                                        // Profile applied to the voices (0 real time, 1 offline, -1 none yet)
+    bool levelOfDetail = true;                                      // Masked voices switch to their modal tail
+    float threadShare = 1.0f;                                       // Share of the worker pool used by a block
+    int maxHelpers = std::numeric_limits<int>::max();               // Workers past which a block renders no faster (EngineProfile)
+    std::atomic<const EngineProfile*>* engineProfile = nullptr;     // Profile of this machine, set by setEngineProfile()
+    const EngineProfile* appliedEngine = nullptr;                   // Engine profile applied to the voices
+    SnapshotBuffer* snapshots = nullptr;                            // Editor view of the voices
+    SympatheticResonance resonance;                                 // Undamped strings while the pedal is down
+    std::atomic<float>* resonanceLevel = nullptr;                   // Output level of the resonance
+    std::atomic<const KeyTable*>* keyTable = nullptr;               // Geometry of the keys the resonance is tuned to
+    juce::AudioBuffer<float> bridge;                                // Voices summed to mono
+    juce::AudioBuffer<float> resonanceOutput;                       // Output of the resonance
+    bool sustainDown = false;                                       // Sustain pedal (CC64) state
+    int samplesSinceSnapshot = 0;                                   // Samples rendered since the last snapshot
+    juce::OwnedArray<juce::AudioBuffer<float>>* voiceTargets = nullptr; // Per-voice outputs set by setVoiceTargets()
+    int targetOffset = 0;                                           // Position of the block in the targets
+    std::atomic<juce::uint32> blocksRendered { 0 };                 // Completed renderNextBlock() calls
+
+    juce::OwnedArray<juce::AudioBuffer<float>>* renderTargets = nullptr;   // Buffers of the current pass, nullptr for renderOutput
+    juce::AudioBuffer<float>* renderOutput = nullptr;               // Output the voices add into when rendered serially
+    int renderStart = 0;                                            // Start of the current pass in renderTargets
+    int passStart = 0;                                              // Start of the current pass in the output
+    int numSamplesToRender = 0;                                     // Length of the current pass
+    bool clearTargets = false;                                      // Clear each buffer before rendering
+};
@@ -0,0 +1,277 @@
+/*
+==============================================================================
+
+WaveguideString.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "WaveguideString.h"
+#include <complex>
+
+namespace {
+	/* Phase delay in samples of the allpass (a + z^-1) / (1 + a z^-1) at w radians per sample*/
+	double allpassDelay(double a, double w) {
+		std::complex<double> z1 = std::polar(1.0, -w);
+		return -std::arg((a + z1) / (1.0 + a * z1)) / w;
+	}
+}
+
+WaveguideString::~WaveguideString() {
+	delete[] line;
+}
+
+float WaveguideString::process() {
+	float output = 0.0f;
+	int count = numPickups;
+	numPickups = 1;
+	process(&output);
+	numPickups = count;
+	return output;
+}
+
+void WaveguideString::process(float* outputs) {
+	// Wave arriving back at the nut after a loop, through the loss, dispersion and fractional delay filters
+	float y = loopGain * line[(writeIndex - integerDelay) & mask];
+	for (int m = 0; m < numAllpasses; m++) {
+		float out = allpassCoeff * y + allpassState[m];
+		allpassState[m] = y - allpassCoeff * out;
+		y = out;
+	}
+	float out = fractionCoeff * y + fractionState;
+	fractionState = y - fractionCoeff * out;
+	line[writeIndex & mask] = out;
+	writeIndex++;
+
+	// The force enters both waves as displacement (the integral of its velocity), the left-going wave is stored inverted
+	forceIntegral += forceCoeff * force;
+	if (forceIntegral != 0.0f) {
+		// Same mapping as readPosition(), the oldest sample was read this step so the left tap stops before it
+		float half = 0.5f * float(integerDelay);
+		int right = int(xi * half + 0.5f);
+		int left = int(float(integerDelay) - xi * half + 0.5f);
+		left = left < integerDelay - 1 ? left : integerDelay - 1;
+		line[(writeIndex - 1 - right) & mask] += forceIntegral;
+		line[(writeIndex - 1 - left) & mask] -= forceIntegral;
+	}
+
+	for (int p = 0; p < numPickups; p++) {
+		outputs[p] += readPosition(pickupPosition[p]);
+	}
+	if (rampRemaining > 0) {
+		for (int p = 0; p < numPickups; p++) {
+			pickupPosition[p] += pickupStep[p];
+		}
+		rampRemaining--;
+	}
+}
+
+float WaveguideString::readAge(float age) {
+	// Linear interpolation, the delay line holds ages 0 to integerDelay
+	age = fmin(fmax(age, 0.0f), float(integerDelay - 1));
+	int a = int(age);
+	float f = age - float(a);
+	float y0 = line[(writeIndex - 1 - a) & mask];
+	float y1 = line[(writeIndex - 2 - a) & mask];
+	return y0 + f * (y1 - y0);
+}
+
+float WaveguideString::readPosition(float x) {
+	// The right-going wave reaches x after x of half the line, the left-going one after the rest of the line less as much.
+	// The filter delay (loopDelay - integerDelay) is not held in the line, so it is treated as spread along the string
+	float half = 0.5f * float(integerDelay);
+	return readAge(x * half) - readAge(float(integerDelay) - x * half);
+}
+
+void WaveguideString::setPickups(const float* positions, int count, bool ramp) {
+	numPickups = count < 1 ? 1 : (count > maxPickups ? maxPickups : count);
+	for (int p = 0; p < numPickups; p++) {
+		pickupStep[p] = ramp ? (positions[p] - pickupPosition[p]) / rampLength : 0.0f;
+		if (!ramp) {
+			pickupPosition[p] = positions[p];
+		}
+	}
+	rampRemaining = ramp ? rampLength : 0;
+}
+
+void WaveguideString::getShape(float* dest, int numPoints) {
+	for (int j = 0; j < numPoints; j++) {
+		dest[j] = readPosition(float(j) / float(numPoints - 1));
+	}
+}
+
+void WaveguideString::setsampleRate(float samprate) {
+	SR = samprate;
+}
+
+void WaveguideString::setForce(float f) {
+	force = f;
+}
+
+void WaveguideString::setExcCoordinates(float inCoordinate, float outCoordinate) {
+	xi = inCoordinate;
+	xo = outCoordinate;
+}
+
+void WaveguideString::setMaterial(float youngsModulus, float density) {
+	E = youngsModulus;
+	rho = density;
+}
+
+float WaveguideString::getInharmonicity(float youngsModulus, float density, float frequencyInHz, float lengthInMetres, float radiusInMetres) {
+	// Same tension as String::computeCoefficients()
+	double T = 4 * M_PI * density * pow(lengthInMetres, 2) * pow(frequencyInHz, 2) * pow(radiusInMetres, 2);
+	double I = 0.25 * M_PI * pow(radiusInMetres, 4);
+	return float(M_PI * M_PI * youngsModulus * I / (T * lengthInMetres * lengthInMetres));
+}
+
+void WaveguideString::setParameters(float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds) {
+	freq = frequencyInHz;
+	L = lengthInMetres;
+	r = radiusInMetres;
+	T60 = T60InSeconds;
+
+	// Partials of the stiff string below 0.45 SR, and the loop delay which puts each of them in tune
+	double B = getInharmonicity(E, rho, freq, L, r);
+	inharmonicity = float(B);
+	numPartials = 0;
+	for (int n = 1; n <= maxPartials; n++) {
+		double f = n * freq * sqrt(1.0 + B * n * n);
+		if (f >= 0.45 * SR && n > 1) {
+			break;
+		}
+		partialFrequency[numPartials] = f;
+		partialDelay[numPartials] = n * SR / f;
+		numPartials++;
+	}
+
+	// Fewest dispersion filters which keep the partials within a cent, otherwise the best fit
+	const int counts[] = { 0, 1, 2, 4, 8, maxAllpasses };
+	double bestError = 1e9;
+	for (int count : counts) {
+		double coefficient, fraction;
+		int delay;
+		double error = design(count, coefficient, delay, fraction);
+		if (error < bestError) {
+			bestError = error;
+			numAllpasses = count;
+			allpassCoeff = float(coefficient);
+			integerDelay = delay;
+			fractionCoeff = float(fraction);
+		}
+		if (error <= 1.0) {
+			break;
+		}
+	}
+	tuningErrorCents = float(bestError);
+
+	// Frequency independent loss, as sig in String
+	loopDelay = float(partialDelay[0]);
+	double sig = 6 * log(10) / T60;
+	loopGain = float(exp(-sig * loopDelay / SR));
+
+	// Velocity of each wave is F / (2 R) with R = rho A c, integrated over one sample
+	double A = M_PI * r * r;
+	double c = 2.0 * L * freq;
+	forceCoeff = float(1.0 / (SR * 2.0 * rho * A * c));
+}
+
+double WaveguideString::design(int count, double& coefficient, int& delay, double& fraction) {
+	if (count == 0) {
+		coefficient = 0.0;
+		return tuningError(0, 0.0, delay, fraction, true);
+	}
+
+	// Golden section search for the coefficient with the least squared error (negative coefficients delay low partials most)
+	const double ratio = 0.5 * (sqrt(5.0) - 1.0);
+	double lo = -0.98, hi = 0.0;
+	double x1 = hi - ratio * (hi - lo), x2 = lo + ratio * (hi - lo);
+	double e1 = tuningError(count, x1, delay, fraction, false);
+	double e2 = tuningError(count, x2, delay, fraction, false);
+	for (int i = 0; i < 30; i++) {
+		if (e1 < e2) {
+			hi = x2;
+			x2 = x1;
+			e2 = e1;
+			x1 = hi - ratio * (hi - lo);
+			e1 = tuningError(count, x1, delay, fraction, false);
+		}
+		else {
+			lo = x1;
+			x1 = x2;
+			e1 = e2;
+			x2 = lo + ratio * (hi - lo);
+			e2 = tuningError(count, x2, delay, fraction, false);
+		}
+	}
+	coefficient = 0.5 * (lo + hi);
+	return tuningError(count, coefficient, delay, fraction, true);
+}
+
+double WaveguideString::tuningError(int count, double coefficient, int& delay, double& fraction, bool worst) {
+	// The delay line and fractional delay make up what the dispersion filters leave of the fundamental's loop delay
+	double w1 = 2 * M_PI * partialFrequency[0] / SR;
+	double rest = partialDelay[0] - count * allpassDelay(coefficient, w1);
+	delay = rest - 0.5 > 2.0 ? int(floor(rest - 0.5)) : 2;
+	double d = rest - delay;
+	fraction = (1.0 - d) / (1.0 + d);
+
+	double error = 0.0;
+	for (int n = 0; n < numPartials; n++) {
+		double w = 2 * M_PI * partialFrequency[n] / SR;
+		double total = delay + allpassDelay(fraction, w) + count * allpassDelay(coefficient, w);
+		double cents = 1200.0 * log2(partialDelay[n] / total);
+		error = worst ? fmax(error, fabs(cents)) : error + cents * cents;
+	}
+	return error;
+}
+
+void WaveguideString::reserveGrid(int size) {
+	if (size <= capacity) {
+		return;
+	}
+	int newCapacity = 1;
+	while (newCapacity < size) {
+		newCapacity *= 2;
+	}
+	delete[] line;
+	line = new float[newCapacity] {0};
+	capacity = newCapacity;
+	mask = capacity - 1;
+}
+
+void WaveguideString::initGrid() {
+	reserveGrid(integerDelay + 2);
+	for (int i = 0; i < capacity; i++) {
+		line[i] = 0.0f;
+	}
+	for (int m = 0; m < maxAllpasses; m++) {
+		allpassState[m] = 0.0f;
+	}
+	fractionState = 0.0f;
+	forceIntegral = 0.0f;
+	writeIndex = 0;
+
+	// Single pickup at xo, until setPickups() is called
+	numPickups = 1;
+	pickupPosition[0] = xo;
+	rampRemaining = 0;
+}
+
+float WaveguideString::getTuningError() {
+	return tuningErrorCents;
+}
+
+int WaveguideString::getNumAllpasses() {
+	return numAllpasses;
+}
+
+float WaveguideString::getInharmonicity() {
+	return inharmonicity;
+}
+
+float WaveguideString::estimateCost(int count) {
+	// Read, loss and write, 4 per allpass, force taps and about 8 per pickup
+	return 16.0f + 4.0f * count;
+}
@@ -0,0 +1,148 @@
+/*
+  ==============================================================================
+
+	WaveguideString.h
+	Author:  Ruthu Prem Kumar
+
+	Digital waveguide string with the same interface as String, costing the
+	same per sample whatever the length of the string.
+
+	The travelling waves run around a single delay line loop (right-going
+	from the nut to the bridge, then inverted and left-going back), closed
+	by a loss gain, a cascade of first order allpass dispersion filters and
+	a first order allpass for the fractional part of the delay. The
+	displacement at a point is the sum of the two waves passing it.
+
+	setParameters() designs the filters from the same inputs as String :
+	the loss matches the frequency independent decay of the FDTD scheme,
+	and the dispersion filters are fitted to the partials of the stiff string
+	f_n = n f0 sqrt(1 + B n^2). getTuningError() tells how well they fit, so
+	that Note can fall back on String for stiff strings.
+
+	The filters hold part of the loop delay, a large part for stiff strings
+	with many dispersion filters. Positions along the string (excitation,
+	pickups and getShape()) are mapped onto the delay line alone, as if the
+	filter delay were spread evenly along the string, so that every position
+	reads or writes samples the line holds.
+
+  ==============================================================================
+*/
+
+#pragma once
+#include "String.h"
+
+class WaveguideString {
+
+public:
+
+	static constexpr int maxPickups = String::maxPickups;
+	static constexpr int maxAllpasses = 16;     // Most dispersion filters
+	static constexpr int maxPartials = 8;       // Lowest partials the dispersion filters are fitted to
+
+	/* Destructor*/
+	~WaveguideString();
+
+	/* Process returns the displacement at xo for each sample*/
+	float process();
+
+	/* Process adds the displacement at each pickup to outputs[0..numPickups-1]*/
+	void process(float* outputs);
+
+	/* Sets pickup positions (0-1), ramping from the current positions if ramp is true*/
+	void setPickups(const float* positions, int count, bool ramp);
+
+	/* Writes the displacement at numPoints evenly spaced points along the string, the fixed ends included*/
+	void getShape(float* dest, int numPoints);
+
+	/* Set sample rate*/
+	void setsampleRate(float samprate);
+
+	/* Set Force*/
+	void setForce(float f);
+
+	/* Sets Parameters of the string and designs its filters (set the material and sample rate first)*/
+	void setParameters(float frequencyInHz, float lengthInMetres, float radiusInMetres, float T60InSeconds);
+
+	/* Sets the coordinates for excitation and output (0-1)*/
+	void setExcCoordinates(float inCoordinate, float outCoordinate);
+
+	/* Sets the material properties of the string (SI units)*/
+	void setMaterial(float youngsModulus, float density);
+
+	/* Clears the delay line and filters, as String::initGrid()*/
+	void initGrid();
+
+	/* Allocates a delay line of at least size samples, so that initGrid() does not allocate*/
+	void reserveGrid(int size);
+
+	/* Worst tuning error of the fitted partials in cents, after setParameters()*/
+	float getTuningError();
+
+	/* Number of dispersion filters chosen by setParameters()*/
+	int getNumAllpasses();
+
+	/* Inharmonicity coefficient B of the string, after setParameters()*/
+	float getInharmonicity();
+
+	/* Operations per sample, comparable with the about 12 per grid point of String*/
+	static float estimateCost(int numAllpasses);
+
+	/* Inharmonicity coefficient B of a stiff string (SI units)*/
+	static float getInharmonicity(float youngsModulus, float density, float frequencyInHz, float lengthInMetres, float radiusInMetres);
+
+private:
+
+	/* Fits numAllpasses dispersion filters, returns the worst tuning error in cents*/
+	double design(int numAllpasses, double& coefficient, int& integerDelay, double& fractionCoefficient);
+
+	/* Tuning error in cents of every fitted partial for a dispersion coefficient, the fundamental tuned exactly*/
+	double tuningError(int numAllpasses, double coefficient, int& integerDelay, double& fractionCoefficient, bool worst);
+
+	/* Value of the delay line at a fractional age (samples since it left the nut)*/
+	float readAge(float age);
+
+	/* Displacement at a position (0-1), from the two waves at their ages along the delay line*/
+	float readPosition(float x);
+
+	// String parameters
+	float SR;                           // Sample Rate
+	float freq;                         // Frequency of note
+	float L;                            // Length of string
+	float r;                            // Radius of string
+	float T60;                          // T60 time
+	float rho;                          // Density
+	float E;                            // Young's Modulus
+	float xi;                           // Coordinate of excitation (0-1)
+	float xo;                           // Coordinate of output (0-1)
+	float force = 0.0f;                 // Force at current timestep (N)
+	float forceCoeff;                   // Wave displacement per Newton per sample
+	float forceIntegral = 0.0f;         // Displacement added to each wave at the excitation point
+
+	// Partials the filters are fitted to
+	int numPartials = 0;
+	double partialFrequency[maxPartials];
+	double partialDelay[maxPartials];   // Loop delay which puts each partial in tune (samples)
+
+	// Loop
+	float* line = nullptr;              // Delay line (circular)
+	int capacity = 0;                   // Allocated size, a power of two
+	int mask = 0;
+	int writeIndex = 0;
+	int integerDelay = 1;               // Delay line length of the loop
+	float loopDelay;                    // Total delay of the loop at the fundamental (samples)
+	float loopGain;                     // Loss per loop
+	int numAllpasses = 0;
+	float allpassCoeff;                 // Coefficient of the dispersion filters
+	float allpassState[maxAllpasses];
+	float fractionCoeff;                // Coefficient of the fractional delay allpass
+	float fractionState;
+	float tuningErrorCents = 0.0f;
+	float inharmonicity = 0.0f;         // B of the stiff string
+
+	// Pickups (positions 0-1)
+	int numPickups = 1;
+	float pickupPosition[maxPickups];   // Current position of each pickup
+	float pickupStep[maxPickups];       // Position increment per sample while ramping
+	int rampRemaining = 0;
+	const int rampLength = 256;         // Same as String
+};
@@ -0,0 +1,141 @@
+/*
+==============================================================================
+
+WorkerPool.cpp
+Author:  Ruthu Prem Kumar
+
+==============================================================================
+*/
+
+#include "WorkerPool.h"
+
+namespace {
+    thread_local bool workerThread = false;
+}
+
+WorkerPool::WorkerPool(int numThreads) {
+    for (int i = 0; i < numThreads; i++) {
+        workers.add(new Worker(*this));
+    }
+    for (auto* w : workers) {
+        w->startThread(9);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    for (auto* w : workers) {
+        w->signalThreadShouldExit();
+        w->wake.signal();
+    }
+    for (auto* w : workers) {
+        w->stopThread(1000);
+    }
+}
+
+int WorkerPool::getNumThreads() const {
+    return workers.size();
+}
+
+juce::uint32 WorkerPool::getNumJobs() const {
+    return numJobs.load(std::memory_order_relaxed);
+}
+
+bool WorkerPool::isWorkerThread() {
+    return workerThread;
+}
+
+void WorkerPool::run(Job job, void* context, int count, int maxHelpers) {
+    if (count <= 0) {
+        return;
+    }
+    numJobs.fetch_add(1, std::memory_order_relaxed);
+
+    // Claim a free slot, or run everything here if too many jobs are running
+    Slot* slot = nullptr;
+    for (auto& s : slots) {
+        int expected = 0;
+        if (s.state.compare_exchange_strong(expected, 1)) {
+            slot = &s;
+            break;
+        }
+    }
+    if (slot == nullptr || count == 1 || workers.isEmpty() || maxHelpers <= 0) {
+        if (slot != nullptr) {
+            slot->state = 0;
+        }
+        for (int i = 0; i < count; i++) {
+            job(context, i);
+        }
+        return;
+    }
+
+    slot->job = job;
+    slot->context = context;
+    slot->count = count;
+    slot->maxUsers = maxHelpers;
+    slot->next = 0;
+    slot->done = 0;
+    slot->state.store(2, std::memory_order_release);
+
+    // Wake as many workers as there are items left for them
+    for (int i = 0; i < juce::jmin(count - 1, workers.size(), maxHelpers); i++) {
+        workers[i]->wake.signal();
+    }
+
+    // Help, then wait for the items picked up by the workers
+    help(*slot);
+    while (slot->done.load(std::memory_order_acquire) < count) {
+        juce::Thread::yield();
+    }
+
+    // Retire the slot once no worker is looking at it
+    slot->state = 1;
+    while (slot->users.load() > 0) {
+        juce::Thread::yield();
+    }
+    slot->state = 0;
+}
+
+void WorkerPool::help(Slot& slot) {
+    for (;;) {
+        int i = slot.next++;
+        if (i >= slot.count) {
+            return;
+        }
+        slot.job(slot.context, i);
+        slot.done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+bool WorkerPool::helpAny() {
+    bool found = false;
+    for (auto& s : slots) {
+        if (s.state.load(std::memory_order_acquire) != 2) {
+            continue;
+        }
+        // Register before checking again, so that the slot cannot be retired in between
+        int users = ++s.users;
+        if (s.state.load(std::memory_order_acquire) == 2 && s.next.load() < s.count && users <= s.maxUsers) {
+            help(s);
+            found = true;
+        }
+        s.users--;
+    }
+    return found;
+}
+
+void WorkerPool::Worker::run() {
+    workerThread = true;
+    // Voices rendered here decay towards denormals like on the audio thread, whose flag is per thread
+    juce::ScopedNoDenormals noDenormals;
+    while (!threadShouldExit()) {
+        // Spin briefly after a job, as the next block usually follows soon
+        bool found = false;
+        for (int spin = 0; spin < 2000 && !found && !threadShouldExit(); spin++) {
+            found = pool.helpAny();
+        }
+        if (!found) {
+            wake.wait(100);
+        }
+    }
+}
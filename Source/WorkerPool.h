@@ -0,0 +1,80 @@
+/*
+  ==============================================================================
+
+    WorkerPool.h
+    Author:  Ruthu Prem Kumar
+
+    Pool of real-time worker threads which can be shared by any number of
+    plugin instances (see SharedResources.h).
+
+    run() splits a job into count items which are picked up by the workers
+    and by the calling thread itself, and returns once every item is done.
+    The calling thread always helps, so a job completes even if all workers
+    are busy with jobs from other instances. No memory is allocated and no
+    lock is taken by run().
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+class WorkerPool {
+public:
+
+    /* Function called for each item of a job*/
+    using Job = void (*)(void* context, int index);
+
+    WorkerPool(int numThreads);
+    ~WorkerPool();
+
+    /* Calls job(context, i) for every i in [0, count) and waits for all of them, with at most maxHelpers workers helping*/
+    void run(Job job, void* context, int count, int maxHelpers = std::numeric_limits<int>::max());
+
+    /* Returns the number of worker threads (not counting callers)*/
+    int getNumThreads() const;
+
+    /* Number of jobs run so far, which tells whether the pool is in use (any thread)*/
+    juce::uint32 getNumJobs() const;
+
+    /* True on the threads of any WorkerPool, which must not block or allocate*/
+    static bool isWorkerThread();
+
+private:
+
+    /* A job being run, slots are owned by the pool so that workers never see freed memory*/
+    struct Slot {
+        std::atomic<int> state { 0 };               // 0 free, 1 being set up or retired, 2 running
+        std::atomic<int> users { 0 };               // Workers currently looking at the slot
+        std::atomic<int> next { 0 };                // Next item to pick up
+        std::atomic<int> done { 0 };                // Number of items finished
+        int maxUsers = 0;                           // Most workers helping with the job
+        Job job = nullptr;
+        void* context = nullptr;
+        int count = 0;
+    };
+
+    class Worker : public juce::Thread {
+    public:
+        Worker(WorkerPool& p) : juce::Thread("AnyPiano worker"), pool(p) {}
+        void run() override;
+        juce::WaitableEvent wake;                   // Signalled when a job is submitted
+
+    private:
+        WorkerPool& pool;
+    };
+
+    /* Runs items of any running job, returns false if there was nothing to do*/
+    bool helpAny();
+
+    /* Runs items of one slot until none are left*/
+    static void help(Slot& slot);
+
+    static constexpr int numSlots = 64;             // Jobs that can run at once
+    Slot slots[numSlots];
+    std::atomic<juce::uint32> numJobs { 0 };        // Jobs run so far
+    juce::OwnedArray<Worker> workers;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(WorkerPool)
+};
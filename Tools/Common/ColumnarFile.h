@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    ColumnarFile.h
+    Author:  Ruthu Prem Kumar
+
+    Minimal column-major table writer used by the command line tools.
+
+    Layout (little endian) :
+        "APCOL1\0\0"                  8 byte magic
+        int32 numRows, int32 numColumns
+        numColumns x (int32 length, UTF-8 name)
+        numColumns x (numRows x float64)
+
+    Each column is contiguous, so a single column can be read (e.g. with
+    numpy.fromfile and an offset) without parsing the others.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <deque>
+
+class ColumnarFile {
+public:
+
+    /* Adds a column, all columns must end up with the same number of rows*/
+    std::vector<double>& addColumn(const juce::String& name) {
+        names.add(name);
+        columns.emplace_back();
+        return columns.back();
+    }
+
+    /* Returns a column added earlier*/
+    std::vector<double>& getColumn(const juce::String& name) {
+        return columns[size_t(names.indexOf(name))];
+    }
+
+    /* Writes the table, returns false on failure*/
+    bool write(const juce::File& file) const {
+        size_t numRows = columns.empty() ? 0 : columns.front().size();
+        for (auto& c : columns) {
+            jassert(c.size() == numRows);
+            if (c.size() != numRows) {
+                return false;
+            }
+        }
+
+        file.deleteFile();
+        juce::FileOutputStream out(file);
+        if (out.failedToOpen()) {
+            return false;
+        }
+
+        out.write("APCOL1\0\0", 8);
+        out.writeInt(int(numRows));
+        out.writeInt(int(columns.size()));
+        for (auto& name : names) {
+            auto utf8 = name.toUTF8();
+            int length = int(utf8.sizeInBytes()) - 1;
+            out.writeInt(length);
+            out.write(utf8.getAddress(), size_t(length));
+        }
+        for (auto& c : columns) {
+            for (double value : c) {
+                out.writeDouble(value);
+            }
+        }
+        out.flush();
+        return out.getStatus().wasOk();
+    }
+
+private:
+    juce::StringArray names;                        // Column names
+    std::deque<std::vector<double>> columns;        // Column values (references stay valid as columns are added)
+};
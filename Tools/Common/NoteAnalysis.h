@@ -0,0 +1,153 @@
+/*
+  ==============================================================================
+
+    NoteAnalysis.h
+    Author:  Ruthu Prem Kumar
+
+    Measurements on a rendered note, shared by the command line tools.
+
+    analyseNote() returns the measured fundamental (first partial), the
+    inharmonicity coefficient B fitted from the partials
+    (f_n = n f0 sqrt(1 + B n^2)), the T60 fitted on the decay of the RMS
+    envelope and the peak amplitude.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+struct NoteAnalysis {
+    float fundamental = 0.0f;                       // Frequency of the first partial (Hz)
+    float inharmonicity = 0.0f;                     // Inharmonicity coefficient B
+    float t60 = 0.0f;                               // Measured T60 (s), 0 if the note does not decay
+    float peak = 0.0f;                              // Peak absolute amplitude
+};
+
+namespace NoteAnalysisHelpers {
+
+    /* Interpolated frequency of the largest spectrum peak between two bins, 0 if too quiet*/
+    inline float findPeak(const std::vector<float>& magnitude, int lo, int hi, float binWidth, float floor) {
+        lo = juce::jmax(1, lo);
+        hi = juce::jmin(int(magnitude.size()) - 2, hi);
+        int best = -1;
+        for (int i = lo; i <= hi; i++) {
+            if (magnitude[i] > floor && (best < 0 || magnitude[i] > magnitude[best])) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            return 0.0f;
+        }
+
+        // Parabolic interpolation on the log magnitude
+        float a = std::log(magnitude[best - 1] + 1e-12f);
+        float b = std::log(magnitude[best] + 1e-12f);
+        float c = std::log(magnitude[best + 1] + 1e-12f);
+        float d = a - 2.0f * b + c;
+        float offset = d != 0.0f ? 0.5f * (a - c) / d : 0.0f;
+        return (best + offset) * binWidth;
+    }
+}
+
+/* Analyses numSamples of a note (without its release) starting at its onset*/
+inline NoteAnalysis analyseNote(const float* samples, int numSamples, double sampleRate, float expectedFundamental) {
+    using namespace NoteAnalysisHelpers;
+    NoteAnalysis result;
+
+    for (int i = 0; i < numSamples; i++) {
+        result.peak = juce::jmax(result.peak, std::abs(samples[i]));
+    }
+    if (result.peak <= 0.0f || numSamples <= 0) {
+        return result;
+    }
+
+    // Spectrum of a Hann windowed segment after the attack
+    const int order = 15;
+    const int fftSize = 1 << order;
+    const int start = juce::jmin(int(0.1 * sampleRate), juce::jmax(0, numSamples - fftSize));
+    std::vector<float> data(2 * fftSize, 0.0f);
+    for (int i = 0; i < fftSize && start + i < numSamples; i++) {
+        data[i] = samples[start + i] * 0.5f * (1.0f - std::cos(2.0f * juce::MathConstants<float>::pi * i / fftSize));
+    }
+    juce::dsp::FFT fft(order);
+    fft.performFrequencyOnlyForwardTransform(data.data());
+    std::vector<float> magnitude(data.begin(), data.begin() + fftSize / 2);
+    const float binWidth = float(sampleRate / fftSize);
+    const float floor = *std::max_element(magnitude.begin(), magnitude.end()) * 1e-3f;
+
+    // First partial near the expected fundamental
+    float f1 = findPeak(magnitude, int(0.5f * expectedFundamental / binWidth), int(1.5f * expectedFundamental / binWidth), binWidth, floor);
+    if (f1 > 0.0f) {
+        // Follow the partials upwards, predicting each from the current fit
+        float sumX = 0.0f, sumY = 0.0f, sumXX = 0.0f, sumXY = 0.0f;
+        int count = 0;
+        float B = 0.0f;
+        float f0 = f1;
+        for (int n = 1; n <= 12; n++) {
+            float predicted = n * f0 * std::sqrt(1.0f + B * n * n);
+            if (predicted + 0.3f * f1 >= 0.5f * sampleRate) {
+                break;
+            }
+            float fn = findPeak(magnitude, int((predicted - 0.3f * f1) / binWidth), int((predicted + 0.3f * f1) / binWidth), binWidth, floor);
+            if (fn <= 0.0f) {
+                continue;
+            }
+
+            // Least squares fit of f_n^2 / n^2 = f0^2 + f0^2 B n^2
+            float x = float(n * n);
+            float y = fn * fn / x;
+            sumX += x;
+            sumY += y;
+            sumXX += x * x;
+            sumXY += x * y;
+            count++;
+            if (count >= 2) {
+                float slope = (count * sumXY - sumX * sumY) / (count * sumXX - sumX * sumX);
+                float intercept = (sumY - slope * sumX) / count;
+                if (intercept > 0.0f) {
+                    f0 = std::sqrt(intercept);
+                    B = juce::jmax(0.0f, slope / intercept);
+                }
+            }
+        }
+        result.fundamental = f1;
+        result.inharmonicity = B;
+    }
+
+    // T60 from the slope of the RMS envelope (10 ms frames), from the peak down to -40 dB
+    const int frameLength = juce::jmax(1, int(0.01 * sampleRate));
+    std::vector<float> levels;
+    for (int f = 0; (f + 1) * frameLength <= numSamples; f++) {
+        double sum = 0.0;
+        for (int i = 0; i < frameLength; i++) {
+            sum += double(samples[f * frameLength + i]) * samples[f * frameLength + i];
+        }
+        levels.push_back(float(10.0 * std::log10(sum / frameLength + 1e-20)));
+    }
+    if (levels.size() > 10) {
+        int first = int(std::max_element(levels.begin(), levels.end()) - levels.begin()) + 10;
+        int last = first;
+        while (last + 1 < int(levels.size()) && levels[last + 1] > levels[first - 10] - 40.0f) {
+            last++;
+        }
+        if (last - first >= 5) {
+            double sumT = 0.0, sumL = 0.0, sumTT = 0.0, sumTL = 0.0;
+            int n = last - first + 1;
+            for (int f = first; f <= last; f++) {
+                double t = f * 0.01;
+                sumT += t;
+                sumL += levels[f];
+                sumTT += t * t;
+                sumTL += t * levels[f];
+            }
+            double slope = (n * sumTL - sumT * sumL) / (n * sumTT - sumT * sumT);
+            if (slope < 0.0) {
+                result.t60 = float(-60.0 / slope);
+            }
+        }
+    }
+
+    return result;
+}
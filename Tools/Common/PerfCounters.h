@@ -0,0 +1,145 @@
+/*
+  ==============================================================================
+
+    PerfCounters.h
+    Author:  Ruthu Prem Kumar
+
+    Hardware performance counters of the calling thread (Linux, through
+    perf_event_open), used by the command line tools to explain their
+    timings : cycles, instructions, L1 data cache read misses and last level
+    cache misses.
+
+    Each event has its own counter, read with its enabled and running times
+    so that counts are scaled when the kernel multiplexes more events than
+    the PMU holds. With inheritThreads the counters also count every thread
+    created afterwards (e.g. the worker pool, if it is created later), and
+    read() returns the sum over all of them.
+
+    Memory traffic is estimated as one cache line per last level miss : the
+    memory controller counters would need system wide access.
+    Counters the kernel refuses (perf_event_paranoid above 2, virtual
+    machines without a PMU, other systems) read as 0, isAvailable() tells
+    whether cycles and instructions are counted.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters {
+public:
+
+    enum Event { cycles, instructions, l1Misses, llcMisses, numEvents };
+
+    static constexpr double cacheLineBytes = 64.0;          // Bytes moved per last level miss
+
+    /* Counts of every event, scaled for multiplexing*/
+    struct Counts {
+        double values[numEvents] = {};
+
+        double operator[](int event) const {
+            return values[event];
+        }
+
+        Counts operator-(const Counts& other) const {
+            Counts difference;
+            for (int e = 0; e < numEvents; e++) {
+                difference.values[e] = values[e] - other.values[e];
+            }
+            return difference;
+        }
+
+        Counts& operator+=(const Counts& other) {
+            for (int e = 0; e < numEvents; e++) {
+                values[e] += other.values[e];
+            }
+            return *this;
+        }
+
+        /* Instructions per cycle*/
+        double getIpc() const {
+            return values[cycles] > 0.0 ? values[instructions] / values[cycles] : 0.0;
+        }
+
+        /* Estimated memory traffic (bytes)*/
+        double getMemoryBytes() const {
+            return values[llcMisses] * cacheLineBytes;
+        }
+    };
+
+    /* Opens and starts the counters of the calling thread, and of the threads it creates from now on if inheritThreads*/
+    explicit PerfCounters(bool inheritThreads = false) {
+#if JUCE_LINUX
+        const juce::uint64 l1ReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const struct { juce::uint32 type; juce::uint64 config; } events[numEvents] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, l1ReadMiss },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }
+        };
+        for (int e = 0; e < numEvents; e++) {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = events[e].type;
+            attr.config = events[e].config;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = inheritThreads ? 1 : 0;
+            fds[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#else
+        juce::ignoreUnused(inheritThreads);
+#endif
+    }
+
+    ~PerfCounters() {
+#if JUCE_LINUX
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    /* True if cycles and instructions are counted*/
+    bool isAvailable() const {
+        return fds[cycles] >= 0 && fds[instructions] >= 0;
+    }
+
+    /* Counts since the counters were opened, take the difference of two reads around the code measured*/
+    Counts read() const {
+        Counts counts;
+#if JUCE_LINUX
+        for (int e = 0; e < numEvents; e++) {
+            juce::uint64 data[3] = {};                      // Value, time enabled, time running
+            if (fds[e] >= 0 && ::read(fds[e], data, sizeof(data)) == ssize_t(sizeof(data)) && data[2] > 0) {
+                counts.values[e] = double(data[0]) * double(data[1]) / double(data[2]);
+            }
+        }
+#endif
+        return counts;
+    }
+
+    static const char* getName(int event) {
+        static const char* names[numEvents] = { "cycles", "instructions", "l1Misses", "llcMisses" };
+        return names[event];
+    }
+
+private:
+
+    int fds[numEvents] = { -1, -1, -1, -1 };
+
+    JUCE_DECLARE_NON_COPYABLE(PerfCounters)
+};
@@ -0,0 +1,589 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Author:  Ruthu Prem Kumar
+
+    RenderServer : headless streaming renderer (Linux).
+
+    Usage : RenderServer [--socket PATH] [--rate SR] [--block N] [--channels C]
+                         [--queue BLOCKS] [--planar] [--realtime] [--stats-interval S]
+
+    Without --socket, a single stream is read from stdin and written to
+    stdout. With --socket, every connection to the Unix socket is a stream
+    of its own, with its own PluginAudioProcessor rendered on its own thread,
+    so independent streams spread over the cores.
+
+    Input, little endian records with times in samples since the start of
+    the stream (times must not decrease) :
+        int64 time, uint8 kind, then
+        kind 0 (MIDI)       : uint8 size (1-3), size bytes
+        kind 1 (parameter)  : uint8 length, parameter ID (UTF-8), float32 value in the parameter's range
+        kind 2 (advance)    : nothing, the input is complete up to time
+        kind 3 (end)        : nothing, renders up to time and ends the stream
+
+    Output : float32 samples in blocks of --block frames (default 256),
+    interleaved, or one channel after the other with --planar. A block is
+    rendered as soon as the input has reached its end, parameter changes
+    split the block so that they apply at their exact time. With --realtime
+    blocks are not rendered ahead of the wall clock and the processor uses
+    its real-time quality profile, otherwise its offline one.
+
+    Blocks pass to a writer thread through a bounded queue of --queue
+    blocks (default 8) and are written from the memory they were rendered
+    in. When the reader of the output falls behind, rendering and then
+    reading the input wait until there is room. With --planar the processor
+    renders straight into the queued block.
+
+    The statistics of a stream (latency from the input reaching the end of a
+    block to the block being written, real-time factor, backpressure waits)
+    are printed to stderr when it ends, and every --stats-interval seconds.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <map>
+#include "../../../Source/PluginProcessor.h"
+
+namespace {
+
+    std::atomic<bool> stopRequested { false };
+
+    struct Options {
+        juce::String socketPath;
+        double sampleRate = 48000.0;
+        int blockSize = 256;
+        int numChannels = 2;
+        int queueBlocks = 8;
+        bool planar = false;
+        bool realtime = false;
+        double statsInterval = 0.0;
+    };
+
+    Options parseOptions(int argc, char* argv[]) {
+        Options o;
+        for (int i = 1; i < argc; i++) {
+            juce::String name(argv[i]);
+            juce::String value(i + 1 < argc ? argv[i + 1] : "");
+            if (name == "--planar")                 o.planar = true;
+            else if (name == "--realtime")          o.realtime = true;
+            else if (name == "--socket")            o.socketPath = value, i++;
+            else if (name == "--rate")              o.sampleRate = value.getDoubleValue(), i++;
+            else if (name == "--block")             o.blockSize = juce::jmax(1, value.getIntValue()), i++;
+            else if (name == "--channels")          o.numChannels = juce::jlimit(1, String::maxPickups, value.getIntValue()), i++;
+            else if (name == "--queue")             o.queueBlocks = juce::jmax(1, value.getIntValue()), i++;
+            else if (name == "--stats-interval")    o.statsInterval = value.getDoubleValue(), i++;
+        }
+        return o;
+    }
+
+    double now() {
+        return juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks());
+    }
+
+    /* Buffered reads from a file descriptor*/
+    class FdReader {
+    public:
+        FdReader(int f) : fd(f) {}
+
+        /* Reads exactly size bytes, returns false at the end of the input*/
+        bool read(void* dest, size_t size) {
+            auto* d = static_cast<char*>(dest);
+            while (size > 0) {
+                if (position == available) {
+                    ssize_t n = ::read(fd, buffer, sizeof(buffer));
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        return false;
+                    }
+                    available = size_t(n);
+                    position = 0;
+                }
+                size_t chunk = std::min(size, available - position);
+                std::memcpy(d, buffer + position, chunk);
+                d += chunk;
+                position += chunk;
+                size -= chunk;
+            }
+            return true;
+        }
+
+    private:
+        int fd;
+        char buffer[65536];
+        size_t position = 0;
+        size_t available = 0;
+    };
+
+    /* Writes every byte, returns false if the output was closed*/
+    bool writeAll(int fd, const void* data, size_t size) {
+        auto* d = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, d, size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            d += n;
+            size -= size_t(n);
+        }
+        return true;
+    }
+
+    /* Latency, throughput and backpressure of a stream, each field has a single writer*/
+    struct StreamStats {
+        static constexpr int numBuckets = 501;                  // 0.1 ms latency buckets, the last one is >= 50 ms
+
+        std::atomic<juce::int64> blocks { 0 };
+        std::atomic<juce::int64> samples { 0 };
+        std::atomic<juce::int64> backpressureWaits { 0 };       // Blocks which waited for room in the queue
+        std::atomic<double> renderSeconds { 0.0 };              // Time spent rendering
+        std::atomic<double> totalLatency { 0.0 };
+        std::atomic<double> maxLatency { 0.0 };
+        std::atomic<juce::int64> latencyHistogram[numBuckets] {};
+
+        void addLatency(double seconds) {
+            totalLatency = totalLatency.load() + seconds;
+            maxLatency = juce::jmax(maxLatency.load(), seconds);
+            latencyHistogram[juce::jlimit(0, numBuckets - 1, int(seconds * 10000.0))]++;
+        }
+
+        /* Latency below which the given fraction of blocks were written (s)*/
+        double getPercentile(double fraction) const {
+            juce::int64 total = 0;
+            for (auto& b : latencyHistogram) {
+                total += b.load();
+            }
+            juce::int64 count = 0;
+            for (int i = 0; i < numBuckets; i++) {
+                count += latencyHistogram[i].load();
+                if (count >= fraction * double(total)) {
+                    return (i + 1) / 10000.0;
+                }
+            }
+            return numBuckets / 10000.0;
+        }
+
+        juce::String toString(double sampleRate) const {
+            juce::int64 n = juce::jmax(juce::int64(1), blocks.load());
+            double audioSeconds = samples.load() / sampleRate;
+            return juce::String(blocks.load()) + " blocks, " + juce::String(audioSeconds, 2) + " s, "
+                + juce::String(audioSeconds / juce::jmax(1e-9, renderSeconds.load()), 1) + "x real time, latency mean "
+                + juce::String(1000.0 * totalLatency.load() / n, 2) + " ms p99 " + juce::String(1000.0 * getPercentile(0.99), 1)
+                + " ms max " + juce::String(1000.0 * maxLatency.load(), 2) + " ms, "
+                + juce::String(backpressureWaits.load()) + " backpressure waits";
+        }
+    };
+
+    /* One input and output, rendered by its own processor*/
+    class Stream : private juce::Thread {
+    public:
+        Stream(int streamId, int input, int output, const Options& o, bool ownsFds)
+            : juce::Thread("RenderServer stream"), id(streamId), inputFd(input), outputFd(output),
+              options(o), closeFds(ownsFds), writer(*this) {}
+
+        ~Stream() override {
+            interrupt();
+            stopThread(10000);
+            writer.stopThread(10000);
+            if (closeFds) {
+                ::close(inputFd);
+            }
+        }
+
+        void start() {
+            startThread();
+        }
+
+        /* Unblocks the reader of a socket, so that the stream ends*/
+        void interrupt() {
+            if (closeFds) {
+                ::shutdown(inputFd, SHUT_RDWR);
+            }
+        }
+
+        bool isFinished() const {
+            return finished;
+        }
+
+        juce::String getStats() const {
+            return "stream " + juce::String(id) + " : " + stats.toString(options.sampleRate);
+        }
+
+    private:
+
+        /* Rendered samples waiting to be written*/
+        struct OutputBlock {
+            juce::HeapBlock<float> data;
+            int numFrames = 0;
+            double inputSeconds = 0.0;                          // Time the input reached the end of the block
+        };
+
+        /* Input event, MIDI or a parameter change*/
+        struct Event {
+            juce::int64 time = 0;
+            juce::RangedAudioParameter* parameter = nullptr;    // nullptr for MIDI
+            float value = 0.0f;
+            juce::uint8 data[3] = {};
+            int size = 0;
+        };
+
+        /* Writes the queued blocks in order*/
+        class Writer : public juce::Thread {
+        public:
+            Writer(Stream& s) : juce::Thread("RenderServer writer"), stream(s) {}
+
+            void run() override {
+                auto& s = stream;
+                for (;;) {
+                    juce::int64 index = s.sent.load();
+                    if (index == s.written.load(std::memory_order_acquire)) {
+                        // The last blocks may have been queued between reading written and inputDone : only stop once both agree
+                        if (s.inputDone.load() && index == s.written.load(std::memory_order_acquire)) {
+                            break;
+                        }
+                        if (!s.inputDone.load()) {
+                            s.blockReady.wait(100);
+                        }
+                        continue;
+                    }
+
+                    auto& block = s.blocks[size_t(index % s.blocks.size())];
+                    if (!writeAll(s.outputFd, block.data.get(), sizeof(float) * size_t(block.numFrames * s.options.numChannels))) {
+                        s.outputClosed = true;
+                        s.spaceAvailable.signal();
+                        break;
+                    }
+                    s.stats.addLatency(now() - block.inputSeconds);
+                    s.sent.store(index + 1, std::memory_order_release);
+                    s.spaceAvailable.signal();
+                }
+            }
+
+        private:
+            Stream& stream;
+        };
+
+        void run() override {
+            if (prepareProcessor()) {
+                writer.startThread();
+                readAndRender();
+                inputDone = true;
+                blockReady.signal();
+                writer.stopThread(-1);
+                processor->releaseResources();
+                processor.reset();
+            }
+            if (closeFds) {
+                ::shutdown(outputFd, SHUT_WR);
+            }
+            finished = true;
+        }
+
+        bool prepareProcessor() {
+            processor.reset(new PluginAudioProcessor());
+            juce::AudioProcessor::BusesLayout layout;
+            layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(options.numChannels));
+            if (!processor->setBusesLayout(layout)) {
+                std::cerr << "stream " << id << " : " << options.numChannels << " channels are not supported" << std::endl;
+                return false;
+            }
+            processor->setRateAndBufferSizeDetails(options.sampleRate, options.blockSize);
+            processor->setNonRealtime(!options.realtime);
+            processor->prepareToPlay(options.sampleRate, options.blockSize);
+
+            for (auto* p : processor->getParameters()) {
+                if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(p)) {
+                    parameterIds[ranged->paramID] = ranged;
+                }
+            }
+
+            // Output queue, allocated once
+            blocks.resize(size_t(options.queueBlocks));
+            for (auto& b : blocks) {
+                b.data.calloc(size_t(options.blockSize * options.numChannels));
+            }
+            scratch.setSize(options.numChannels, options.blockSize);
+            midi.ensureSize(4096);
+            return true;
+        }
+
+        /* Reads records until the end of the input, rendering every block they complete*/
+        void readAndRender() {
+            FdReader reader(inputFd);
+            startSeconds = now();
+            juce::int64 endTime = -1;
+
+            while (!threadShouldExit() && !outputClosed) {
+                juce::int64 time;
+                juce::uint8 kind;
+                if (!reader.read(&time, 8) || !reader.read(&kind, 1)) {
+                    break;
+                }
+                time = juce::jmax(time, inputTime);
+
+                if (kind == 0 || kind == 1) {
+                    Event e;
+                    e.time = time;
+                    juce::uint8 size;
+                    if (!reader.read(&size, 1)) {
+                        break;
+                    }
+                    if (kind == 0) {
+                        e.size = juce::jlimit(0, 3, int(size));
+                        if (!reader.read(e.data, size_t(e.size))) {
+                            break;
+                        }
+                        for (int skip = e.size; skip < size; skip++) {
+                            juce::uint8 unused;
+                            reader.read(&unused, 1);
+                        }
+                    }
+                    else {
+                        juce::HeapBlock<char> name(size_t(size) + 1, true);
+                        if (!reader.read(name.get(), size) || !reader.read(&e.value, 4)) {
+                            break;
+                        }
+                        auto found = parameterIds.find(juce::String::fromUTF8(name.get(), size));
+                        if (found == parameterIds.end()) {
+                            std::cerr << "stream " << id << " : unknown parameter " << name.get() << std::endl;
+                            continue;
+                        }
+                        e.parameter = found->second;
+                    }
+                    events.push_back(e);
+                }
+                else if (kind == 3) {
+                    endTime = time;
+                }
+                else if (kind != 2) {
+                    std::cerr << "stream " << id << " : unknown record kind " << int(kind) << std::endl;
+                    break;
+                }
+
+                inputTime = time;
+                inputSeconds = now();
+                while (renderPosition + options.blockSize <= inputTime && !outputClosed) {
+                    renderBlock(options.blockSize);
+                }
+                if (endTime >= 0) {
+                    break;
+                }
+            }
+
+            // Whatever the input covered, the last block is cut short
+            if (!outputClosed && inputTime > renderPosition) {
+                renderBlock(int(inputTime - renderPosition));
+            }
+        }
+
+        /* Renders numFrames samples from renderPosition into the next output block*/
+        void renderBlock(int numFrames) {
+            // Wait for room in the queue
+            if (sent.load(std::memory_order_acquire) + juce::int64(blocks.size()) <= written.load()) {
+                stats.backpressureWaits++;
+                while (sent.load(std::memory_order_acquire) + juce::int64(blocks.size()) <= written.load() && !outputClosed) {
+                    spaceAvailable.wait(100);
+                }
+                if (outputClosed) {
+                    return;
+                }
+            }
+
+            // Stay behind the wall clock if asked to
+            if (options.realtime) {
+                double due = startSeconds + renderPosition / options.sampleRate;
+                double wait = due - now();
+                if (wait > 0.0) {
+                    juce::Thread::sleep(int(wait * 1000.0));
+                }
+            }
+
+            double renderStart = now();
+            auto& block = blocks[size_t(written.load() % blocks.size())];
+            block.numFrames = numFrames;
+            block.inputSeconds = inputSeconds;
+
+            // Planar blocks are rendered in place, interleaved ones through the scratch buffer
+            float* channels[String::maxPickups];
+            for (int c = 0; c < options.numChannels; c++) {
+                channels[c] = options.planar ? block.data.get() + c * numFrames : scratch.getWritePointer(c);
+            }
+            juce::AudioBuffer<float> output(channels, options.numChannels, numFrames);
+            output.clear();
+
+            // Split the block at parameter changes, so that they apply at their exact time
+            const juce::int64 end = renderPosition + numFrames;
+            juce::int64 segmentStart = renderPosition;
+            bool parametersChanged = false;
+            while (segmentStart < end) {
+                juce::int64 segmentEnd = end;
+                midi.clear();
+                while (nextEvent < events.size()) {
+                    auto& e = events[nextEvent];
+                    if (e.time >= segmentEnd) {
+                        break;
+                    }
+                    if (e.parameter != nullptr) {
+                        if (e.time > segmentStart) {
+                            segmentEnd = e.time;
+                            break;
+                        }
+                        e.parameter->setValueNotifyingHost(e.parameter->convertTo0to1(e.value));
+                        parametersChanged = true;
+                    }
+                    else if (e.size > 0) {
+                        midi.addEvent(e.data, e.size, int(juce::jmax(juce::int64(0), e.time - segmentStart)));
+                    }
+                    nextEvent++;
+                }
+                if (parametersChanged) {
+                    processor->updateSharedTables();                // No message loop here to call it from its timer
+                    parametersChanged = false;
+                }
+
+                juce::AudioBuffer<float> segment(output.getArrayOfWritePointers(), options.numChannels,
+                    int(segmentStart - renderPosition), int(segmentEnd - segmentStart));
+                processor->processBlock(segment, midi);
+                segmentStart = segmentEnd;
+            }
+            events.erase(events.begin(), events.begin() + std::ptrdiff_t(nextEvent));
+            nextEvent = 0;
+
+            if (!options.planar) {
+                juce::AudioDataConverters::interleaveSamples(scratch.getArrayOfReadPointers(), block.data.get(), numFrames, options.numChannels);
+            }
+
+            renderPosition = end;
+            stats.renderSeconds = stats.renderSeconds.load() + now() - renderStart;
+            stats.samples += numFrames;
+            stats.blocks++;
+            written.store(written.load() + 1, std::memory_order_release);
+            blockReady.signal();
+        }
+
+        const int id;
+        const int inputFd;
+        const int outputFd;
+        const Options options;
+        const bool closeFds;                                    // Socket streams own their connection
+
+        std::unique_ptr<PluginAudioProcessor> processor;
+        std::map<juce::String, juce::RangedAudioParameter*> parameterIds;
+
+        // Input
+        std::vector<Event> events;                              // Events not rendered yet, in time order
+        size_t nextEvent = 0;                                   // First event of the block being rendered
+        juce::int64 inputTime = 0;                              // Time the input is complete up to (samples)
+        double inputSeconds = 0.0;                              // Wall clock time inputTime was reached
+        double startSeconds = 0.0;                              // Wall clock time the stream started
+        juce::int64 renderPosition = 0;                         // Samples rendered so far
+        juce::AudioBuffer<float> scratch;                       // Planar output before interleaving
+        juce::MidiBuffer midi;
+
+        // Output queue, blocks [sent, written) wait for the writer
+        std::vector<OutputBlock> blocks;
+        std::atomic<juce::int64> written { 0 };
+        std::atomic<juce::int64> sent { 0 };
+        juce::WaitableEvent blockReady;
+        juce::WaitableEvent spaceAvailable;
+        std::atomic<bool> inputDone { false };
+        std::atomic<bool> outputClosed { false };
+        std::atomic<bool> finished { false };
+
+        StreamStats stats;
+        Writer writer;
+    };
+
+    void requestStop(int) {
+        stopRequested = true;
+    }
+
+    /* Listens on a Unix socket, every connection is a stream*/
+    int serveSocket(const Options& options) {
+        int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        options.socketPath.copyToUTF8(address.sun_path, sizeof(address.sun_path));
+        ::unlink(address.sun_path);
+        if (server < 0 || ::bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(server, 64) != 0) {
+            std::cerr << "Cannot listen on " << options.socketPath << " : " << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cerr << "Listening on " << options.socketPath << std::endl;
+
+        juce::OwnedArray<Stream> streams;
+        int nextId = 0;
+        double nextStats = now() + options.statsInterval;
+
+        while (!stopRequested) {
+            pollfd request { server, POLLIN, 0 };
+            if (::poll(&request, 1, 100) > 0) {
+                int connection = ::accept(server, nullptr, nullptr);
+                if (connection >= 0) {
+                    streams.add(new Stream(nextId++, connection, connection, options, true));
+                    streams.getLast()->start();
+                }
+            }
+
+            for (int i = streams.size(); --i >= 0;) {
+                if (streams[i]->isFinished()) {
+                    std::cerr << streams[i]->getStats() << std::endl;
+                    streams.remove(i);
+                }
+            }
+            if (options.statsInterval > 0.0 && now() >= nextStats) {
+                for (auto* s : streams) {
+                    std::cerr << s->getStats() << std::endl;
+                }
+                nextStats = now() + options.statsInterval;
+            }
+        }
+
+        for (auto* s : streams) {
+            s->interrupt();
+        }
+        streams.clear();
+        ::close(server);
+        ::unlink(address.sun_path);
+        return 0;
+    }
+
+    /* A single stream from stdin to stdout*/
+    int serveStdio(const Options& options) {
+        Stream stream(0, STDIN_FILENO, STDOUT_FILENO, options, false);
+        stream.start();
+        double nextStats = now() + options.statsInterval;
+        while (!stream.isFinished()) {
+            juce::Thread::sleep(50);
+            if (options.statsInterval > 0.0 && now() >= nextStats) {
+                std::cerr << stream.getStats() << std::endl;
+                nextStats = now() + options.statsInterval;
+            }
+        }
+        std::cerr << stream.getStats() << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInit;
+    const Options options = parseOptions(argc, argv);
+
+    ::signal(SIGPIPE, SIG_IGN);
+    ::signal(SIGINT, requestStop);
+    ::signal(SIGTERM, requestStop);
+
+    return options.socketPath.isEmpty() ? serveStdio(options) : serveSocket(options);
+}
@@ -0,0 +1,353 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Author:  Ruthu Prem Kumar
+
+    SessionReplay : plays a session trace (see SessionCapture.h) through
+    PluginAudioProcessor headless, as fast as possible, and times every block.
+
+    Usage : SessionReplay <trace.aptrace> [--repeat N] [--offline] [--timings FILE] [--retune] [--counters]
+
+    The whole trace is parsed before rendering, so that reading it does not
+    show in the timings. Each repeat renders the trace with a fresh processor,
+    blocks of the same sizes, MIDI at the same positions and parameter
+    values applied before the blocks they were recorded with. The processor
+    uses its real-time quality profile unless --offline is given, and renders
+    no note cache or key responses in the background, which would skew the
+    timings and write to the user's cache folder.
+
+    A summary (real-time factor, block load percentiles, blocks over their
+    deadline) is printed for each repeat. --timings writes one row per block
+    and repeat to an .apcol file (see ColumnarFile.h) : repeat, block,
+    samples, events, seconds and load (render time / block duration).
+
+    Replays wait for the engine tuner (see EngineTuner.h) so that a first
+    launch does not tune during the timings, --retune measures this machine
+    again before replaying.
+
+    --counters reads the hardware counters (Linux, see PerfCounters.h) of
+    every thread around each block, the worker pool included, and adds IPC,
+    cycles, L1 misses and memory bytes per sample to the summary and the
+    columns cycles, instructions, l1Misses and llcMisses to the timings.
+    Idle workers spinning for work count too, so compare replays of the
+    same trace on the same machine.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <map>
+#include "../../../Source/PluginProcessor.h"
+#include "../../Common/ColumnarFile.h"
+#include "../../Common/PerfCounters.h"
+
+namespace {
+
+    struct Options {
+        juce::File trace;
+        juce::File timings;
+        int repeat = 1;
+        bool offline = false;
+        bool retune = false;
+        bool counters = false;
+    };
+
+    /* Sample rate, block size and channels the processor is prepared with*/
+    struct Prepare {
+        double sampleRate = 0.0;
+        int samplesPerBlock = 0;
+        int numChannels = 0;
+    };
+
+    /* A recorded block, with its MIDI and the parameters changed before it*/
+    struct Block {
+        int prepare = -1;                               // Index of a prepare record coming before the block, or -1
+        int numSamples = 0;
+        std::vector<std::pair<int, float>> parameters;  // Parameter index and value
+        juce::MidiBuffer midi;
+    };
+
+    struct Trace {
+        juce::StringArray parameterIds;
+        std::vector<Prepare> prepares;
+        std::vector<Block> blocks;
+        bool complete = false;                          // The end record was found
+    };
+
+    bool parseOptions(int argc, char* argv[], Options& o) {
+        for (int i = 1; i < argc; i++) {
+            juce::String name(argv[i]);
+            juce::String value(i + 1 < argc ? argv[i + 1] : "");
+            if (name == "--offline")                o.offline = true;
+            else if (name == "--retune")            o.retune = true;
+            else if (name == "--counters")          o.counters = true;
+            else if (name == "--repeat")            o.repeat = juce::jmax(1, value.getIntValue()), i++;
+            else if (name == "--timings")           o.timings = juce::File::getCurrentWorkingDirectory().getChildFile(value), i++;
+            else if (o.trace == juce::File())       o.trace = juce::File::getCurrentWorkingDirectory().getChildFile(name);
+            else                                    return false;
+        }
+        return o.trace.existsAsFile();
+    }
+
+    /* Reads a whole trace, returns false if it is not one*/
+    bool readTrace(const juce::File& file, Trace& trace) {
+        juce::MemoryBlock data;
+        if (!file.loadFileAsData(data)) {
+            return false;
+        }
+        juce::MemoryInputStream in(data, false);
+
+        char magic[4];
+        if (in.read(magic, 4) != 4 || memcmp(magic, "APTR", 4) != 0) {
+            return false;
+        }
+        if (juce::uint32(in.readInt()) != SessionCapture::version) {
+            std::cerr << "unsupported trace version" << std::endl;
+            return false;
+        }
+        int numParameters = juce::uint16(in.readShort());
+        for (int i = 0; i < numParameters; i++) {
+            int length = juce::uint8(in.readByte());
+            juce::HeapBlock<char> name(size_t(length) + 1, true);
+            in.read(name.get(), length);
+            trace.parameterIds.add(juce::String::fromUTF8(name.get(), length));
+        }
+
+        int pendingPrepare = -1;
+        while (!in.isExhausted()) {
+            char kind = in.readByte();
+            if (kind == 'P') {
+                Prepare p;
+                p.sampleRate = in.readDouble();
+                p.samplesPerBlock = in.readInt();
+                p.numChannels = in.readInt();
+                trace.prepares.push_back(p);
+                pendingPrepare = int(trace.prepares.size()) - 1;
+            }
+            else if (kind == 'B') {
+                Block b;
+                b.prepare = pendingPrepare;
+                pendingPrepare = -1;
+                b.numSamples = in.readInt();
+                int numChanged = juce::uint16(in.readShort());
+                for (int i = 0; i < numChanged; i++) {
+                    int index = juce::uint16(in.readShort());
+                    float value = in.readFloat();
+                    b.parameters.emplace_back(index, value);
+                }
+                juce::uint32 numEvents = juce::uint32(in.readInt());
+                for (juce::uint32 i = 0; i < numEvents && !in.isExhausted(); i++) {
+                    int position = in.readInt();
+                    int size = juce::uint16(in.readShort());
+                    juce::HeapBlock<juce::uint8> bytes(size_t(juce::jmax(1, size)));
+                    if (in.read(bytes.get(), size) != size) {
+                        return true;                    // Cut short, the blocks so far can still be replayed
+                    }
+                    b.midi.addEvent(bytes.get(), size, position);
+                }
+                if (trace.prepares.empty()) {
+                    return false;
+                }
+                trace.blocks.push_back(std::move(b));
+            }
+            else if (kind == 'E') {
+                trace.complete = true;
+                break;
+            }
+            else {
+                std::cerr << "unknown record '" << kind << "', replaying the blocks before it" << std::endl;
+                break;
+            }
+        }
+        return true;
+    }
+
+    /* Prepares the processor as recorded, returns false if the layout is not supported*/
+    bool prepare(PluginAudioProcessor& processor, const Prepare& p, bool offline) {
+        processor.releaseResources();
+        juce::AudioProcessor::BusesLayout layout;
+        layout.outputBuses.add(juce::AudioChannelSet::canonicalChannelSet(p.numChannels));
+        if (!processor.setBusesLayout(layout)) {
+            std::cerr << p.numChannels << " channels are not supported" << std::endl;
+            return false;
+        }
+        processor.setRateAndBufferSizeDetails(p.sampleRate, p.samplesPerBlock);
+        processor.setNonRealtime(offline);
+        processor.prepareToPlay(p.sampleRate, p.samplesPerBlock);
+        return true;
+    }
+
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        size_t index = size_t(juce::jlimit(0.0, double(values.size() - 1), p * double(values.size() - 1)));
+        std::nth_element(values.begin(), values.begin() + std::ptrdiff_t(index), values.end());
+        return values[index];
+    }
+
+    /* Renders the trace once, adding a row per block to the timings*/
+    bool replay(const Trace& trace, const Options& options, int repeat, ColumnarFile& timings, const PerfCounters* counters) {
+        std::unique_ptr<PluginAudioProcessor> processor(new PluginAudioProcessor(false));
+
+        // Parameters of this build, by their index in the trace
+        std::map<juce::String, juce::RangedAudioParameter*> byId;
+        for (auto* p : processor->getParameters()) {
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(p)) {
+                byId[ranged->paramID] = ranged;
+            }
+        }
+        std::vector<juce::RangedAudioParameter*> parameters;
+        for (auto& id : trace.parameterIds) {
+            auto found = byId.find(id);
+            if (found == byId.end() && repeat == 0) {
+                std::cerr << "parameter " << id << " is not in this build, ignored" << std::endl;
+            }
+            parameters.push_back(found != byId.end() ? found->second : nullptr);
+        }
+
+        juce::AudioBuffer<float> buffer;
+        juce::MidiBuffer midi;
+        midi.ensureSize(4096);
+        double sampleRate = 0.0;
+        double renderSeconds = 0.0, audioSeconds = 0.0;
+        int overruns = 0;
+        PerfCounters::Counts totalCounts;
+        double totalSamples = 0.0;
+        std::vector<double> loads;
+        loads.reserve(trace.blocks.size());
+
+        for (size_t i = 0; i < trace.blocks.size(); i++) {
+            const auto& b = trace.blocks[i];
+            if (b.prepare >= 0) {
+                const auto& p = trace.prepares[size_t(b.prepare)];
+                if (!prepare(*processor, p, options.offline)) {
+                    return false;
+                }
+                sampleRate = p.sampleRate;
+                buffer.setSize(p.numChannels, juce::jmax(p.samplesPerBlock, b.numSamples));
+            }
+            if (b.numSamples > buffer.getNumSamples()) {
+                buffer.setSize(buffer.getNumChannels(), b.numSamples, false, false, true);
+            }
+            for (auto& change : b.parameters) {
+                if (change.first < int(parameters.size()) && parameters[size_t(change.first)] != nullptr) {
+                    auto* p = parameters[size_t(change.first)];
+                    p->setValueNotifyingHost(p->convertTo0to1(change.second));
+                }
+            }
+            midi.clear();
+            midi.addEvents(b.midi, 0, -1, 0);
+
+            // The host hands over a cleared buffer of the recorded size
+            juce::AudioBuffer<float> block(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), b.numSamples);
+            block.clear();
+            PerfCounters::Counts startCounts;
+            if (counters != nullptr) {
+                startCounts = counters->read();
+            }
+            auto startTicks = juce::Time::getHighResolutionTicks();
+            processor->processBlock(block, midi);
+            double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - startTicks);
+            if (counters != nullptr) {
+                PerfCounters::Counts counts = counters->read() - startCounts;
+                totalCounts += counts;
+                totalSamples += b.numSamples;
+                for (int e = 0; e < PerfCounters::numEvents; e++) {
+                    timings.getColumn(PerfCounters::getName(e)).push_back(counts[e]);
+                }
+            }
+
+            double duration = b.numSamples / sampleRate;
+            double load = duration > 0.0 ? seconds / duration : 0.0;
+            renderSeconds += seconds;
+            audioSeconds += duration;
+            overruns += load > 1.0 ? 1 : 0;
+            loads.push_back(load);
+
+            timings.getColumn("repeat").push_back(repeat);
+            timings.getColumn("block").push_back(double(i));
+            timings.getColumn("samples").push_back(b.numSamples);
+            timings.getColumn("events").push_back(b.midi.getNumEvents());
+            timings.getColumn("seconds").push_back(seconds);
+            timings.getColumn("load").push_back(load);
+        }
+        processor->releaseResources();
+
+        std::cout << "repeat " << repeat << " : " << trace.blocks.size() << " blocks, "
+            << audioSeconds << " s of audio in " << renderSeconds << " s ("
+            << (renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0) << "x real time)" << std::endl
+            << "  block load p50 " << percentile(loads, 0.5) << ", p99 " << percentile(loads, 0.99)
+            << ", max " << percentile(loads, 1.0) << ", " << overruns << " blocks over their deadline" << std::endl
+            << "  notes refused " << processor->getHealth().refused.load() << ", voices quarantined "
+            << processor->getHealth().quarantined.load() << ", flushed " << processor->getHealth().flushed.load()
+            << ", MIDI events dropped " << processor->getHealth().midiDropped.load() << std::endl;
+        if (counters != nullptr) {
+            const double samples = juce::jmax(1.0, totalSamples);
+            std::cout << "  counters : IPC " << totalCounts.getIpc() << ", " << totalCounts[PerfCounters::cycles] / samples
+                << " cycles/sample, " << totalCounts[PerfCounters::l1Misses] / samples << " L1 misses/sample, "
+                << totalCounts.getMemoryBytes() / samples << " bytes/sample" << std::endl;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInit;
+
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage : SessionReplay <trace.aptrace> [--repeat N] [--offline] [--timings FILE] [--retune] [--counters]" << std::endl;
+        return 1;
+    }
+
+    // Opened before the worker pool exists, so that its threads inherit the counters
+    std::unique_ptr<PerfCounters> counters;
+    if (options.counters) {
+        counters.reset(new PerfCounters(true));
+        if (!counters->isAvailable()) {
+            std::cerr << "Hardware counters are not available (no PMU, or see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+            return 1;
+        }
+    }
+
+    // Held for the whole run, so that the processors of every repeat share the tuned profile
+    juce::SharedResourcePointer<SharedResources> sharedResources;
+    auto& tuner = sharedResources->getEngineTuner();
+    if (options.retune) {
+        tuner.retune();
+    }
+    tuner.waitUntilTuned(-1);
+    if (auto* profile = tuner.getProfile()) {
+        std::cout << "engine profile : " << EngineTuner::describe(*profile) << std::endl;
+    }
+
+    Trace trace;
+    if (!readTrace(options.trace, trace)) {
+        std::cerr << "cannot read " << options.trace.getFullPathName() << std::endl;
+        return 1;
+    }
+    if (!trace.complete) {
+        std::cerr << "the trace is incomplete (the capture overflowed or was not stopped)" << std::endl;
+    }
+
+    ColumnarFile timings;
+    for (auto name : { "repeat", "block", "samples", "events", "seconds", "load" }) {
+        timings.addColumn(name);
+    }
+    for (int e = 0; counters != nullptr && e < PerfCounters::numEvents; e++) {
+        timings.addColumn(PerfCounters::getName(e));
+    }
+    for (int r = 0; r < options.repeat; r++) {
+        if (!replay(trace, options, r, timings, counters.get())) {
+            return 1;
+        }
+    }
+
+    if (options.timings != juce::File() && !timings.write(options.timings)) {
+        std::cerr << "cannot write " << options.timings.getFullPathName() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,378 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Author:  Ruthu Prem Kumar
+
+    SoakTest : long-running stress test of PluginAudioProcessor (Linux).
+
+    Usage : SoakTest [--hours H] [--seed S] [--max-misses M] [--max-leak-kb K]
+
+    Drives processBlock() with H hours of audio (default 2) of randomised
+    dense MIDI : chords, trills, runs, parameter automation and preset
+    switches, cycling through block sizes and sample rates.
+    Blocks are rendered as fast as possible.
+
+    malloc, calloc, realloc and free (and so operator new/delete) are hooked
+    to count allocations made on the audio thread, on the worker pool or on
+    the render-ahead thread (see RenderPipeline.h), and to track live heap bytes. RSS is sampled after every segment.
+
+    Fails (exit code 1) if anything allocates on the audio thread, if the
+    live heap or RSS grows by more than --max-leak-kb (default 1024) after
+    the warm-up segments, if more than --max-misses blocks (default 0)
+    take longer than their real-time deadline, or if the watchdog had to
+    quarantine a diverging voice (see HealthCounters).
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "../../../Source/PluginProcessor.h"
+
+//==============================================================================
+// Allocation hooks
+namespace AllocationTracker {
+    thread_local bool audioThread = false;              // Set around processBlock() by the test
+    std::atomic<juce::int64> liveBytes { 0 };           // Bytes currently allocated
+    std::atomic<juce::int64> audioAllocations { 0 };    // Allocations on the audio, worker or render-ahead threads
+    std::atomic<juce::int64> audioFrees { 0 };          // Frees on the audio, worker or render-ahead threads
+
+    inline bool isRealtime() {
+        return audioThread || WorkerPool::isWorkerThread() || RenderPipeline::isRenderThread();
+    }
+
+    inline void allocated(void* p) {
+        if (p != nullptr) {
+            liveBytes += juce::int64(malloc_usable_size(p));
+            if (isRealtime()) {
+                audioAllocations++;
+            }
+        }
+    }
+
+    inline void freed(void* p) {
+        if (p != nullptr) {
+            liveBytes -= juce::int64(malloc_usable_size(p));
+            if (isRealtime()) {
+                audioFrees++;
+            }
+        }
+    }
+}
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* p, size_t size);
+    void __libc_free(void* p);
+
+    void* malloc(size_t size) {
+        void* p = __libc_malloc(size);
+        AllocationTracker::allocated(p);
+        return p;
+    }
+
+    void* calloc(size_t count, size_t size) {
+        void* p = __libc_calloc(count, size);
+        AllocationTracker::allocated(p);
+        return p;
+    }
+
+    void* realloc(void* p, size_t size) {
+        AllocationTracker::freed(p);
+        void* q = __libc_realloc(p, size);
+        AllocationTracker::allocated(q != nullptr ? q : (size == 0 ? nullptr : p));
+        return q;
+    }
+
+    void free(void* p) {
+        AllocationTracker::freed(p);
+        __libc_free(p);
+    }
+}
+
+void* operator new(size_t size) {
+    if (void* p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+//==============================================================================
+namespace {
+
+    /* Resident set size in bytes*/
+    juce::int64 getResidentBytes() {
+        juce::int64 pages = 0, resident = 0;
+        if (FILE* f = fopen("/proc/self/statm", "r")) {
+            if (fscanf(f, "%lld %lld", &pages, &resident) != 2) {
+                resident = 0;
+            }
+            fclose(f);
+        }
+        return resident * juce::int64(sysconf(_SC_PAGESIZE));
+    }
+
+    /* Random dense MIDI, chords, trills and runs over the piano range*/
+    class MidiGenerator {
+    public:
+        MidiGenerator(juce::int64 seed) : random(seed) {}
+
+        /* Adds the events of one block*/
+        void fillBlock(juce::MidiBuffer& midi, int numSamples, double sampleRate) {
+            midi.clear();
+            for (int s = 0; s < numSamples; s++) {
+                time += 1.0 / sampleRate;
+
+                // Release notes which have been held long enough
+                for (int k = 21; k <= 108; k++) {
+                    if (offTime[k] > 0.0 && time >= offTime[k]) {
+                        midi.addEvent(juce::MidiMessage::noteOff(1, k), s);
+                        offTime[k] = 0.0;
+                    }
+                }
+
+                if (time < nextEvent) {
+                    continue;
+                }
+
+                switch (random.nextInt(4)) {
+                case 0: {
+                    // Chord of 3 to 6 notes
+                    int root = 21 + random.nextInt(70);
+                    for (int n = random.nextInt(4) + 3; n > 0; n--) {
+                        noteOn(midi, juce::jmin(108, root + random.nextInt(18)), s, 0.2 + random.nextDouble() * 2.0);
+                    }
+                    nextEvent = time + 0.05 + random.nextDouble() * 0.3;
+                    break;
+                }
+                case 1: {
+                    // Trill between neighbouring keys
+                    trillKey = 21 + random.nextInt(86);
+                    trillCount = 8 + random.nextInt(16);
+                    nextEvent = time;
+                    break;
+                }
+                default:
+                    // Single notes, or the next trill note
+                    if (trillCount > 0) {
+                        noteOn(midi, trillKey + (trillCount % 2), s, 0.06);
+                        trillCount--;
+                        nextEvent = time + 0.06;
+                    }
+                    else {
+                        noteOn(midi, 21 + random.nextInt(88), s, 0.05 + random.nextDouble() * 1.5);
+                        nextEvent = time + 0.01 + random.nextDouble() * 0.1;
+                    }
+                    break;
+                }
+            }
+        }
+
+    private:
+        void noteOn(juce::MidiBuffer& midi, int key, int sample, double duration) {
+            midi.addEvent(juce::MidiMessage::noteOn(1, key, juce::uint8(1 + random.nextInt(127))), sample);
+            offTime[key] = time + duration;
+        }
+
+        juce::Random random;
+        double time = 0.0;                                  // Time since the start (s)
+        double nextEvent = 0.0;                             // Time of the next event (s)
+        double offTime[128] = {};                           // Note off time per key (0 if off)
+        int trillKey = 60;
+        int trillCount = 0;
+    };
+
+    struct Options {
+        double hours = 2.0;
+        juce::int64 seed = 1;
+        int maxMisses = 0;
+        juce::int64 maxLeakBytes = 1024 * 1024;
+    };
+
+    Options parseOptions(int argc, char* argv[]) {
+        Options o;
+        for (int i = 1; i + 1 < argc; i += 2) {
+            juce::String name(argv[i]);
+            juce::String value(argv[i + 1]);
+            if (name == "--hours")          o.hours = value.getDoubleValue();
+            else if (name == "--seed")      o.seed = value.getLargeIntValue();
+            else if (name == "--max-misses") o.maxMisses = value.getIntValue();
+            else if (name == "--max-leak-kb") o.maxLeakBytes = value.getLargeIntValue() * 1024;
+        }
+        return o;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInit;
+    const Options options = parseOptions(argc, argv);
+
+    const double sampleRates[] = { 44100.0, 48000.0, 96000.0 };
+    const int blockSizes[] = { 32, 64, 128, 256, 512, 1024 };
+    const double segmentSeconds = 60.0;
+    const int warmUpSegments = 3;                           // One per sample rate, so that every buffer has reached its largest size
+    const int numSegments = juce::jmax(warmUpSegments + 1, int(options.hours * 3600.0 / segmentSeconds));
+
+    juce::Random random(options.seed);
+    MidiGenerator generator(options.seed);
+    std::unique_ptr<PluginAudioProcessor> processor(new PluginAudioProcessor(false));
+    processor->enableAllBuses();
+
+    // A few random presets to switch between
+    juce::Array<juce::MemoryBlock> presets;
+    for (int p = 0; p < 4; p++) {
+        for (auto* param : processor->getParameters()) {
+            param->setValueNotifyingHost(random.nextFloat());
+        }
+        juce::MemoryBlock state;
+        processor->getStateInformation(state);
+        presets.add(state);
+    }
+
+    // Block times as a fraction of the deadline, in 10% buckets (the last bucket is >= 100%)
+    juce::int64 histogram[11] = {};
+    juce::int64 totalBlocks = 0;
+    juce::int64 misses = 0;
+    juce::int64 warmLiveBytes = 0, warmResidentBytes = 0;
+    juce::int64 maxLiveGrowth = 0, maxResidentGrowth = 0;
+
+    std::cout << "segment  rate   block  allocs  live(kB)  rss(kB)  worst(%)" << std::endl;
+
+    for (int segment = 0; segment < numSegments; segment++) {
+        const double sampleRate = sampleRates[segment % 3];
+        const int blockSize = blockSizes[(segment / 3) % 6];
+        const int numChannels = processor->getTotalNumOutputChannels();
+
+        processor->setRateAndBufferSizeDetails(sampleRate, blockSize);
+        processor->prepareToPlay(sampleRate, blockSize);
+
+        juce::AudioBuffer<float> buffer(numChannels, blockSize);
+        juce::MidiBuffer midi;
+        midi.ensureSize(4096);
+        const double deadline = blockSize / sampleRate;
+        const juce::int64 allocationsBefore = AllocationTracker::audioAllocations.load();
+        double worst = 0.0;
+
+        const int numBlocks = int(segmentSeconds * sampleRate / blockSize);
+        for (int b = 0; b < numBlocks; b++) {
+            // Host side : automation, preset switches and table updates, outside the audio thread section
+            if (random.nextInt(200) == 0) {
+                auto& params = processor->getParameters();
+                params[random.nextInt(params.size())]->setValueNotifyingHost(random.nextFloat());
+            }
+            if (random.nextInt(20000) == 0) {
+                auto& state = presets.getReference(random.nextInt(presets.size()));
+                processor->setStateInformation(state.getData(), int(state.getSize()));
+            }
+            if (b % juce::jmax(1, int(0.1 * sampleRate / blockSize)) == 0) {
+                processor->updateSharedTables();
+            }
+            generator.fillBlock(midi, blockSize, sampleRate);
+            buffer.clear();
+
+            // Audio thread
+            AllocationTracker::audioThread = true;
+            auto start = juce::Time::getHighResolutionTicks();
+            processor->processBlock(buffer, midi);
+            double seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+            AllocationTracker::audioThread = false;
+
+            // The first segments are a warm-up, not judged
+            if (segment >= warmUpSegments) {
+                double load = seconds / deadline;
+                histogram[juce::jmin(10, int(load * 10.0))]++;
+                totalBlocks++;
+                worst = juce::jmax(worst, load);
+                if (load >= 1.0) {
+                    misses++;
+                }
+            }
+        }
+        processor->releaseResources();
+
+        const juce::int64 allocations = AllocationTracker::audioAllocations.load() - allocationsBefore;
+        const juce::int64 liveBytes = AllocationTracker::liveBytes.load();
+        const juce::int64 residentBytes = getResidentBytes();
+        if (segment < warmUpSegments) {
+            warmLiveBytes = liveBytes;
+            warmResidentBytes = residentBytes;
+            AllocationTracker::audioAllocations = 0;
+            AllocationTracker::audioFrees = 0;
+        }
+        else {
+            maxLiveGrowth = juce::jmax(maxLiveGrowth, liveBytes - warmLiveBytes);
+            maxResidentGrowth = juce::jmax(maxResidentGrowth, residentBytes - warmResidentBytes);
+        }
+
+        std::cout << juce::String(segment).paddedLeft(' ', 7) << juce::String(int(sampleRate)).paddedLeft(' ', 7)
+            << juce::String(blockSize).paddedLeft(' ', 7) << juce::String(allocations).paddedLeft(' ', 8)
+            << juce::String(liveBytes / 1024).paddedLeft(' ', 10) << juce::String(residentBytes / 1024).paddedLeft(' ', 9)
+            << juce::String(worst * 100.0, 1).paddedLeft(' ', 10) << std::endl;
+    }
+
+    const HealthCounters& health = processor->getHealth();
+    const int refused = health.refused.load();
+    const int quarantined = health.quarantined.load();
+    const int flushed = health.flushed.load();
+    const int midiDropped = health.midiDropped.load();
+    processor.reset();
+
+    // Report
+    std::cout << std::endl << "Block time / deadline over " << totalBlocks << " blocks" << std::endl;
+    for (int i = 0; i < 11; i++) {
+        juce::String label = i < 10 ? juce::String(i * 10) + "-" + juce::String(i * 10 + 10) + "%" : juce::String(">=100%");
+        std::cout << label.paddedLeft(' ', 10) << "  " << histogram[i] << std::endl;
+    }
+
+    const juce::int64 audioAllocations = AllocationTracker::audioAllocations.load();
+    std::cout << std::endl
+        << "Audio thread allocations : " << audioAllocations << " (frees " << AllocationTracker::audioFrees.load() << ")" << std::endl
+        << "Live heap growth : " << maxLiveGrowth / 1024 << " kB" << std::endl
+        << "RSS growth : " << maxResidentGrowth / 1024 << " kB" << std::endl
+        << "Deadline misses : " << misses << std::endl
+        << "Notes refused : " << refused << ", voices quarantined : " << quarantined << ", flushed : " << flushed << std::endl
+        << "MIDI events dropped : " << midiDropped << std::endl;
+
+    bool failed = false;
+    if (audioAllocations > 0) {
+        std::cout << "FAIL : allocations on the audio thread" << std::endl;
+        failed = true;
+    }
+    if (maxLiveGrowth > options.maxLeakBytes || maxResidentGrowth > options.maxLeakBytes) {
+        std::cout << "FAIL : memory growth" << std::endl;
+        failed = true;
+    }
+    if (misses > options.maxMisses) {
+        std::cout << "FAIL : deadline misses" << std::endl;
+        failed = true;
+    }
+    if (quarantined > 0) {
+        std::cout << "FAIL : diverging voices" << std::endl;
+        failed = true;
+    }
+    std::cout << (failed ? "FAILED" : "PASSED") << std::endl;
+    return failed ? 1 : 0;
+}
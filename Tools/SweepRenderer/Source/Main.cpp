@@ -0,0 +1,611 @@
+/*
+  ==============================================================================
+
+    Main.cpp
+    Author:  Ruthu Prem Kumar
+
+    SweepRenderer : headless parameter sweep for sound design.
+
+    Usage : SweepRenderer <spec.json>
+
+    The spec chooses any of the parameters of PluginAudioProcessor, a grid
+    or a Latin hypercube over them, and the notes to render, e.g.
+
+    {
+        "mode": "latin",                // "grid" (default) or "latin"
+        "samples": 2000,                // Number of presets for "latin"
+        "seed": 1,
+        "sampleRate": 48000,
+        "seconds": 3.0,                 // Time each note is held
+        "tail": 0.5,                    // Time rendered after the note off
+        "parameters": {
+            "youngsModulus": { "min": 100, "max": 300, "steps": 5 },
+            "density": { "min": 6000, "max": 9000, "steps": 4 }
+        },
+        "fixed": { "T60time": 6.0 },    // Overrides of the default values
+        "notes": [ { "key": 36, "velocity": 0.8 }, { "key": 60, "velocity": 0.5 } ],
+        "output": "sweep",
+        "writeAudio": true
+    }
+
+    Every preset is rendered on its own voice with the offline quality
+    profile (see QualityProfile), on all cores in parallel.
+    The output folder gets one WAV file per preset and note (if writeAudio),
+    and summary.apcol (see ColumnarFile.h) with one row per preset and note :
+    preset, key, velocity, the swept parameters, fundamental, inharmonicity,
+    t60, peak and cpuSeconds (time taken to render the note).
+
+    Usage : SweepRenderer --half-report <report.apcol> [sampleRate] [seconds]
+
+    Renders every piano key with the default parameters with fp32 grids and
+    with grids rounded to fp16 after every timestep (see
+    String::setHalfRounding()), and writes one row per key : key, fundamental
+    and t60 of both, their differences (cents and ratio) and the RMS
+    difference of the fp16 render relative to the fp32 one. This is how fp16
+    grid storage was measured and rejected : only short grids keep their
+    pitch and decay, and those are cache resident, so there is no memory
+    traffic to save.
+
+    Usage : SweepRenderer --counters <report.apcol> [sampleRate] [samples]
+
+    Reads the hardware counters (Linux, see PerfCounters.h) around each
+    stage of a timestep, run samples times (default 48000) on a struck string
+    of every piano key with the default parameters : the grid update, the
+    boundary update, the force injection, the whole String::process() and a
+    voice rendering the key. Writes one row per key : key, gridSize, strings,
+    and for each stage (grid, boundary, force, string, voice) its cycles, IPC,
+    L1 misses and memory bytes per sample, and gridCyclesPerPoint (cycles per
+    interior grid point of the grid update). Voice mixing, the sum of the
+    voice buffers into the output as done by the synthesiser, is printed
+    once per output sample.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <numeric>
+#include "../../../Source/PluginProcessor.h"
+#include "../../Common/NoteAnalysis.h"
+#include "../../Common/ColumnarFile.h"
+#include "../../Common/PerfCounters.h"
+
+namespace {
+
+    /* A parameter of the processor*/
+    struct ParameterInfo {
+        juce::String id;
+        juce::NormalisableRange<float> range;
+        float defaultValue;
+    };
+
+    /* A swept parameter*/
+    struct Dimension {
+        int parameter;                                  // Index in the parameter list
+        float min, max;
+        int steps;                                      // Grid steps
+    };
+
+    struct NoteSpec {
+        int key;
+        float velocity;
+    };
+
+    struct Result {
+        NoteAnalysis analysis;
+        double cpuSeconds = 0.0;
+    };
+
+    /* Processor which only holds the parameters, so that reading them starts no thread or cache*/
+    class ParameterHost : public juce::AudioProcessor {
+    public:
+        const juce::String getName() const override { return "ParameterHost"; }
+        void prepareToPlay(double, int) override {}
+        void releaseResources() override {}
+        void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override {}
+        double getTailLengthSeconds() const override { return 0.0; }
+        bool acceptsMidi() const override { return true; }
+        bool producesMidi() const override { return false; }
+        juce::AudioProcessorEditor* createEditor() override { return nullptr; }
+        bool hasEditor() const override { return false; }
+        int getNumPrograms() override { return 1; }
+        int getCurrentProgram() override { return 0; }
+        void setCurrentProgram(int) override {}
+        const juce::String getProgramName(int) override { return {}; }
+        void changeProgramName(int, const juce::String&) override {}
+        void getStateInformation(juce::MemoryBlock&) override {}
+        void setStateInformation(const void*, int) override {}
+    };
+
+    /* Reads the ids, ranges and defaults of PluginAudioProcessor::createParameterLayout()*/
+    std::vector<ParameterInfo> getParameterInfo() {
+        std::vector<ParameterInfo> info;
+        ParameterHost host;
+        juce::AudioProcessorValueTreeState state(host, nullptr, "ParamTree", PluginAudioProcessor::createParameterLayout());
+        for (auto* p : host.getParameters()) {
+            if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(p)) {
+                info.push_back({ ranged->paramID, ranged->getNormalisableRange(),
+                    ranged->convertFrom0to1(ranged->getDefaultValue()) });
+            }
+        }
+        return info;
+    }
+
+    /* Voice with its own parameter values, pinned to the offline profile so that the level of detail,
+       the modal hand-off and the choice of waveguides never depend on the machine or its load*/
+    class SweepVoice {
+    public:
+        SweepVoice(const std::vector<ParameterInfo>& info, const std::vector<float>& preset, double sampleRate)
+            : values(new std::atomic<float>[info.size()]) {
+            for (size_t i = 0; i < info.size(); i++) {
+                values[i] = preset[i];
+            }
+            auto ptr = [&](const char* id) {
+                for (size_t i = 0; i < info.size(); i++) {
+                    if (info[i].id == id) {
+                        return &values[i];
+                    }
+                }
+                jassertfalse;
+                return &values[0];
+            };
+            voice.setParamPointers(ptr("T60time"), ptr("gain"), ptr("velCurve"), ptr("baseVel"), ptr("choice"), ptr("youngsModulus"), ptr("density"));
+            voice.setNotePointers(ptr("interval"), ptr("freqParam"), ptr("xi"), ptr("xo"), ptr("lengthParam"), ptr("radiusParam"), ptr("lim1"), ptr("lim2"));
+            voice.setADSRPointers(ptr("attack"), ptr("decay"), ptr("sustain"), ptr("release"));
+            voice.setCurrentPlaybackSampleRate(sampleRate);
+            voice.init(float(sampleRate));
+            voice.setQuality(QualityProfile::offline());
+        }
+
+        SynthVoice voice;
+
+    private:
+        std::unique_ptr<std::atomic<float>[]> values;
+    };
+
+    void usage() {
+        std::cout << "Usage : SweepRenderer <spec.json>" << std::endl;
+        std::cout << "        SweepRenderer --half-report <report.apcol> [sampleRate] [seconds]" << std::endl;
+        std::cout << "        SweepRenderer --counters <report.apcol> [sampleRate] [samples]" << std::endl;
+    }
+
+    /* Renders a held note on a voice with the offline profile, with or without fp16 rounding of the grids*/
+    std::vector<float> renderHeld(const std::vector<ParameterInfo>& info, const std::vector<float>& preset,
+        double sampleRate, int key, int numSamples, bool halfRounding) {
+        SweepVoice sweepVoice(info, preset, sampleRate);
+        QualityProfile quality = QualityProfile::offline();
+        quality.halfRounding = halfRounding;
+        sweepVoice.voice.setQuality(quality);
+
+        juce::AudioBuffer<float> buffer(1, numSamples);
+        buffer.clear();
+        sweepVoice.voice.startNote(key, 0.8f);
+        for (int s = 0; s < numSamples; s += 512) {
+            sweepVoice.voice.renderNextBlock(buffer, s, juce::jmin(512, numSamples - s));
+        }
+        return std::vector<float>(buffer.getReadPointer(0), buffer.getReadPointer(0) + numSamples);
+    }
+
+    /* Pitch and decay of fp16 grids against the fp32 reference, for every piano key*/
+    int halfReport(int argc, char* argv[]) {
+        if (argc < 3) {
+            usage();
+            return 1;
+        }
+        juce::File output = juce::File::getCurrentWorkingDirectory().getChildFile(argv[2]);
+        const double sampleRate = argc > 3 ? juce::String(argv[3]).getDoubleValue() : 48000.0;
+        const double seconds = argc > 4 ? juce::String(argv[4]).getDoubleValue() : 3.0;
+        const int numSamples = int(seconds * sampleRate);
+
+        const std::vector<ParameterInfo> info = getParameterInfo();
+        std::vector<float> preset;
+        for (auto& p : info) {
+            preset.push_back(p.defaultValue);
+        }
+
+        ColumnarFile report;
+        auto& keyColumn = report.addColumn("key");
+        auto& fundamental = report.addColumn("fundamental");
+        auto& fundamentalHalf = report.addColumn("fundamentalHalf");
+        auto& cents = report.addColumn("cents");
+        auto& t60 = report.addColumn("t60");
+        auto& t60Half = report.addColumn("t60Half");
+        auto& t60Ratio = report.addColumn("t60Ratio");
+        auto& error = report.addColumn("error");
+
+        for (int key = 21; key <= 108; key++) {
+            std::vector<float> reference = renderHeld(info, preset, sampleRate, key, numSamples, false);
+            std::vector<float> half = renderHeld(info, preset, sampleRate, key, numSamples, true);
+            NoteAnalysis a = analyseNote(reference.data(), numSamples, sampleRate, KeyGeometry::getFrequency(key));
+            NoteAnalysis b = analyseNote(half.data(), numSamples, sampleRate, KeyGeometry::getFrequency(key));
+
+            double difference = 0.0, energy = 0.0;
+            for (int i = 0; i < numSamples; i++) {
+                difference += double(half[size_t(i)] - reference[size_t(i)]) * double(half[size_t(i)] - reference[size_t(i)]);
+                energy += double(reference[size_t(i)]) * double(reference[size_t(i)]);
+            }
+            keyColumn.push_back(key);
+            fundamental.push_back(a.fundamental);
+            fundamentalHalf.push_back(b.fundamental);
+            cents.push_back(a.fundamental > 0.0f && b.fundamental > 0.0f ? 1200.0 * std::log2(b.fundamental / a.fundamental) : 0.0);
+            t60.push_back(a.t60);
+            t60Half.push_back(b.t60);
+            t60Ratio.push_back(a.t60 > 0.0f ? b.t60 / a.t60 : 0.0);
+            error.push_back(energy > 0.0 ? std::sqrt(difference / energy) : 0.0);
+            std::cout << "key " << key << " : " << cents.back() << " cents, t60 x " << t60Ratio.back()
+                << ", error " << error.back() << std::endl;
+        }
+
+        if (!report.write(output)) {
+            std::cerr << "Could not write the report" << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << output.getFullPathName() << std::endl;
+        return 0;
+    }
+
+    /* Counts of the events of a stage*/
+    template <typename Stage>
+    PerfCounters::Counts countStage(const PerfCounters& counters, Stage&& stage) {
+        PerfCounters::Counts start = counters.read();
+        stage();
+        return counters.read() - start;
+    }
+
+    /* Adds the columns of a stage and its counts per sample*/
+    void addStage(ColumnarFile& report, const juce::String& stage, const PerfCounters::Counts& counts, int numSamples) {
+        report.getColumn(stage + "Cycles").push_back(counts[PerfCounters::cycles] / numSamples);
+        report.getColumn(stage + "Ipc").push_back(counts.getIpc());
+        report.getColumn(stage + "L1Misses").push_back(counts[PerfCounters::l1Misses] / numSamples);
+        report.getColumn(stage + "Bytes").push_back(counts.getMemoryBytes() / numSamples);
+    }
+
+    /* Hardware counters of each stage of a timestep, for every piano key*/
+    int countersReport(int argc, char* argv[]) {
+        if (argc < 3) {
+            usage();
+            return 1;
+        }
+        juce::File output = juce::File::getCurrentWorkingDirectory().getChildFile(argv[2]);
+        const double sampleRate = argc > 3 ? juce::String(argv[3]).getDoubleValue() : 48000.0;
+        const int numSamples = argc > 4 ? juce::jmax(512, juce::String(argv[4]).getIntValue()) : 48000;
+
+        PerfCounters counters;
+        if (!counters.isAvailable()) {
+            std::cerr << "Hardware counters are not available (no PMU, or see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+            return 1;
+        }
+        juce::ScopedNoDenormals noDenormals;
+
+        const std::vector<ParameterInfo> info = getParameterInfo();
+        std::vector<float> preset;
+        for (auto& p : info) {
+            preset.push_back(p.defaultValue);
+        }
+        auto value = [&](const char* id) {
+            for (size_t i = 0; i < info.size(); i++) {
+                if (info[i].id == id) {
+                    return preset[i];
+                }
+            }
+            jassertfalse;
+            return 0.0f;
+        };
+        NoteParameters p;
+        p.T60 = value("T60time");
+        p.interval = value("interval");
+        p.freqParam = value("freqParam");
+        p.baseVel = value("baseVel");
+        p.velCurve = value("velCurve");
+        p.E = value("youngsModulus");
+        p.rho = value("density");
+        p.xi = value("xi");
+        p.xo = value("xo");
+        p.lengthParam = value("lengthParam");
+        p.radiusParam = value("radiusParam");
+        p.lim1 = value("lim1");
+        p.lim2 = value("lim2");
+        std::unique_ptr<KeyTable> table(new KeyTable(p, sampleRate));
+
+        const juce::StringArray stages { "grid", "boundary", "force", "string", "voice" };
+        ColumnarFile report;
+        for (auto name : { "key", "gridSize", "strings" }) {
+            report.addColumn(name);
+        }
+        for (auto& stage : stages) {
+            for (auto counter : { "Cycles", "Ipc", "L1Misses", "Bytes" }) {
+                report.addColumn(stage + counter);
+            }
+        }
+        report.addColumn("gridCyclesPerPoint");
+
+        for (int key = 21; key <= 108; key++) {
+            const KeyGeometry& g = table->keys[key];
+            String s;
+            s.setsampleRate(float(sampleRate));
+            s.setExcCoordinates(p.xi, p.xo);
+            s.setCoefficients(g.coefficients);
+            if (!s.isStable()) {
+                std::cout << "key " << key << " : grid of " << s.getGridSize() << " points, skipped" << std::endl;
+                continue;
+            }
+            s.initGrid();
+            for (int n = 0; n < 64; n++) {
+                s.setForce(n < 32 ? 1.0f : 0.0f);
+                s.process();
+            }
+
+            // Each stage alone on the struck state, then the whole timestep
+            auto grid = countStage(counters, [&] { for (int n = 0; n < numSamples; n++) s.updateGrid(); });
+            auto boundary = countStage(counters, [&] { for (int n = 0; n < numSamples; n++) s.updateBoundary(); });
+            s.setForce(0.0f);
+            auto force = countStage(counters, [&] { for (int n = 0; n < numSamples; n++) s.addForce(); });
+            float sum = 0.0f;
+            auto timestep = countStage(counters, [&] { for (int n = 0; n < numSamples; n++) sum += s.process(); });
+
+            // A voice playing the key, strings, engine choice and pickups included
+            SweepVoice sweepVoice(info, preset, sampleRate);
+            juce::AudioBuffer<float> buffer(1, 512);
+            sweepVoice.voice.startNote(key, 0.8f);
+            auto voice = countStage(counters, [&] {
+                for (int n = 0; n < numSamples; n += 512) {
+                    buffer.clear();
+                    sweepVoice.voice.renderNextBlock(buffer, 0, juce::jmin(512, numSamples - n));
+                }
+            });
+
+            const int points = juce::jmax(1, s.getGridSize() - 4);
+            report.getColumn("key").push_back(key);
+            report.getColumn("gridSize").push_back(s.getGridSize());
+            report.getColumn("strings").push_back(g.numStrings);
+            addStage(report, "grid", grid, numSamples);
+            addStage(report, "boundary", boundary, numSamples);
+            addStage(report, "force", force, numSamples);
+            addStage(report, "string", timestep, numSamples);
+            addStage(report, "voice", voice, numSamples);
+            report.getColumn("gridCyclesPerPoint").push_back(grid[PerfCounters::cycles] / (double(numSamples) * points));
+            std::cout << "key " << key << " (N " << s.getGridSize() << ") : grid " << report.getColumn("gridCyclesPerPoint").back()
+                << " cycles/point, IPC " << grid.getIpc() << ", string " << timestep[PerfCounters::cycles] / numSamples
+                << " cycles/sample, voice " << voice[PerfCounters::cycles] / numSamples << " cycles/sample"
+                << (std::isfinite(sum) ? "" : " (diverged)") << std::endl;
+        }
+
+        // Voice mixing : 16 stereo voice buffers summed into the output, as PianoSynthesiser does
+        juce::OwnedArray<juce::AudioBuffer<float>> voiceBuffers;
+        for (int v = 0; v < 16; v++) {
+            voiceBuffers.add(new juce::AudioBuffer<float>(2, 512))->clear();
+        }
+        juce::AudioBuffer<float> mixed(2, 512);
+        mixed.clear();
+        auto mix = countStage(counters, [&] {
+            for (int n = 0; n < numSamples; n += 512) {
+                for (auto* voiceBuffer : voiceBuffers) {
+                    for (int chan = 0; chan < mixed.getNumChannels(); chan++) {
+                        mixed.addFrom(chan, 0, *voiceBuffer, chan, 0, 512);
+                    }
+                }
+            }
+        });
+        const double mixSamples = double((numSamples + 511) / 512 * 512);
+        std::cout << "voice mixing (16 voices) : " << mix[PerfCounters::cycles] / mixSamples << " cycles/sample, IPC "
+            << mix.getIpc() << ", " << mix.getMemoryBytes() / mixSamples << " bytes/sample" << std::endl;
+
+        if (!report.write(output)) {
+            std::cerr << "Could not write the report" << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << output.getFullPathName() << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    juce::ScopedJuceInitialiser_GUI juceInit;
+
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    if (juce::String(argv[1]) == "--half-report") {
+        return halfReport(argc, argv);
+    }
+    if (juce::String(argv[1]) == "--counters") {
+        return countersReport(argc, argv);
+    }
+
+    // Read the spec
+    juce::File specFile = juce::File::getCurrentWorkingDirectory().getChildFile(argv[1]);
+    juce::var spec = juce::JSON::parse(specFile);
+    if (!spec.isObject()) {
+        std::cerr << "Could not read " << specFile.getFullPathName() << std::endl;
+        return 1;
+    }
+
+    const double sampleRate = spec.getProperty("sampleRate", 48000.0);
+    const double seconds = spec.getProperty("seconds", 3.0);
+    const double tail = spec.getProperty("tail", 0.5);
+    const bool latin = spec.getProperty("mode", "grid").toString() == "latin";
+    const bool writeAudio = spec.getProperty("writeAudio", true);
+    juce::File output = specFile.getParentDirectory().getChildFile(spec.getProperty("output", "sweep").toString());
+    output.createDirectory();
+
+    const std::vector<ParameterInfo> info = getParameterInfo();
+    auto indexOf = [&info](const juce::String& id) {
+        for (size_t i = 0; i < info.size(); i++) {
+            if (info[i].id == id) {
+                return int(i);
+            }
+        }
+        return -1;
+    };
+
+    // Defaults with the fixed overrides
+    std::vector<float> base;
+    for (auto& p : info) {
+        base.push_back(p.defaultValue);
+    }
+    if (auto* fixed = spec.getProperty("fixed", {}).getDynamicObject()) {
+        for (auto& property : fixed->getProperties()) {
+            int i = indexOf(property.name.toString());
+            if (i < 0) {
+                std::cerr << "Unknown parameter " << property.name.toString() << std::endl;
+                return 1;
+            }
+            base[i] = info[i].range.snapToLegalValue(float(property.value));
+        }
+    }
+
+    // Swept dimensions
+    std::vector<Dimension> dimensions;
+    if (auto* swept = spec.getProperty("parameters", {}).getDynamicObject()) {
+        for (auto& property : swept->getProperties()) {
+            int i = indexOf(property.name.toString());
+            if (i < 0) {
+                std::cerr << "Unknown parameter " << property.name.toString() << std::endl;
+                return 1;
+            }
+            dimensions.push_back({ i, property.value.getProperty("min", info[i].range.start),
+                property.value.getProperty("max", info[i].range.end),
+                juce::jmax(1, int(property.value.getProperty("steps", 2))) });
+        }
+    }
+
+    std::vector<NoteSpec> notes;
+    if (auto* list = spec.getProperty("notes", {}).getArray()) {
+        for (auto& n : *list) {
+            notes.push_back({ int(n.getProperty("key", 60)), float(n.getProperty("velocity", 0.8)) });
+        }
+    }
+    if (notes.empty()) {
+        notes.push_back({ 60, 0.8f });
+    }
+
+    // Presets : grid (every combination of steps) or Latin hypercube (one sample per stratum and dimension)
+    std::vector<std::vector<float>> presets;
+    if (latin) {
+        const int numSamples = juce::jmax(1, int(spec.getProperty("samples", 100)));
+        juce::Random random(juce::int64(spec.getProperty("seed", 1)));
+        presets.assign(size_t(numSamples), base);
+        for (auto& d : dimensions) {
+            std::vector<int> strata(size_t(numSamples));
+            std::iota(strata.begin(), strata.end(), 0);
+            for (int i = numSamples - 1; i > 0; i--) {
+                std::swap(strata[size_t(i)], strata[size_t(random.nextInt(i + 1))]);
+            }
+            for (int s = 0; s < numSamples; s++) {
+                float x = (strata[size_t(s)] + random.nextFloat()) / numSamples;
+                presets[size_t(s)][size_t(d.parameter)] = info[size_t(d.parameter)].range.snapToLegalValue(d.min + x * (d.max - d.min));
+            }
+        }
+    }
+    else {
+        int numPresets = 1;
+        for (auto& d : dimensions) {
+            numPresets *= d.steps;
+        }
+        for (int c = 0; c < numPresets; c++) {
+            std::vector<float> preset = base;
+            int index = c;
+            for (auto& d : dimensions) {
+                int step = index % d.steps;
+                index /= d.steps;
+                float x = d.steps > 1 ? float(step) / float(d.steps - 1) : 0.5f;
+                preset[size_t(d.parameter)] = info[size_t(d.parameter)].range.snapToLegalValue(d.min + x * (d.max - d.min));
+            }
+            presets.push_back(preset);
+        }
+    }
+
+    std::cout << "Rendering " << presets.size() << " presets x " << notes.size() << " notes on "
+        << juce::SystemStats::getNumCpus() << " threads" << std::endl;
+
+    // Render every preset on its own voice, in parallel
+    std::vector<Result> results(presets.size() * notes.size());
+    const int heldSamples = int(seconds * sampleRate);
+    const int totalSamples = heldSamples + int(tail * sampleRate);
+    const int blockSize = 512;
+
+    juce::ThreadPool pool(juce::SystemStats::getNumCpus());
+    std::atomic<int> finished { 0 };
+    for (size_t c = 0; c < presets.size(); c++) {
+        pool.addJob([&, c] {
+            SweepVoice sweepVoice(info, presets[c], sampleRate);
+            juce::AudioBuffer<float> buffer(1, totalSamples);
+            juce::WavAudioFormat wav;
+
+            for (size_t n = 0; n < notes.size(); n++) {
+                buffer.clear();
+                auto start = juce::Time::getHighResolutionTicks();
+                sweepVoice.voice.startNote(notes[n].key, notes[n].velocity);
+                for (int s = 0; s < totalSamples; s += blockSize) {
+                    if (s <= heldSamples && s + blockSize > heldSamples) {
+                        sweepVoice.voice.renderNextBlock(buffer, s, heldSamples - s);
+                        sweepVoice.voice.stopNote(0.0f, true);
+                        sweepVoice.voice.renderNextBlock(buffer, heldSamples, juce::jmin(s + blockSize, totalSamples) - heldSamples);
+                    }
+                    else {
+                        sweepVoice.voice.renderNextBlock(buffer, s, juce::jmin(blockSize, totalSamples - s));
+                    }
+                }
+                Result& r = results[c * notes.size() + n];
+                r.cpuSeconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+                r.analysis = analyseNote(buffer.getReadPointer(0), heldSamples, sampleRate, KeyGeometry::getFrequency(notes[n].key));
+
+                if (writeAudio) {
+                    juce::File file = output.getChildFile("p" + juce::String(int(c)) + "_k" + juce::String(notes[n].key)
+                        + "_v" + juce::String(juce::roundToInt(notes[n].velocity * 127)) + ".wav");
+                    file.deleteFile();
+                    std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(new juce::FileOutputStream(file),
+                        sampleRate, 1, 24, {}, 0));
+                    if (writer != nullptr) {
+                        writer->writeFromAudioSampleBuffer(buffer, 0, totalSamples);
+                    }
+                }
+            }
+            finished++;
+        });
+    }
+
+    while (pool.getNumJobs() > 0) {
+        juce::Thread::sleep(1000);
+        std::cout << "\r" << finished.load() << " / " << presets.size() << std::flush;
+    }
+    std::cout << std::endl;
+
+    // Summary, one row per preset and note
+    ColumnarFile summary;
+    auto& presetColumn = summary.addColumn("preset");
+    auto& keyColumn = summary.addColumn("key");
+    auto& velocityColumn = summary.addColumn("velocity");
+    for (auto& d : dimensions) {
+        summary.addColumn(info[size_t(d.parameter)].id);
+    }
+    auto& fundamental = summary.addColumn("fundamental");
+    auto& inharmonicity = summary.addColumn("inharmonicity");
+    auto& t60 = summary.addColumn("t60");
+    auto& peak = summary.addColumn("peak");
+    auto& cpuSeconds = summary.addColumn("cpuSeconds");
+
+    for (size_t c = 0; c < presets.size(); c++) {
+        for (size_t n = 0; n < notes.size(); n++) {
+            const Result& r = results[c * notes.size() + n];
+            presetColumn.push_back(double(c));
+            keyColumn.push_back(notes[n].key);
+            velocityColumn.push_back(notes[n].velocity);
+            for (auto& d : dimensions) {
+                summary.getColumn(info[size_t(d.parameter)].id).push_back(presets[c][size_t(d.parameter)]);
+            }
+            fundamental.push_back(r.analysis.fundamental);
+            inharmonicity.push_back(r.analysis.inharmonicity);
+            t60.push_back(r.analysis.t60);
+            peak.push_back(r.analysis.peak);
+            cpuSeconds.push_back(r.cpuSeconds);
+        }
+    }
+
+    if (!summary.write(output.getChildFile("summary.apcol"))) {
+        std::cerr << "Could not write the summary" << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << output.getChildFile("summary.apcol").getFullPathName() << std::endl;
+    return 0;
+}